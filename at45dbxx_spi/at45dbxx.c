@@ -1,98 +1,402 @@
 
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
 #include <msp430.h>
+#endif
 #include <string.h>
 
 #include "spi_interface.h"
 #include "myprintf.h"
 
 #include "at45dbxx.h"
+#include "pgcache.h"
 
 #define CONFIG_AT45DB_PREWAIT
-//#define CONFIG_AT45DB_PWRSAVE
+#define CONFIG_AT45DB_PINGPONG
+#define CONFIG_AT45DB_PWRSAVE    /* Deep power-down when idle */
+//#define CONFIG_AT45DB_RDYPIN     /* RDY/BUSY wired to SPI_RDY_PIN */
+//#define CONFIG_AT45DB_DEBUG      /* Trace every read, write and erase */
 
-struct at45db_dev_s
-{
-    uint8_t  pageshift;        /* log2 of the page size (eg. 1 << 9 = 512) */
-    uint32_t npages;           /* Number of pages in the device */
-};
+#ifdef CONFIG_AT45DB_DEBUG
+#define at45db_info myprintf
+#else
+#define at45db_info(...)
+#endif
+
+/* Busy polling backoff when the RDY/BUSY pin is not used, in 10us steps:
+ * 10us doubling up to 640us between status reads, well under the shortest
+ * page program or page erase time.
+ */
+
+#define AT45DB_POLL_MIN      1
+#define AT45DB_POLL_MAX      64
+
+/* TA0 runs from ACLK (LFXT) and is the time base for the busy measurement */
+
+#define AT45DB_TICK_HZ       32768UL
+
+/* Idle power-down: TA0 CCR1 checks the parts every AT45DB_PM_TICK ticks and
+ * puts those idle for longer than pmidle into deep power-down.
+ */
+
+#define AT45DB_PM_TICK       328       /* ~10ms */
+#define AT45DB_PM_IDLE       100       /* Default idle time, ms */
+#define AT45DB_PM_MAXDEV     4
+#define AT45DB_TRDPD_US      35        /* Resume from deep power-down (tRDPD) */
+
+/* Tries of a frame that times out, the repeats at SPI_SPEED_SLOW */
+
+#define AT45DB_TRIES         3
+
+/* SPI tuning: bytes per buffer transfer and rounds every divisor must pass */
+
+#define AT45DB_TUNE_CHUNK    32
+#define AT45DB_TUNE_PASSES   4
+
+/* The default instance behind the at45db_* API, on SPI_CS_PIN */
 
-struct at45db_dev_s priv;
+struct at45db_dev_s g_at45db0;
+
+volatile uint16_t g_tickhi;    /* TA0 overflow count, upper half of at45db_ticks() */
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+struct at45db_dev_s *g_pmdev[AT45DB_PM_MAXDEV];    /* Parts watched by the idle tick */
+uint8_t g_npmdev;
+volatile uint8_t g_pmhold;     /* A frame or stream owns the bus, chip select low or about to be */
+#endif
+
+/* Only the default instance is cached (see pgcache.c) */
+
+#ifdef CONFIG_AT45DB_CACHE
+#define at45db_uncache(p, o, n) do { if ((p)->cached) pgcache_invalidate(o, n); } while (0)
+#else
+#define at45db_uncache(p, o, n) ((void)0)
+#endif
 
 /* Lock and per-transaction configuration */
 
-void at45db_active(void);
-void at45db_deactive(void);
+void at45db_active(struct at45db_dev_s *priv);
+void at45db_deactive(struct at45db_dev_s *priv);
+SPI_Mode at45db_xfer(struct at45db_dev_s *priv, SPI_Xfer *xfer);
+SPI_Mode at45db_cmd(struct at45db_dev_s *priv, const uint8_t *cmd, uint8_t len);
 
 /* Power management */
 
 #ifdef CONFIG_AT45DB_PWRSAVE
-void at45db_pwrdown(void);
-void at45db_resume(void);
+void at45db_pwrdown(struct at45db_dev_s *priv);
+void at45db_resume(struct at45db_dev_s *priv);
+void at45db_pmstate(struct at45db_dev_s *priv, uint8_t state);
+void at45db_pm_tick(void);
+void at45db_pm_done(SPI_Trans *trans);
 #else
-#define  at45db_pwrdown()
-#define  at45db_resume()
+#define  at45db_pwrdown(priv)
+#define  at45db_resume(priv)
 #endif
 
-int at45db_rdid(void);
-uint8_t at45db_rdsr(void);
-uint8_t at45db_waitbusy(void);
-void at45db_pgerase(long offset);
-void at32db_chiperase(void);
-void at45db_pgwrite(uint8_t *buffer, long offset);
-
-int at45db_erase(long startblock, unsigned int nblocks);
-int at45db_bread(long startblock, unsigned int nblocks, uint8_t *buf);
-int at45db_bwrite(long startblock, unsigned int nblocks, uint8_t *buf);
-int at45db_read(long offset, unsigned int nbytes, uint8_t *buffer);
+int at45db_rdid(struct at45db_dev_s *priv);
+uint8_t at45db_rdsr(struct at45db_dev_s *priv);
+uint8_t at45db_waitbusy(struct at45db_dev_s *priv);
+uint32_t at45db_addr(struct at45db_dev_s *priv, long page, uint16_t byte);
+void at45db_timer_init(void);
+uint32_t at45db_ticks(void);
+uint32_t at45db_usec(uint32_t ticks);
+void at45db_erasecmd(struct at45db_dev_s *priv, uint8_t opcode, long page);
+long at45db_eraseop(struct at45db_dev_s *priv, long page, long end, uint8_t *kind);
+uint8_t at45db_bfcmd(struct at45db_dev_s *priv, uint8_t opcode, long page, uint8_t wait);
+void at45db_busystart(struct at45db_dev_s *priv, uint8_t opcode);
+void at45db_pgerase(struct at45db_dev_s *priv, long offset);
+void at32db_chiperase(struct at45db_dev_s *priv);
+void at45db_pgwrite(struct at45db_dev_s *priv, uint8_t *buffer, long offset);
+void at45db_bfwrite(struct at45db_dev_s *priv, uint8_t bf, uint8_t *buffer);
+void at45db_bfprogram(struct at45db_dev_s *priv, uint8_t bf, long page, uint8_t erase);
+int at45db_pgstream(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buffer, uint8_t erase);
+void at45db_bufxfer(struct at45db_dev_s *priv, uint8_t opcode, uint16_t byte, uint8_t *buf, uint8_t len,
+                    uint8_t speed);
+uint8_t at45db_tunepass(struct at45db_dev_s *priv, uint8_t salt);
+
+/* Block device operations */
+
+int at45db_blk_read(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_blk_write(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_blk_erase(struct blkdev_s *dev, long startblock, unsigned int nblocks);
+int at45db_blk_sync(struct blkdev_s *dev);
+int at45db_blk_geometry(struct blkdev_s *dev, struct blkdev_geometry_s *geo);
 
 /* Chip erase sequence */
 #define CHIP_ERASE_SIZE 4
 uint8_t g_chiperase[CHIP_ERASE_SIZE] = {0xc7, 0x94, 0x80, 0x9a};
 
-/* Sequence to program the device to binary page sizes{256, 512, 1024} */
-#define BINPGSIZE_SIZE 4
-uint8_t g_binpgsize[BINPGSIZE_SIZE] = {0x3d, 0x2a, 0x80, 0xa6};
+void at45db_active(struct at45db_dev_s *priv)
+{
+    *priv->csOut &= ~priv->csPin;
+
+    //__delay_cycles(SPI_SMCLK_HZ / 100000); // 10us
+}
+
+void at45db_deactive(struct at45db_dev_s *priv)
+{
+    *priv->csOut |= priv->csPin;
+
+    //__delay_cycles(SPI_SMCLK_HZ / 100000); // 10us
+}
+
+/************************************************************************************
+ * Name: at45db_xfer
+ *
+ * Description:
+ *   Clock one frame under the chip select of the part. A frame that times out
+ *   is repeated at the slow clock, up to AT45DB_TRIES in all. The aborted
+ *   frame may have gone out whole and started a program or erase, so the
+ *   repeat waits for the part to be ready (all such commands are safe to
+ *   issue twice). Returns IDLE_MODE, or TIMEOUT_MODE if every try failed.
+ *
+ ************************************************************************************/
 
-void at45db_active(void)
+SPI_Mode at45db_xfer(struct at45db_dev_s *priv, SPI_Xfer *xfer)
 {
-    SPI_CS_OUT &= ~SPI_CS_PIN;
+    SPI_Mode mode;
+    uint8_t tries = 0;
+
+    for (;;)
+    {
+        /* Frames still queued go out first: their completion raises their own
+         * chip select, which may be this one. From here on the idle tick
+         * queues nothing until our chip select is high again.
+         */
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+        g_pmhold++;
+#endif
+        SPI_Queue_Flush();
+        at45db_active(priv);
+        mode = SPI_Master_Transfer(xfer);
+        at45db_deactive(priv);
+#ifdef CONFIG_AT45DB_PWRSAVE
+        g_pmhold--;
+#endif
+
+        if (mode != TIMEOUT_MODE)
+        {
+            return mode;
+        }
+
+        if (++tries == AT45DB_TRIES)
+        {
+            priv->nfailed++;
+            myprintf("at45db: opcode %02x timed out\r\n", (unsigned long)xfer->cmd[0]);
+            return mode;
+        }
 
-    //__delay_cycles(1600); // 160=1us, 10us
+        priv->nretries++;
+        xfer->speed = SPI_SPEED_SLOW;
+
+        if (xfer->cmd[0] != AT45DB_RDSR && xfer->cmd[0] != AT45DB_RESUME)
+        {
+            at45db_waitbusy(priv);
+        }
+    }
 }
 
-void at45db_deactive(void)
+SPI_Mode at45db_cmd(struct at45db_dev_s *priv, const uint8_t *cmd, uint8_t len)
 {
-    SPI_CS_OUT |= SPI_CS_PIN;
+    SPI_Xfer xfer = {0};
 
-    //__delay_cycles(1600); // 160=1us, 10us
+    xfer.cmd = cmd;
+    xfer.cmdLen = len;
+
+    return at45db_xfer(priv, &xfer);
 }
 
 #ifdef CONFIG_AT45DB_PWRSAVE
-void at45db_pwrdown(void)
+/************************************************************************************
+ * Name: at45db_pmstate
+ *
+ * Description:
+ *   Switch to a new power state and charge the time since the last switch to
+ *   the old one. Called from the main loop and from the SPI completion ISR.
+ *
+ ************************************************************************************/
+
+void at45db_pmstate(struct at45db_dev_s *priv, uint8_t state)
 {
-    HAL_StatusTypeDef res;
-    uint8_t cmd[1] = {0, };
+    unsigned short istate;
+    uint32_t now;
 
-    at45db_active();
+    istate = __get_interrupt_state();
+    __disable_interrupt();
 
-    cmd[0] = AT45DB_PWRDOWN;
-    res = HAL_SPI_Transmit(&hspi1, cmd, sizeof(cmd), HAL_MAX_DELAY);
+    now = at45db_ticks();
+    priv->pmticks[priv->pmstate] += now - priv->pmsince;
+    priv->pmsince = now;
+    priv->pmstate = state;
 
-    at45db_deactive();
+    __set_interrupt_state(istate);
 }
 
-void at45db_resume(void)
+/************************************************************************************
+ * Name: at45db_resume
+ *
+ * Description:
+ *   Start of an access. Wakes the part from deep power-down if the idle tick
+ *   put it there, and keeps the tick away from it until at45db_pwrdown.
+ *
+ ************************************************************************************/
+
+void at45db_resume(struct at45db_dev_s *priv)
 {
-    HAL_StatusTypeDef res;
     uint8_t cmd[1] = {0, };
+    unsigned short istate;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+    priv->inuse++;
+    __set_interrupt_state(istate);
+
+    if (priv->inuse > 1)
+    {
+        return;
+    }
+
+    /* A status read or power-down queued by the idle tick goes out first */
+
+    SPI_Queue_Flush();
+
+    if (priv->pmstate == AT45DB_PM_DPD)
+    {
+        cmd[0] = AT45DB_RESUME;
+        at45db_cmd(priv, cmd, sizeof(cmd));
+
+        __delay_cycles(SPI_SMCLK_HZ / 1000000 * AT45DB_TRDPD_US);
+
+        priv->nresume++;
+    }
+
+    at45db_pmstate(priv, AT45DB_PM_ACTIVE);
+}
+
+/************************************************************************************
+ * Name: at45db_pwrdown
+ *
+ * Description:
+ *   End of an access. The part stays in standby; the idle tick powers it
+ *   down once it has not been used for pmidle.
+ *
+ ************************************************************************************/
+
+void at45db_pwrdown(struct at45db_dev_s *priv)
+{
+    unsigned short istate;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    if (priv->inuse && --priv->inuse == 0)
+    {
+        at45db_pmstate(priv, AT45DB_PM_STANDBY);
+    }
+
+    __set_interrupt_state(istate);
+}
+
+/************************************************************************************
+ * Name: at45db_pm_tick
+ *
+ * Description:
+ *   TA0 CCR1 interrupt. Queues a status read for every part that has been in
+ *   standby for pmidle; at45db_pm_done sends the power-down if the part is
+ *   ready. Nothing is queued while a blocking transfer or a stream owns the
+ *   bus: g_pmhold is taken before their chip select goes low, since
+ *   SPI_Master_Busy only covers the frame once it is clocking.
+ *
+ ************************************************************************************/
+
+void at45db_pm_tick(void)
+{
+    struct at45db_dev_s *priv;
+    SPI_Trans *trans;
+    uint8_t d;
+
+    if (SPI_Master_Busy() || g_pmhold)
+    {
+        return;
+    }
+
+    for (d = 0; d < g_npmdev; d++)
+    {
+        priv = g_pmdev[d];
+
+        if (priv->inuse || priv->pmpending || priv->pmstate != AT45DB_PM_STANDBY ||
+            priv->pmidle == 0 || at45db_ticks() - priv->pmsince < priv->pmidle)
+        {
+            continue;
+        }
+
+        trans = &priv->pmtrans;
+        trans->csOut = priv->csOut;
+        trans->csPin = priv->csPin;
+        trans->cmd[0] = AT45DB_RDSR;
+        trans->xfer.cmd = trans->cmd;
+        trans->xfer.cmdLen = 1;
+        trans->xfer.dummyLen = 0;
+        trans->xfer.txData = 0;
+        trans->xfer.rxData = &priv->pmsr;
+        trans->xfer.dataLen = 1;
+        trans->xfer.speed = SPI_SPEED_SLOW;
+        trans->done = at45db_pm_done;
+        trans->arg = priv;
+
+        priv->pmpending = 1;
+        if (!SPI_Queue_Submit(trans))
+        {
+            priv->pmpending = 0;
+        }
+    }
+}
+
+/************************************************************************************
+ * Name: at45db_pm_done
+ *
+ * Description:
+ *   Completion of the idle tick frames, in the SPI ISR. After the status read
+ *   the same descriptor goes out again as the power-down command, unless the
+ *   part became busy or was taken in the meantime.
+ *
+ ************************************************************************************/
 
-    at45db_active();
+void at45db_pm_done(SPI_Trans *trans)
+{
+    struct at45db_dev_s *priv = (struct at45db_dev_s *)trans->arg;
 
-    cmd[0] = AT45DB_RESUME;
-    res = HAL_SPI_Transmit(&hspi1, cmd, sizeof(cmd), HAL_MAX_DELAY);
+    if (trans->cmd[0] == AT45DB_RDSR)
+    {
+        if (priv->inuse == 0 && trans->status == IDLE_MODE && (priv->pmsr & AT45DB_SR_RDY))
+        {
+            /* A program or erase finished while nobody waited for it. Its time
+             * is an upper bound and the busy hook is not called from the ISR.
+             */
+
+            if (priv->busyop)
+            {
+                priv->busyusec = at45db_usec(at45db_ticks() - priv->busystart);
+                priv->busyop = 0;
+            }
+
+            trans->cmd[0] = AT45DB_PWRDOWN;
+            trans->xfer.rxData = 0;
+            trans->xfer.dataLen = 0;
+            if (SPI_Queue_Submit(trans))
+            {
+                return;
+            }
+        }
+    }
+    else if (trans->status == IDLE_MODE)
+    {
+        at45db_pmstate(priv, AT45DB_PM_DPD);
+    }
 
-    at45db_deactive();
-    DWT_Delay_us(50);
+    priv->pmpending = 0;
 }
 #endif
 
@@ -100,22 +404,21 @@ void at45db_resume(void)
  * Name: at45db_rdid
  ************************************************************************************/
 
-int at45db_rdid(void)
+int at45db_rdid(struct at45db_dev_s *priv)
 {
     uint8_t capacity;
 
     uint8_t cmd[1] = {0, };
     uint8_t devid[4] = {0, };
-
-    at45db_active();
+    SPI_Xfer xfer = {0};
 
     cmd[0] = AT45DB_RDDEVID;
 
-    SPI_Master_ReadReg(cmd, sizeof(cmd), sizeof(devid));
-    CopyArray(ReceiveBuffer, devid, sizeof(devid));
-    memset(ReceiveBuffer, 0x00, sizeof(ReceiveBuffer));
-
-    at45db_deactive();
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.rxData = devid;
+    xfer.dataLen = sizeof(devid);
+    at45db_xfer(priv, &xfer);
 
     myprintf("manufacturer: %02x devid1: %02x devid2: %02x\r\n", (unsigned long)devid[0], (unsigned long)devid[1], (unsigned long)devid[2]);
 
@@ -135,22 +438,25 @@ int at45db_rdid(void)
         case AT45DB_DEVID1_1MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB011 */
 
-            priv.pageshift   = 8;    /* Page size = 256 bytes */
-            priv.npages      = 512;  /* 512 pages */
+            priv->pageshift   = 8;    /* Page size = 256 bytes */
+            priv->npages      = 512;  /* 512 pages */
+            priv->sectpages   = 128;  /* 128 pages per sector */
             return 1;
 
         case AT45DB_DEVID1_2MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB021 */
 
-            priv.pageshift   = 8;    /* Page size = 256/264 bytes */
-            priv.npages      = 1024; /* 1024 pages */
+            priv->pageshift   = 8;    /* Page size = 256/264 bytes */
+            priv->npages      = 1024; /* 1024 pages */
+            priv->sectpages   = 128;  /* 128 pages per sector */
             return 1;
 
         case AT45DB_DEVID1_4MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB041 */
 
-            priv.pageshift   = 8;    /* Page size = 256/264 bytes */
-            priv.npages      = 2048; /* 2048 pages */
+            priv->pageshift   = 8;    /* Page size = 256/264 bytes */
+            priv->npages      = 2048; /* 2048 pages */
+            priv->sectpages   = 256;  /* 256 pages per sector */
 
             myprintf("4MBIT DataFlash\r\n");
             return 1;
@@ -158,29 +464,33 @@ int at45db_rdid(void)
         case AT45DB_DEVID1_8MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB081 */
 
-            priv.pageshift   = 8;    /* Page size = 256/264 bytes */
-            priv.npages      = 4096; /* 4096 pages */
+            priv->pageshift   = 8;    /* Page size = 256/264 bytes */
+            priv->npages      = 4096; /* 4096 pages */
+            priv->sectpages   = 256;  /* 256 pages per sector */
             return 1;
 
         case AT45DB_DEVID1_16MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB161 */
 
-            priv.pageshift   = 9;    /* Page size = 512/528 bytes */
-            priv.npages      = 4096; /* 4096 pages */
+            priv->pageshift   = 9;    /* Page size = 512/528 bytes */
+            priv->npages      = 4096; /* 4096 pages */
+            priv->sectpages   = 256;  /* 256 pages per sector */
             return 1;
 
         case AT45DB_DEVID1_32MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB321 */
 
-            priv.pageshift   = 9;    /* Page size = 512/528 bytes */
-            priv.npages      = 8192; /* 8192 pages */
+            priv->pageshift   = 9;    /* Page size = 512/528 bytes */
+            priv->npages      = 8192; /* 8192 pages */
+            priv->sectpages   = 128;  /* 128 pages per sector */
             return 1;
 
         case AT45DB_DEVID1_64MBIT:
             /* Save the FLASH geometry for the 16Mbit AT45DB321 */
 
-            priv.pageshift   = 10;   /* Page size = 1024/1056 bytes */
-            priv.npages      = 8192; /* 8192 pages */
+            priv->pageshift   = 10;   /* Page size = 1024/1056 bytes */
+            priv->npages      = 8192; /* 8192 pages */
+            priv->sectpages   = 256;  /* 256 pages per sector */
             return 1;
 
         default:
@@ -195,40 +505,198 @@ int at45db_rdid(void)
  * Name: at45db_rdsr
  ************************************************************************************/
 
-uint8_t at45db_rdsr(void)
+uint8_t at45db_rdsr(struct at45db_dev_s *priv)
 {
     uint8_t cmd[1] = {0, };
     uint8_t status[1] = {0, };
-
-    at45db_active();
+    SPI_Xfer xfer = {0};
 
     cmd[0] = AT45DB_RDSR;
-    SPI_Master_ReadReg(cmd, sizeof(cmd), sizeof(status));
-    CopyArray(ReceiveBuffer, status, sizeof(status));
-    memset(ReceiveBuffer, 0x00, sizeof(ReceiveBuffer));
 
-    at45db_deactive();
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.rxData = status;
+    xfer.dataLen = sizeof(status);
+
+    /* A dead bus reads as all ones: ready, so busy waits end */
+
+    if (at45db_xfer(priv, &xfer) == TIMEOUT_MODE)
+    {
+        return 0xff;
+    }
 
     return status[0];
 }
 
+/************************************************************************************
+ * Name: at45db_addr
+ *
+ * Description:
+ *   24-bit command address of a byte within a page. The page number sits right
+ *   above the byte address, which is pageshift bits wide in binary page mode
+ *   and one bit wider in DataFlash mode (264/528/1056 byte pages).
+ *
+ ************************************************************************************/
+
+uint32_t at45db_addr(struct at45db_dev_s *priv, long page, uint16_t byte)
+{
+    return ((uint32_t)page << priv->pabits) | byte;
+}
+
+/************************************************************************************
+ * Name: at45db_timer_init
+ ************************************************************************************/
+
+void at45db_timer_init(void)
+{
+    g_tickhi = 0;
+    TA0CTL = TASSEL__ACLK | MC__CONTINUOUS | TACLR | TAIE;
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    TA0CCR1 = AT45DB_PM_TICK;
+    TA0CCTL1 = CCIE;
+#endif
+
+#ifdef CONFIG_AT45DB_RDYPIN
+    /* RDY/BUSY is open drain: input with pull-up, interrupt on the ready edge */
+
+    SPI_RDY_DIR &= ~SPI_RDY_PIN;
+    SPI_RDY_OUT |= SPI_RDY_PIN;
+    SPI_RDY_REN |= SPI_RDY_PIN;
+    SPI_RDY_IES &= ~SPI_RDY_PIN;
+    SPI_RDY_IFG &= ~SPI_RDY_PIN;
+#endif
+}
+
+/************************************************************************************
+ * Name: at45db_ticks
+ ************************************************************************************/
+
+uint32_t at45db_ticks(void)
+{
+    unsigned short istate;
+    uint16_t hi, lo;
+
+#ifdef CONFIG_AT45DB_SIM
+    return at45sim_ticks();
+#endif
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    hi = g_tickhi;
+    lo = TA0R;
+    if ((TA0CTL & TAIFG) && lo < 0x8000)
+    {
+        hi++;                  /* Wrapped, ISR not run yet */
+    }
+
+    __set_interrupt_state(istate);
+
+    return ((uint32_t)hi << 16) | lo;
+}
+
+/************************************************************************************
+ * Name: at45db_usec
+ *
+ * Description:
+ *   at45db_ticks() interval in microseconds, ticks * 1000000 / 32768 without
+ *   overflowing 32 bits.
+ *
+ ************************************************************************************/
+
+uint32_t at45db_usec(uint32_t ticks)
+{
+    return (ticks >> 9) * 15625 + (((ticks & 511) * 15625) >> 9);
+}
+
+/************************************************************************************
+ * Name: at45db_busystart
+ *
+ * Description:
+ *   Called right after chip select is released on a command that leaves the
+ *   device busy (program, erase, transfer).
+ *
+ ************************************************************************************/
+
+void at45db_busystart(struct at45db_dev_s *priv, uint8_t opcode)
+{
+    priv->busyop = opcode;
+    priv->busystart = at45db_ticks();
+}
+
 /************************************************************************************
  * Name: at45db_waitbusy
  ************************************************************************************/
 
-uint8_t at45db_waitbusy(void)
+uint8_t at45db_waitbusy(struct at45db_dev_s *priv)
 {
     uint8_t sr;
+    uint32_t ticks;
+    unsigned int delay = AT45DB_POLL_MIN;
+    unsigned int i;
+
+#ifdef CONFIG_AT45DB_RDYPIN
+    unsigned short istate;
 
-    /* Poll the device, waiting for it to report that it is ready */
+    if (priv->rdypin)
+    {
+        /* Sleep in LPM3 until the RDY/BUSY pin goes high. The flag is cleared with
+         * interrupts off, so an edge after that still wakes the LPM3 entry below.
+         */
+
+        istate = __get_interrupt_state();
+        __disable_interrupt();
+
+        while ((SPI_RDY_IN & SPI_RDY_PIN) == 0)
+        {
+            SPI_RDY_IFG &= ~SPI_RDY_PIN;
+            SPI_RDY_IE |= SPI_RDY_PIN;
+            if (SPI_RDY_IN & SPI_RDY_PIN)
+            {
+                break;
+            }
+
+            __bis_SR_register(LPM3_bits + GIE);
+            __disable_interrupt();
+        }
+
+        SPI_RDY_IE &= ~SPI_RDY_PIN;
+        __set_interrupt_state(istate);
+    }
+#endif
+
+    /* Poll the device, waiting for it to report that it is ready. Back off
+     * exponentially so long erases do not flood the bus with status reads.
+     */
+
+    while (((sr = (uint8_t)at45db_rdsr(priv)) & AT45DB_SR_RDY) == 0)
+    {
+        for (i = 0; i < delay; i++)
+        {
+            __delay_cycles(SPI_SMCLK_HZ / 100000); // 10us
+        }
+
+        if (delay < AT45DB_POLL_MAX)
+        {
+            delay <<= 1;
+        }
+    }
 
-    do
+    if (priv->busyop)
     {
-        __delay_cycles(1600); // 10us
-        sr = (uint8_t)at45db_rdsr();
-        //myprintf(".");
+        /* ticks * 1000000 / 32768 without overflowing 32 bits */
+
+        ticks = at45db_ticks() - priv->busystart;
+        priv->busyusec = at45db_usec(ticks);
+
+        if (priv->busyhook)
+        {
+            priv->busyhook(priv->busyop, priv->busyusec);
+        }
+
+        priv->busyop = 0;
     }
-    while ((sr & AT45DB_SR_RDY) == 0);
 
     return sr;
 }
@@ -238,12 +706,12 @@ uint8_t at45db_waitbusy(void)
  * Name:  at45db_pgerase
  ************************************************************************************/
 
-void at45db_pgerase(long sector)
+void at45db_pgerase(struct at45db_dev_s *priv, long sector)
 {
     uint8_t cmd[4] = {0, };
-    uint32_t offset = sector << priv.pageshift;
+    uint32_t offset = at45db_addr(priv, sector, 0);
 
-    myprintf("sector: %08lx\r\n", (unsigned long)sector);
+    at45db_info("sector: %08lx\r\n", (unsigned long)sector);
 
     /* Higher performance write logic:  We leave the chip busy after write and erase
      * operations.  This improves write and erase performance because we do not have
@@ -253,7 +721,7 @@ void at45db_pgerase(long sector)
      */
 
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
     /* "The Page Erase command can be used to individually erase any page in the main
@@ -265,6 +733,8 @@ void at45db_pgerase(long sector)
      *  RDY/BUSY pin will indicate that the part is busy."
      */
 
+    at45db_uncache(priv, sector * priv->pagesize, priv->pagesize);
+
     cmd[0] = AT45DB_PGERASE;   /* Page erase command */
     cmd[1] = (offset >> 16) & 0xff; /* 24-bit offset MS bytes */
     cmd[2] = (offset >>  8) & 0xff; /* 24-bit offset middle bytes */
@@ -272,28 +742,25 @@ void at45db_pgerase(long sector)
 
     /* Erase the page */
 
-    at45db_active();
-
-    SPI_Master_WriteReg(cmd, sizeof(cmd));
-
-    at45db_deactive();
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, AT45DB_PGERASE);
 
     /* Wait for any erase to complete if we are not trying to improve write
      * performance. (see comments above).
      */
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    myprintf("Erased\r\n");
+    at45db_info("Erased\r\n");
 }
 
 /************************************************************************************
  * Name:  at32db_chiperase
  ************************************************************************************/
 
-void at32db_chiperase(void)
+void at32db_chiperase(struct at45db_dev_s *priv)
 {
     /* Higher performance write logic:  We leave the chip busy after write and erase
      * operations.  This improves write and erase performance because we do not have
@@ -303,7 +770,7 @@ void at32db_chiperase(void)
      */
 
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
     /* "The entire main memory can be erased at one time by using the Chip Erase
@@ -314,18 +781,20 @@ void at32db_chiperase(void)
      * Erase command will not affect sectors that are protected or locked down...
      */
 
-    at45db_active();
-
-    SPI_Master_WriteReg(g_chiperase, CHIP_ERASE_SIZE);
+    if (priv->cached)
+    {
+        pgcache_flush();
+    }
 
-    at45db_deactive();
+    at45db_cmd(priv, g_chiperase, CHIP_ERASE_SIZE);
+    at45db_busystart(priv, AT45DB_CHIPERASE1);
 
     /* Wait for any erase to complete if we are not trying to improve write
      * performance. (see comments above).
      */
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 }
 
@@ -333,13 +802,13 @@ void at32db_chiperase(void)
  * Name:  at45db_pgwrite
  ************************************************************************************/
 
-void at45db_pgwrite(uint8_t *buffer, long page)
+void at45db_pgwrite(struct at45db_dev_s *priv, uint8_t *buffer, long page)
 {
-    //uint8_t cmd[4] = {0, };
-    uint8_t cmd[128] = {0, };
-    uint32_t offset = page << priv.pageshift;
+    uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, page, 0);
+    SPI_Xfer xfer = {0};
 
-    myprintf("page: %08lx offset: %08lx\r\n", (unsigned long)page, (unsigned long)offset);
+    at45db_info("page: %08lx offset: %08lx\r\n", (unsigned long)page, (unsigned long)offset);
 
     /* We assume that sectors are not write protected */
 
@@ -356,372 +825,1635 @@ void at45db_pgwrite(uint8_t *buffer, long page)
      */
 
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    at45db_active();
-
-    CopyArray(&buffer[0], &cmd[4], (1 << priv.pageshift));
+    at45db_uncache(priv, page * priv->pagesize, priv->pagesize);
 
-    SPI_Master_WriteReg(cmd, 4 + (1 << priv.pageshift));
-
-    //SPI_Master_WriteReg(buffer, 1 << priv.pageshift);
-
-    at45db_deactive();
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.txData = buffer;
+    xfer.dataLen = priv->pagesize;
+    xfer.speed = SPI_SPEED_FAST;
+    at45db_xfer(priv, &xfer);
+    at45db_busystart(priv, AT45DB_MNTHRUBF1);
 
     /* Wait for any erase to complete if we are not trying to improve write
      * performance. (see comments above).
      */
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
-    myprintf("Written\r\n");
+    at45db_info("Written\r\n");
 }
 
 /************************************************************************************
- * Name: at45db_erase
+ * Name:  at45db_bfwrite
  ************************************************************************************/
 
-int at45db_erase(long startblock, unsigned int nblocks)
+void at45db_bfwrite(struct at45db_dev_s *priv, uint8_t bf, uint8_t *buffer)
 {
-    unsigned int pgsleft = nblocks;
-
-    myprintf("startblock: %08lx nblocks: %d\r\n", (unsigned long)startblock, (unsigned long)nblocks);
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
 
-    /* Take the lock so that we have exclusive access to the bus, then power up the
-     * FLASH device.
+    /* The device accepts data into one buffer while the other buffer programs
+     * into main memory, so there is no busy wait here. The caller only has to
+     * make sure this buffer is not the one being programmed.
      */
 
-    at45db_resume();
+    cmd[0] = (bf == 1) ? AT45DB_WRBF1 : AT45DB_WRBF2;
+    cmd[1] = 0;                     /* Start of the buffer */
+    cmd[2] = 0;
+    cmd[3] = 0;
+
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.txData = buffer;
+    xfer.dataLen = priv->pagesize;
+    xfer.speed = SPI_SPEED_FAST;
+    at45db_xfer(priv, &xfer);
+}
 
-    /* Then erase each page */
+/************************************************************************************
+ * Name:  at45db_bfprogram
+ ************************************************************************************/
 
-    while (pgsleft-- > 0)
-    {
-        /* Erase each sector */
+void at45db_bfprogram(struct at45db_dev_s *priv, uint8_t bf, long page, uint8_t erase)
+{
+    uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, page, 0);
 
-        at45db_pgerase(startblock);
-        startblock++;
+    if (erase)
+    {
+        cmd[0] = (bf == 1) ? AT45DB_BF1TOMNE : AT45DB_BF2TOMNE;
+    }
+    else
+    {
+        cmd[0] = (bf == 1) ? AT45DB_BF1TOMN : AT45DB_BF2TOMN;
     }
 
-    at45db_pwrdown();
+    cmd[1] = (offset >> 16) & 0xff; /* 24-bit address MS byte */
+    cmd[2] = (offset >>  8) & 0xff; /* 24-bit address middle byte */
+    cmd[3] =  offset        & 0xff; /* 24-bit address LS byte */
+
+    at45db_uncache(priv, page * priv->pagesize, priv->pagesize);
 
-    return (int)nblocks;
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, cmd[0]);
 }
 
 /************************************************************************************
- * Name: at45db_bread
+ * Name:  at45db_pgstream
+ *
+ * Description:
+ *   Write consecutive pages alternating between the two SRAM buffers: page N+1
+ *   is clocked into one buffer while page N programs from the other, so the
+ *   sustained rate is bound by the program time rather than program plus
+ *   transfer time. Without erase the pages must already be erased, which
+ *   programs several times faster than the built-in erase.
+ *
  ************************************************************************************/
 
-int at45db_bread(long startblock, unsigned int nblocks, uint8_t *buffer)
+int at45db_pgstream(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buffer, uint8_t erase)
 {
-    int nbytes;
+    unsigned int pgsleft = nblocks;
+    uint8_t bf = 1;
 
-    /* On this device, we can handle the block read just like the byte-oriented read */
+    /* A previous operation may still be programming from buffer 1 */
 
-    nbytes = at45db_read(startblock << priv.pageshift, nblocks << priv.pageshift, buffer);
-    if (nbytes > 0)
+#ifdef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+    while (pgsleft-- > 0)
+    {
+        at45db_bfwrite(priv, bf, buffer);         /* Overlaps the other buffer's program */
+        at45db_waitbusy(priv);
+        at45db_bfprogram(priv, bf, startblock, erase);
+
+        buffer += priv->pagesize;
+        startblock++;
+        bf ^= 3;                            /* 1 <-> 2 */
+    }
+
+#ifndef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+    return nblocks;
+}
+
+/************************************************************************************
+ * Name:  at45db_dev_pgwrite_async
+ *
+ * Description:
+ *   Queue a page program through buffer 1 and return as soon as the frame is
+ *   on the SPI ring, so the caller can prepare the next page while this one
+ *   streams out. trans and buffer must stay untouched until done runs.
+ *
+ ************************************************************************************/
+
+int at45db_dev_pgwrite_async(struct at45db_dev_s *priv, SPI_Trans *trans, uint8_t *buffer, long page,
+                             SPI_Callback done)
+{
+    uint32_t offset = at45db_addr(priv, page, 0);
+    int ret;
+
+    /* The frame runs in the background, so the only place left to wait for the
+     * previous program or erase is before queueing this one. The idle tick
+     * queues behind it and cannot power the part down before it has gone out.
+     */
+
+    at45db_resume(priv);
+    at45db_waitbusy(priv);
+
+    trans->csOut = priv->csOut;
+    trans->csPin = priv->csPin;
+
+    trans->cmd[0] = AT45DB_MNTHRUBF1;      /* To main memory through buffer 1 */
+    trans->cmd[1] = (offset >> 16) & 0xff; /* 24-bit address MS byte */
+    trans->cmd[2] = (offset >>  8) & 0xff; /* 24-bit address middle byte */
+    trans->cmd[3] =  offset        & 0xff; /* 24-bit address LS byte */
+
+    trans->xfer.cmd = trans->cmd;
+    trans->xfer.cmdLen = 4;
+    trans->xfer.dummyLen = 0;
+    trans->xfer.txData = buffer;
+    trans->xfer.rxData = 0;
+    trans->xfer.dataLen = priv->pagesize;
+    trans->xfer.speed = SPI_SPEED_FAST;
+    trans->done = done;
+
+    at45db_uncache(priv, page * priv->pagesize, priv->pagesize);
+
+    /* The measured busy time also covers the frame transfer */
+
+    at45db_busystart(priv, AT45DB_MNTHRUBF1);
+
+    ret = SPI_Queue_Submit(trans) ? 1 : -1;
+
+    at45db_pwrdown(priv);
+
+    return ret;
+}
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+/************************************************************************************
+ * Name: at45db_dev_setidle
+ *
+ * Description:
+ *   Standby time before the part goes into deep power-down, 0 to keep it in
+ *   standby.
+ *
+ ************************************************************************************/
+
+void at45db_dev_setidle(struct at45db_dev_s *priv, uint32_t msec)
+{
+    priv->pmidle = (msec * AT45DB_TICK_HZ) / 1000;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_pmstats
+ *
+ * Description:
+ *   Time spent in each AT45DB_PM_* state since initialization, in ms.
+ *
+ ************************************************************************************/
+
+void at45db_dev_pmstats(struct at45db_dev_s *priv, uint32_t msec[AT45DB_PM_NSTATES])
+{
+    uint8_t i;
+
+    at45db_pmstate(priv, priv->pmstate);
+
+    for (i = 0; i < AT45DB_PM_NSTATES; i++)
+    {
+        msec[i] = at45db_usec(priv->pmticks[i]) / 1000;
+    }
+}
+#endif
+
+/************************************************************************************
+ * Name: at45db_erasecmd
+ *
+ * Description:
+ *   Issue a block or sector erase starting at page and leave the device busy
+ *   with it. The span dropped from the cache follows from the opcode and the
+ *   sector size of the detected part.
+ *
+ ************************************************************************************/
+
+void at45db_erasecmd(struct at45db_dev_s *priv, uint8_t opcode, long page)
+{
+    uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, page, 0);
+
+#ifdef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+    at45db_uncache(priv, page * priv->pagesize,
+                   (uint32_t)(opcode == AT45DB_SECTERASE ? priv->sectpages : PG_PER_BLOCK) * priv->pagesize);
+
+    cmd[0] = opcode;
+    cmd[1] = (offset >> 16) & 0xff; /* 24-bit offset MS bytes */
+    cmd[2] = (offset >>  8) & 0xff; /* 24-bit offset middle bytes */
+    cmd[3] =  offset        & 0xff; /* 24-bit offset LS bytes */
+
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, opcode);
+
+#ifndef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+}
+
+/************************************************************************************
+ * Name: at45db_eraseop
+ *
+ * Description:
+ *   Pick the next erase command for the range [page, end): the biggest aligned
+ *   unit that fits the range and is estimated to be quicker than the smaller
+ *   units it replaces. Sector 0 is split in 0a/0b on these parts, so it is
+ *   never sector erased. Returns the number of pages covered.
+ *
+ ************************************************************************************/
+
+long at45db_eraseop(struct at45db_dev_s *priv, long page, long end, uint8_t *kind)
+{
+    uint32_t *est = priv->erasetime;
+
+    long sect = priv->sectpages;
+
+    if (page >= sect && (page % sect) == 0 && end - page >= sect &&
+        est[AT45DB_ERASE_SECTOR] < est[AT45DB_ERASE_BLOCK] * (sect / PG_PER_BLOCK))
+    {
+        *kind = AT45DB_ERASE_SECTOR;
+        return sect;
+    }
+
+    if ((page % PG_PER_BLOCK) == 0 && end - page >= PG_PER_BLOCK &&
+        est[AT45DB_ERASE_BLOCK] < est[AT45DB_ERASE_PAGE] * PG_PER_BLOCK)
+    {
+        *kind = AT45DB_ERASE_BLOCK;
+        return PG_PER_BLOCK;
+    }
+
+    *kind = AT45DB_ERASE_PAGE;
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_erase_start
+ *
+ * Description:
+ *   Plan the erase of nblocks pages from startblock and estimate how long it
+ *   takes. The whole device goes with one chip erase when that is estimated to
+ *   be quicker. Nothing is sent to the device until at45db_erase_poll.
+ *
+ ************************************************************************************/
+
+void at45db_erase_start(struct at45db_dev_s *priv, struct at45db_erase_s *plan, long startblock,
+                        unsigned long nblocks)
+{
+    long page = startblock;
+    long end = startblock + nblocks;
+    uint8_t kind;
+
+    if (priv->erasetime[AT45DB_ERASE_PAGE] == 0)
+    {
+        /* Typical AT45DB041 figures until the device has been measured */
+
+        priv->erasetime[AT45DB_ERASE_PAGE]   = 15000UL;
+        priv->erasetime[AT45DB_ERASE_BLOCK]  = 45000UL;
+        priv->erasetime[AT45DB_ERASE_SECTOR] = 1600000UL;
+        priv->erasetime[AT45DB_ERASE_CHIP]   = 9000000UL;
+    }
+
+    plan->dev     = priv;
+    plan->page    = startblock;
+    plan->end     = end;
+    plan->kind    = AT45DB_ERASE_NKINDS;
+    plan->chip    = 0;
+    plan->estusec = 0;
+    plan->usec    = 0;
+
+    while (page < end)
+    {
+        page += at45db_eraseop(priv, page, end, &kind);
+        plan->estusec += priv->erasetime[kind];
+    }
+
+    if (startblock == 0 && end >= (long)priv->npages &&
+        priv->erasetime[AT45DB_ERASE_CHIP] < plan->estusec)
+    {
+        plan->chip    = 1;
+        plan->estusec = priv->erasetime[AT45DB_ERASE_CHIP];
+    }
+
+    plan->started = at45db_ticks();
+}
+
+/************************************************************************************
+ * Name: at45db_erase_poll
+ *
+ * Description:
+ *   Issue the next erase command of the plan if the device is ready, without
+ *   waiting for it. The caller can do other work (eg. other devices or the SPI
+ *   queue) between polls while the device erases. The measured time of each
+ *   command refines the estimate for its kind.
+ *
+ *   Returns 1 once the whole range is erased, with the actual time in
+ *   plan->usec, 0 while commands are still outstanding.
+ *
+ ************************************************************************************/
+
+int at45db_erase_poll(struct at45db_erase_s *plan)
+{
+    struct at45db_dev_s *priv = plan->dev;
+    uint32_t *est;
+    long n;
+    int ret = 0;
+
+    at45db_resume(priv);
+
+    if (priv->busyop && (at45db_rdsr(priv) & AT45DB_SR_RDY) == 0)
+    {
+        goto out;
+    }
+
+    /* Ready: account the finished command */
+
+    at45db_waitbusy(priv);
+    if (plan->kind < AT45DB_ERASE_NKINDS)
+    {
+        est = &priv->erasetime[plan->kind];
+        *est = (*est * 3 + priv->busyusec) / 4;
+        plan->kind = AT45DB_ERASE_NKINDS;
+    }
+
+    if (plan->page >= plan->end)
+    {
+        if (plan->usec == 0)
+        {
+            plan->usec = at45db_usec(at45db_ticks() - plan->started);
+        }
+
+        ret = 1;
+        goto out;
+    }
+
+    if (plan->chip)
+    {
+        at32db_chiperase(priv);
+        plan->kind = AT45DB_ERASE_CHIP;
+        plan->page = plan->end;
+        goto out;
+    }
+
+    n = at45db_eraseop(priv, plan->page, plan->end, &plan->kind);
+    switch (plan->kind)
+    {
+    case AT45DB_ERASE_SECTOR:
+        at45db_erasecmd(priv, AT45DB_SECTERASE, plan->page);
+        break;
+    case AT45DB_ERASE_BLOCK:
+        at45db_erasecmd(priv, AT45DB_BLKERASE, plan->page);
+        break;
+    default:
+        at45db_pgerase(priv, plan->page);
+        break;
+    }
+
+    plan->page += n;
+
+out:
+    at45db_pwrdown(priv);
+    return ret;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_erase
+ ************************************************************************************/
+
+int at45db_dev_erase(struct at45db_dev_s *priv, long startblock, unsigned int nblocks)
+{
+    struct at45db_erase_s plan;
+
+    at45db_info("startblock: %08lx nblocks: %d\r\n", (unsigned long)startblock, (unsigned long)nblocks);
+
+    /* Take the lock so that we have exclusive access to the bus, then power up the
+     * FLASH device.
+     */
+
+    at45db_resume(priv);
+
+    at45db_erase_start(priv, &plan, startblock, nblocks);
+    while (!at45db_erase_poll(&plan))
+    {
+        at45db_waitbusy(priv);
+    }
+
+    at45db_info("erase: estimated %u us, actual %u us\r\n", (unsigned long)plan.estusec,
+                (unsigned long)plan.usec);
+
+    at45db_pwrdown(priv);
+
+    return (int)nblocks;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_bread
+ ************************************************************************************/
+
+int at45db_dev_bread(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    int nbytes;
+
+    /* On this device, we can handle the block read just like the byte-oriented read */
+
+    nbytes = at45db_dev_read(priv, startblock * priv->pagesize, nblocks * priv->pagesize, buffer);
+    if (nbytes > 0)
+    {
+        return nbytes / priv->pagesize;
+    }
+    return nbytes;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_bwrite
+ ************************************************************************************/
+
+int at45db_dev_bwrite(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    unsigned int pgsleft = nblocks;
+
+    at45db_info("startblock: %08lx nblocks: %d\r\n", (unsigned long)startblock, (unsigned long)nblocks);
+
+    /* Power up the FLASH device */
+
+    at45db_resume(priv);
+
+    /* Write each page to FLASH */
+#ifdef CONFIG_AT45DB_PINGPONG
+    at45db_pgstream(priv, startblock, pgsleft, buffer, 1);
+#else
+    while (pgsleft-- > 0)
+    {
+        at45db_pgwrite(priv, buffer, startblock);
+        buffer += priv->pagesize;
+        startblock++;
+    }
+#endif
+
+    at45db_pwrdown(priv);
+
+    return nblocks;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_bprogram
+ *
+ * Description:
+ *   Like at45db_dev_bwrite, but for pages that are already erased (see
+ *   at45db_dev_blkerase): the buffers program without the built-in erase.
+ *
+ ************************************************************************************/
+
+int at45db_dev_bprogram(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    at45db_info("startblock: %08lx nblocks: %d\r\n", (unsigned long)startblock, (unsigned long)nblocks);
+
+    at45db_resume(priv);
+
+    at45db_pgstream(priv, startblock, nblocks, buffer, 0);
+
+    at45db_pwrdown(priv);
+
+    return nblocks;
+}
+
+/************************************************************************************
+ * Name: at45db_bfcmd
+ *
+ * Description:
+ *   Send a buffer 1 <-> main memory page command (transfer, compare, program)
+ *   and wait for it if asked to.
+ *
+ ************************************************************************************/
+
+uint8_t at45db_bfcmd(struct at45db_dev_s *priv, uint8_t opcode, long page, uint8_t wait)
+{
+    uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, page, 0);
+
+    cmd[0] = opcode;
+    cmd[1] = (offset >> 16) & 0xff; /* 24-bit address MS byte */
+    cmd[2] = (offset >>  8) & 0xff; /* 24-bit address middle byte */
+    cmd[3] =  offset        & 0xff; /* 24-bit address LS byte */
+
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, opcode);
+
+    return wait ? at45db_waitbusy(priv) : 0;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_write
+ *
+ * Description:
+ *   Write a byte range without moving whole pages over SPI: each page is copied
+ *   into buffer 1 on the chip, only the new bytes are written into the buffer,
+ *   and the buffer is programmed back with the built-in erase. Pages whose
+ *   buffer still compares equal to main memory are not programmed at all.
+ *
+ *   Returns the number of pages programmed.
+ *
+ ************************************************************************************/
+
+int at45db_dev_write(struct at45db_dev_s *priv, long offset, unsigned int nbytes, const uint8_t *buffer)
+{
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
+    unsigned int byte, n;
+    long page;
+    int nprog = 0;
+
+    at45db_info("offset: %08lx nbytes: %d\r\n", (unsigned long)offset, (unsigned long)nbytes);
+
+    at45db_resume(priv);
+
+    /* Buffer 1 must not be programming when it is loaded */
+
+    at45db_waitbusy(priv);
+
+    while (nbytes > 0)
+    {
+        page = offset / priv->pagesize;
+        byte = offset - page * priv->pagesize;
+        n    = priv->pagesize - byte;
+        if (n > nbytes)
+        {
+            n = nbytes;
+        }
+
+        /* A partial page needs the rest of its bytes in the buffer first */
+
+        if (n < priv->pagesize)
+        {
+            at45db_bfcmd(priv, AT45DB_MNTOBF1XFR, page, 1);
+        }
+
+        cmd[0] = AT45DB_WRBF1;
+        cmd[1] = 0;
+        cmd[2] = (byte >> 8) & 0xff;    /* Buffer address */
+        cmd[3] =  byte       & 0xff;
+
+        xfer.cmd = cmd;
+        xfer.cmdLen = sizeof(cmd);
+        xfer.txData = buffer;
+        xfer.dataLen = n;
+        xfer.speed = SPI_SPEED_FAST;
+
+        at45db_xfer(priv, &xfer);
+
+        /* COMP is clear when the page already holds the buffer contents */
+
+        if (at45db_bfcmd(priv, AT45DB_MNBF1CMP, page, 1) & AT45DB_SR_COMP)
+        {
+            at45db_uncache(priv, page * priv->pagesize, priv->pagesize);
+            at45db_bfcmd(priv, AT45DB_BF1TOMNE, page, 0);
+            nprog++;
+
+            /* The next page reuses buffer 1 */
+
+            if (nbytes > n)
+            {
+                at45db_waitbusy(priv);
+            }
+        }
+        else
+        {
+            at45db_info("page %d unchanged\r\n", (unsigned long)page);
+        }
+
+        buffer += n;
+        offset += n;
+        nbytes -= n;
+    }
+
+#ifndef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+    at45db_pwrdown(priv);
+
+    return nprog;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_blkerase
+ *
+ * Description:
+ *   Erase one block of PG_PER_BLOCK pages.
+ *
+ ************************************************************************************/
+
+int at45db_dev_blkerase(struct at45db_dev_s *priv, long block)
+{
+    at45db_info("block: %08lx\r\n", (unsigned long)block);
+
+    at45db_resume(priv);
+
+    at45db_erasecmd(priv, AT45DB_BLKERASE, block * PG_PER_BLOCK);
+
+    at45db_pwrdown(priv);
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_sync
+ *
+ * Description:
+ *   Wait until everything queued for the part has gone out and the last
+ *   program or erase has finished.
+ *
+ ************************************************************************************/
+
+int at45db_dev_sync(struct at45db_dev_s *priv)
+{
+    SPI_Queue_Flush();
+
+    at45db_resume(priv);
+    at45db_waitbusy(priv);
+    at45db_pwrdown(priv);
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_bufxfer
+ *
+ * Description:
+ *   Write (AT45DB_WRBF1) or read (AT45DB_RDBF1) len bytes of SRAM buffer 1
+ *   from byte on, at the given SPI speed class.
+ *
+ ************************************************************************************/
+
+void at45db_bufxfer(struct at45db_dev_s *priv, uint8_t opcode, uint16_t byte, uint8_t *buf, uint8_t len,
+                    uint8_t speed)
+{
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
+
+    cmd[0] = opcode;
+    cmd[1] = 0;
+    cmd[2] = (byte >> 8) & 0xff;
+    cmd[3] =  byte       & 0xff;
+
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    if (opcode == AT45DB_RDBF1)
+    {
+        xfer.dummyLen = 1;
+        xfer.rxData = buf;
+    }
+    else
+    {
+        xfer.txData = buf;
+    }
+    xfer.dataLen = len;
+    xfer.speed = speed;
+
+    at45db_xfer(priv, &xfer);
+}
+
+/************************************************************************************
+ * Name: at45db_tunepass
+ *
+ * Description:
+ *   One round of the tuning test at the current SPI_SPEED_FAST divisor: fill
+ *   buffer 1 with a page of pattern at the fast clock, read it back at the
+ *   slow clock (checks the writes) and at the fast clock (checks the reads).
+ *   Returns 1 if both match.
+ *
+ ************************************************************************************/
+
+uint8_t at45db_tunepass(struct at45db_dev_s *priv, uint8_t salt)
+{
+    uint8_t chunk[AT45DB_TUNE_CHUNK];
+    uint8_t rd[AT45DB_TUNE_CHUNK];
+    uint16_t byte;
+    uint8_t len, i;
+
+    for (byte = 0; byte < priv->pagesize; byte += len)
+    {
+        len = priv->pagesize - byte < AT45DB_TUNE_CHUNK ? priv->pagesize - byte : AT45DB_TUNE_CHUNK;
+
+        /* Walking bit transitions, different for every round and offset */
+
+        for (i = 0; i < len; i++)
+        {
+            chunk[i] = (uint8_t)((byte + i) * 167) ^ salt;
+        }
+
+        at45db_bufxfer(priv, AT45DB_WRBF1, byte, chunk, len, SPI_SPEED_FAST);
+
+        at45db_bufxfer(priv, AT45DB_RDBF1, byte, rd, len, SPI_SPEED_SLOW);
+        if (memcmp(rd, chunk, len) != 0)
+        {
+            return 0;
+        }
+
+        at45db_bufxfer(priv, AT45DB_RDBF1, byte, rd, len, SPI_SPEED_FAST);
+        if (memcmp(rd, chunk, len) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_tune
+ *
+ * Description:
+ *   Ramp the SPI_SPEED_FAST clock up from SPI_DIV_SLOW, halving the divisor
+ *   while every round of the buffer test passes, and keep the last good one
+ *   in FRAM. Only the SRAM buffer is used, so the array is left alone, but
+ *   buffer 1 contents are lost. Returns the divisor.
+ *
+ ************************************************************************************/
+
+int at45db_dev_tune(struct at45db_dev_s *priv)
+{
+    uint16_t div, best = SPI_DIV_SLOW;
+    uint8_t pass;
+
+    at45db_resume(priv);
+    at45db_waitbusy(priv);
+
+    for (div = SPI_DIV_SLOW; div >= SPI_DIV_MIN; div >>= 1)
+    {
+        SPI_Set_Divisor(SPI_SPEED_FAST, div);
+
+        for (pass = 0; pass < AT45DB_TUNE_PASSES; pass++)
+        {
+            if (!at45db_tunepass(priv, (uint8_t)(pass * 0x55) ^ (uint8_t)div))
+            {
+                break;
+            }
+        }
+
+        if (pass < AT45DB_TUNE_PASSES)
+        {
+            break;
+        }
+
+        best = div;
+    }
+
+    SPI_Set_Divisor(SPI_SPEED_FAST, best);
+    SPI_Save_Divisor();
+
+    at45db_pwrdown(priv);
+
+    myprintf("spi: fast divisor %d, %u Hz\r\n", (unsigned long)best, (unsigned long)(SPI_SMCLK_HZ / best));
+
+    return best;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_geometry
+ ************************************************************************************/
+
+int at45db_dev_geometry(struct at45db_dev_s *priv, struct at45db_geometry_s *geo)
+{
+    if (priv->npages == 0)
+    {
+        return -1;
+    }
+
+    geo->blocksize    = priv->pagesize;
+    geo->erasesize    = priv->pagesize * PG_PER_BLOCK;
+    geo->neraseblocks = priv->npages / PG_PER_BLOCK;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_read
+ ************************************************************************************/
+
+int at45db_dev_read(struct at45db_dev_s *priv, long offset, unsigned int nbytes, uint8_t *buffer)
+{
+#ifdef CONFIG_AT45DB_CACHE
+    if (priv->cached)
+    {
+        return pgcache_read(offset, nbytes, buffer);
+    }
+#endif
+
+    return at45db_dev_rdarray(priv, offset, nbytes, buffer);
+}
+
+/************************************************************************************
+ * Name: at45db_dev_rdarray
+ *
+ * Description:
+ *   Read straight from the array, bypassing the page cache.
+ *
+ ************************************************************************************/
+
+int at45db_dev_rdarray(struct at45db_dev_s *priv, long offset, unsigned int nbytes, uint8_t *buffer)
+{
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
+    SPI_Mode mode;
+    uint32_t addr;
+    long page;
+
+    at45db_info("offset: %08lx nbytes: %d\r\n", (unsigned long)offset, (unsigned long)nbytes);
+
+    /* offset is linear over the whole array. The continuous read runs on from
+     * the last byte of a page to the first of the next in both page modes, so
+     * only the start address needs splitting into page and byte.
+     */
+
+    if (priv->pabits == priv->pageshift)
+    {
+        addr = offset;
+    }
+    else
+    {
+        page = offset / priv->pagesize;
+        addr = at45db_addr(priv, page, offset - page * priv->pagesize);
+    }
+
+    /* Set up for the read */
+
+    cmd[0] = AT45DB_RDARRAYHF;       /* FAST_READ is safe at all supported SPI speeds. */
+    cmd[1] = (addr >> 16) & 0xff;    /* 24-bit address upper byte */
+    cmd[2] = (addr >>  8) & 0xff;    /* 24-bit address middle byte */
+    cmd[3] =  addr        & 0xff;    /* 24-bit address least significant byte */
+
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.dummyLen = 1;               /* Dummy byte */
+    xfer.rxData = buffer;            /* Straight into the caller's buffer */
+    xfer.dataLen = nbytes;
+    xfer.speed = SPI_SPEED_FAST;
+
+    /* Take the lock so that we have exclusive access to the bus, then power up the
+     * FLASH device.
+     */
+    at45db_resume(priv);
+
+    /* Higher performance write logic:  We leave the chip busy after write and erase
+     * operations.  This improves write and erase performance because we do not have
+     * to wait as long between transactions (other processing can occur while the chip
+     * is busy) but means that the chip must stay powered and that we must check if
+     * the chip is still busy on each entry point.
+     */
+
+#ifdef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+    /* Perform the read */
+    mode = at45db_xfer(priv, &xfer);
+
+    at45db_pwrdown(priv);
+
+    at45db_info("return nbytes: %d\r\n", (unsigned long)nbytes);
+
+    return mode == TIMEOUT_MODE ? -1 : (int)nbytes;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_stream
+ *
+ * Description:
+ *   Read nbytes from offset with a single continuous array read, handing the
+ *   data to consumer in chunks of up to chunk bytes. buf holds two chunks:
+ *   while the consumer works on one, the transaction queue clocks the next
+ *   into the other, and chip select stays low across the whole read, page
+ *   boundaries included. A whole-chip dump is one command.
+ *
+ *   Returns the number of bytes delivered to the consumer, or -1 if a chunk
+ *   timed out (the stream stops there).
+ *
+ ************************************************************************************/
+
+long at45db_dev_stream(struct at45db_dev_s *priv, long offset, unsigned long nbytes, uint8_t *buf, uint16_t chunk,
+                       at45db_stream_t consumer, void *arg)
+{
+    SPI_Trans trans[2];
+    unsigned long left = nbytes;
+    long done = 0;
+    uint32_t addr;
+    long page;
+    uint8_t i, inflight = 0;
+    int ret = 0;
+
+    if (nbytes == 0 || chunk == 0)
+    {
+        return 0;
+    }
+
+    if (priv->pabits == priv->pageshift)
+    {
+        addr = offset;
+    }
+    else
+    {
+        page = offset / priv->pagesize;
+        addr = at45db_addr(priv, page, offset - page * priv->pagesize);
+    }
+
+    /* Chip select is driven here, not by the queue. Only the first frame
+     * carries the command, the others continue the read.
+     */
+
+    memset(trans, 0, sizeof(trans));
+    for (i = 0; i < 2; i++)
+    {
+        trans[i].xfer.rxData = buf + i * chunk;
+        trans[i].xfer.speed = SPI_SPEED_FAST;
+    }
+
+    trans[0].cmd[0] = AT45DB_RDARRAYHF;
+    trans[0].cmd[1] = (addr >> 16) & 0xff;
+    trans[0].cmd[2] = (addr >>  8) & 0xff;
+    trans[0].cmd[3] =  addr        & 0xff;
+    trans[0].xfer.cmd = trans[0].cmd;
+    trans[0].xfer.cmdLen = 4;
+    trans[0].xfer.dummyLen = 1;
+
+    at45db_resume(priv);
+
+#ifdef CONFIG_AT45DB_PREWAIT
+    at45db_waitbusy(priv);
+#endif
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    g_pmhold++;
+#endif
+
+    /* No other frame may go out while our chip select is low */
+
+    SPI_Queue_Flush();
+    at45db_active(priv);
+
+    for (i = 0; i < 2 && left; i++)
+    {
+        trans[i].xfer.dataLen = left < chunk ? left : chunk;
+        left -= trans[i].xfer.dataLen;
+
+        SPI_Queue_Submit(&trans[i]);
+        inflight++;
+    }
+
+    for (i = 0; inflight; i ^= 1)
+    {
+        while (trans[i].status == TX_REG_ADDRESS_MODE)
+        {
+            /* The other half is still being clocked */
+        }
+
+        inflight--;
+
+        if (trans[i].status == TIMEOUT_MODE && ret >= 0)
+        {
+            /* Where the read got to is unknown, it cannot be resumed */
+
+            priv->nfailed++;
+            done = -1;
+            ret = -1;
+        }
+
+        if (ret >= 0)
+        {
+            ret = consumer(trans[i].xfer.rxData, trans[i].xfer.dataLen, arg);
+            done += trans[i].xfer.dataLen;
+        }
+
+        if (ret >= 0 && left)
+        {
+            trans[i].xfer.cmdLen = 0;
+            trans[i].xfer.dummyLen = 0;
+            trans[i].xfer.dataLen = left < chunk ? left : chunk;
+            left -= trans[i].xfer.dataLen;
+
+            SPI_Queue_Submit(&trans[i]);
+            inflight++;
+        }
+    }
+
+    at45db_deactive(priv);
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    g_pmhold--;
+#endif
+
+    at45db_pwrdown(priv);
+
+    return done;
+}
+
+/************************************************************************************
+ * Name: at45db_dev_initialize
+ *
+ * Description:
+ *   Create an initialize MTD device instance.  MTD devices are not registered
+ *   in the file system, but are created as instances that can be bound to
+ *   other functions (such as a block or character driver front end).
+ *
+ *   csOut/csPin select the part; the pin must already be a GPIO output.
+ *
+ ************************************************************************************/
+
+int at45db_dev_initialize(struct at45db_dev_s *priv, volatile uint8_t *csOut, uint8_t csPin)
+{
+    uint8_t sr;
+    int ret;
+
+    priv->csOut = csOut;
+    priv->csPin = csPin;
+    priv->busyop = 0;
+
+    priv->blk.read     = at45db_blk_read;
+    priv->blk.write    = at45db_blk_write;
+    priv->blk.erase    = at45db_blk_erase;
+    priv->blk.sync     = at45db_blk_sync;
+    priv->blk.geometry = at45db_blk_geometry;
+
+    /* Deselect the FLASH */
+    at45db_deactive(priv);
+
+    /* The time base is shared by all instances */
+
+    if ((TA0CTL & MC_3) == 0)
+    {
+        at45db_timer_init();
+    }
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    /* The part keeps its deep power-down over an MCU reset, so always resume */
+
+    priv->inuse = 0;
+    priv->pmpending = 0;
+    priv->pmstate = AT45DB_PM_DPD;
+    priv->pmsince = at45db_ticks();
+    if (priv->pmidle == 0)
+    {
+        at45db_dev_setidle(priv, AT45DB_PM_IDLE);
+    }
+#endif
+
+    at45db_resume(priv);
+
+    //while(1)
+    {
+    /* Identify the FLASH chip and get its capacity */
+    ret = at45db_rdid(priv);
+    if (ret != 1)
+    {
+        /* Unrecognized! Discard all of that work we just did and return NULL */
+
+        myprintf("Unrecognized\r\n");
+        at45db_pwrdown(priv);
+        return -1;
+    }
+
+        //for (ret = 0 ; ret < 100; ret++)
+        //    __delay_cycles(SPI_SMCLK_HZ / 1000); // 1ms
+    }
+
+    /* Get the value of the status register (as soon as the device is ready) */
+    sr = at45db_waitbusy(priv);
+
+    myprintf("status register: %02x\r\n", (unsigned long)sr);
+
+    /* Binary page mode (256, 512 or 1024 bytes) or DataFlash mode, where every
+     * page has 1/32 more bytes (264, 528 or 1056). at45db_addr encodes both, so
+     * the one time page size configuration is left as it is and the extra bytes
+     * stay usable.
+     */
+
+    if (sr & AT45DB_SR_PGSIZE)
+    {
+        priv->pagesize = 1 << priv->pageshift;
+        priv->pabits   = priv->pageshift;
+    }
+    else
+    {
+        priv->pagesize = (1 << priv->pageshift) + (1 << (priv->pageshift - 5));
+        priv->pabits   = priv->pageshift + 1;
+    }
+
+    myprintf("page size: %d\r\n", (unsigned long)priv->pagesize);
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    /* Let the idle tick watch this part */
+
+    for (ret = 0; ret < g_npmdev && g_pmdev[ret] != priv; ret++);
+    if (ret == g_npmdev && g_npmdev < AT45DB_PM_MAXDEV)
     {
-        return nbytes >> priv.pageshift;
+        g_pmdev[g_npmdev] = priv;
+        g_npmdev++;
     }
-    return nbytes;
+#endif
+
+    /* power down the device */
+    at45db_pwrdown(priv);
+
+    return 1;
 }
 
+//******************************************************************************
+// Default Instance ************************************************************
+//******************************************************************************
+
 /************************************************************************************
- * Name: at45db_bwrite
+ * Name: at45db_initialize
  ************************************************************************************/
 
-int at45db_bwrite(long startblock, unsigned int nblocks, uint8_t *buffer)
+int at45db_initialize(void)
 {
-    unsigned int pgsleft = nblocks;
+    int ret;
 
-    myprintf("startblock: %08lx nblocks: %d\r\n", (unsigned long)startblock, (unsigned long)nblocks);
+#ifdef CONFIG_AT45DB_RDYPIN
+    g_at45db0.rdypin = 1;
+#endif
 
-    /* Take the lock so that we have exclusive access to the bus, then power up the
-     * FLASH device.
-     */
+    ret = at45db_dev_initialize(&g_at45db0, &SPI_CS_OUT, SPI_CS_PIN);
+    if (ret == 1)
+    {
+        /* Tuned once, the divisor is kept in FRAM from then on */
 
-    at45db_active();
-    at45db_resume();
+        if (SPI_Saved_Divisor() == 0)
+        {
+            at45db_dev_tune(&g_at45db0);
+        }
 
-    /* Write each page to FLASH */
-    while (pgsleft-- > 0)
-    {
-        at45db_pgwrite(buffer, startblock);
-        startblock++;
+        pgcache_init(&g_at45db0);
     }
 
-    at45db_pwrdown();
-    at45db_deactive();
+    return ret;
+}
 
-    return nblocks;
+void at45db_setbusyhook(at45db_busyhook_t hook)
+{
+    g_at45db0.busyhook = hook;
 }
 
-/************************************************************************************
- * Name: at45db_read
- ************************************************************************************/
+int at45db_geometry(struct at45db_geometry_s *geo)
+{
+    return at45db_dev_geometry(&g_at45db0, geo);
+}
+
+int at45db_bread(long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    return at45db_dev_bread(&g_at45db0, startblock, nblocks, buffer);
+}
+
+int at45db_bwrite(long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    return at45db_dev_bwrite(&g_at45db0, startblock, nblocks, buffer);
+}
+
+int at45db_bprogram(long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    return at45db_dev_bprogram(&g_at45db0, startblock, nblocks, buffer);
+}
+
+int at45db_blkerase(long block)
+{
+    return at45db_dev_blkerase(&g_at45db0, block);
+}
+
+int at45db_erase(long startblock, unsigned int nblocks)
+{
+    return at45db_dev_erase(&g_at45db0, startblock, nblocks);
+}
 
 int at45db_read(long offset, unsigned int nbytes, uint8_t *buffer)
 {
-    uint8_t cmd[5] = {0, };
+    return at45db_dev_read(&g_at45db0, offset, nbytes, buffer);
+}
 
-    myprintf("offset: %08lx nbytes: %d\r\n", (unsigned long)offset, (unsigned long)nbytes);
+int at45db_rdarray(long offset, unsigned int nbytes, uint8_t *buffer)
+{
+    return at45db_dev_rdarray(&g_at45db0, offset, nbytes, buffer);
+}
 
-    /* Set up for the read */
+long at45db_stream(long offset, unsigned long nbytes, uint8_t *buf, uint16_t chunk, at45db_stream_t consumer, void *arg)
+{
+    return at45db_dev_stream(&g_at45db0, offset, nbytes, buf, chunk, consumer, arg);
+}
 
-    cmd[0] = AT45DB_RDARRAYHF;       /* FAST_READ is safe at all supported SPI speeds. */
-    cmd[1] = (offset >> 16) & 0xff;  /* 24-bit address upper byte */
-    cmd[2] = (offset >>  8) & 0xff;  /* 24-bit address middle byte */
-    cmd[3] =  offset        & 0xff;  /* 24-bit address least significant byte */
-    cmd[4] = 0;                      /* Dummy byte */
+int at45db_write(long offset, unsigned int nbytes, const uint8_t *buffer)
+{
+    return at45db_dev_write(&g_at45db0, offset, nbytes, buffer);
+}
 
-    /* Take the lock so that we have exclusive access to the bus, then power up the
-     * FLASH device.
-     */
-    at45db_resume();
+int at45db_pgwrite_async(SPI_Trans *trans, uint8_t *buffer, long page, SPI_Callback done)
+{
+    return at45db_dev_pgwrite_async(&g_at45db0, trans, buffer, page, done);
+}
 
-    /* Higher performance write logic:  We leave the chip busy after write and erase
-     * operations.  This improves write and erase performance because we do not have
-     * to wait as long between transactions (other processing can occur while the chip
-     * is busy) but means that the chip must stay powered and that we must check if
-     * the chip is still busy on each entry point.
-     */
+int at45db_tune(void)
+{
+    return at45db_dev_tune(&g_at45db0);
+}
 
-#ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
-#endif
+struct blkdev_s *at45db_blkdev(void)
+{
+    return &g_at45db0.blk;
+}
 
-    /* Perform the read */
-    at45db_active();
+//******************************************************************************
+// Block Device ****************************************************************
+//******************************************************************************
+
+int at45db_blk_read(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf)
+{
+    return at45db_dev_bread((struct at45db_dev_s *)dev, startblock, nblocks, buf);
+}
+
+int at45db_blk_write(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf)
+{
+    return at45db_dev_bwrite((struct at45db_dev_s *)dev, startblock, nblocks, buf);
+}
+
+int at45db_blk_erase(struct blkdev_s *dev, long startblock, unsigned int nblocks)
+{
+    return at45db_dev_erase((struct at45db_dev_s *)dev, startblock, nblocks);
+}
 
-    SPI_Master_ReadReg(cmd, sizeof(cmd), nbytes);
-    CopyArray(ReceiveBuffer, buffer, nbytes);
-    memset(ReceiveBuffer, 0x00, sizeof(ReceiveBuffer));
+int at45db_blk_sync(struct blkdev_s *dev)
+{
+    return at45db_dev_sync((struct at45db_dev_s *)dev);
+}
 
-    at45db_deactive();
+int at45db_blk_geometry(struct blkdev_s *dev, struct blkdev_geometry_s *geo)
+{
+    struct at45db_dev_s *priv = (struct at45db_dev_s *)dev;
 
-    at45db_pwrdown();
+    if (priv->npages == 0)
+    {
+        return -1;
+    }
 
-    myprintf("return nbytes: %d\r\n", (unsigned long)nbytes);
+    geo->blocksize   = priv->pagesize;
+    geo->eraseblocks = PG_PER_BLOCK;
+    geo->nblocks     = priv->npages;
 
-    return nbytes;
+    return 1;
 }
 
+//******************************************************************************
+// Striping ********************************************************************
+//******************************************************************************
+
 /************************************************************************************
- * Name: at45db_initialize
+ * Name: at45db_stripe_init
  *
  * Description:
- *   Create an initialize MTD device instance.  MTD devices are not registered
- *   in the file system, but are created as instances that can be bound to
- *   other functions (such as a block or character driver front end).
+ *   Combine initialized parts into one striped device. All parts need the same
+ *   page size; the smallest one sets the size of the stripe.
  *
  ************************************************************************************/
 
-int at45db_initialize(void)
+int at45db_stripe_init(struct at45db_stripe_s *stripe, struct at45db_dev_s **devs, uint8_t ndev)
 {
-    uint8_t sr;
-    int ret;
-
-    /* Deselect the FLASH */
-    at45db_deactive();
-
-    at45db_resume();
+    uint32_t npages = 0;
+    uint8_t d;
 
-    //while(1)
+    if (ndev == 0 || ndev > AT45DB_MAXSTRIPE)
     {
-    /* Identify the FLASH chip and get its capacity */
-    ret = at45db_rdid();
-    if (ret != 1)
+        return -1;
+    }
+
+    for (d = 0; d < ndev; d++)
     {
-        /* Unrecognized! Discard all of that work we just did and return NULL */
+        if (devs[d]->npages == 0 || devs[d]->pagesize != devs[0]->pagesize)
+        {
+            return -1;
+        }
 
-        myprintf("Unrecognized\r\n");
+        if (npages == 0 || devs[d]->npages < npages)
+        {
+            npages = devs[d]->npages;
+        }
+
+        stripe->dev[d] = devs[d];
+    }
+
+    stripe->ndev      = ndev;
+    stripe->pagesize  = devs[0]->pagesize;
+    stripe->npages    = npages * ndev;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: at45db_stripe_geometry
+ *
+ * Description:
+ *   One erase block of the stripe is the same block on every part, so it
+ *   holds PG_PER_BLOCK pages per part.
+ *
+ ************************************************************************************/
+
+int at45db_stripe_geometry(struct at45db_stripe_s *stripe, struct at45db_geometry_s *geo)
+{
+    if (stripe->ndev == 0)
+    {
         return -1;
     }
 
-        //for (ret = 0 ; ret < 100; ret++)
-        //    __delay_cycles(160000); // 1ms
+    geo->blocksize    = stripe->pagesize;
+    geo->erasesize    = stripe->pagesize * PG_PER_BLOCK * stripe->ndev;
+    geo->neraseblocks = stripe->npages / (PG_PER_BLOCK * stripe->ndev);
+
+    return 1;
+}
+
+int at45db_stripe_bread(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    unsigned int pgsleft = nblocks;
+    int ret;
+
+    while (pgsleft-- > 0)
+    {
+        ret = at45db_dev_bread(stripe->dev[startblock % stripe->ndev], startblock / stripe->ndev, 1, buffer);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        buffer += stripe->pagesize;
+        startblock++;
     }
 
-    /* Get the value of the status register (as soon as the device is ready) */
-    sr = at45db_waitbusy();
+    return nblocks;
+}
 
-    myprintf("status register: %02x\r\n", (unsigned long)sr);
+/************************************************************************************
+ * Name: at45db_stripe_stream
+ *
+ * Description:
+ *   at45db_pgstream across the parts: each page is clocked into an SRAM buffer
+ *   of its part while the other parts are still programming theirs, and every
+ *   part alternates between its own two buffers.
+ *
+ ************************************************************************************/
 
-    /* Check if the device is configured as 256, 512 or 1024 bytes-per-page device */
-    if ((sr & AT45DB_SR_PGSIZE) == 0)
+int at45db_stripe_stream(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks,
+                         uint8_t *buffer, uint8_t erase)
+{
+    unsigned int pgsleft = nblocks;
+    struct at45db_dev_s *priv;
+    uint8_t bf[AT45DB_MAXSTRIPE];
+    uint8_t d;
+
+    for (d = 0; d < stripe->ndev; d++)
     {
-        /* No, re-program it for the binary page size.  NOTE:  A power cycle
-         * is required after the device has be re-programmed.
-         */
+        priv = stripe->dev[d];
+        bf[d] = 1;
 
-        myprintf("Reprogramming page size\r\n");
+        at45db_resume(priv);
 
-        at45db_active();
+#ifdef CONFIG_AT45DB_PREWAIT
+        at45db_waitbusy(priv);
+#endif
+    }
 
-        SPI_Master_WriteReg(g_binpgsize, BINPGSIZE_SIZE);
+    while (pgsleft-- > 0)
+    {
+        d = startblock % stripe->ndev;
+        priv = stripe->dev[d];
 
-        at45db_deactive();
+        at45db_bfwrite(priv, bf[d], buffer);
+        at45db_waitbusy(priv);
+        at45db_bfprogram(priv, bf[d], startblock / stripe->ndev, erase);
 
-        return -1;
+        buffer += stripe->pagesize;
+        startblock++;
+        bf[d] ^= 3;                         /* 1 <-> 2 */
     }
 
-    /* power down the device */
-    at45db_pwrdown();
+    for (d = 0; d < stripe->ndev; d++)
+    {
+        priv = stripe->dev[d];
 
-    return 1;
+#ifndef CONFIG_AT45DB_PREWAIT
+        at45db_waitbusy(priv);
+#endif
+
+        at45db_pwrdown(priv);
+    }
+
+    return nblocks;
 }
 
-void ErasingDataFlash(void)
+int at45db_stripe_bwrite(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buffer)
 {
-    uint8_t cmd[4] = {0, };
-    uint16_t block_counter = 0;
+    return at45db_stripe_stream(stripe, startblock, nblocks, buffer, 1);
+}
 
-    myprintf("ErasingDataFlash Start\r\n");
+int at45db_stripe_bprogram(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buffer)
+{
+    return at45db_stripe_stream(stripe, startblock, nblocks, buffer, 0);
+}
+
+/************************************************************************************
+ * Name: at45db_stripe_blkerase
+ *
+ * Description:
+ *   Erase the block on every part. With CONFIG_AT45DB_PREWAIT nothing waits
+ *   for an erase to finish, so the parts erase in parallel.
+ *
+ ************************************************************************************/
 
-    while (block_counter < 512)
+int at45db_stripe_blkerase(struct at45db_stripe_s *stripe, long block)
+{
+    uint8_t d;
+
+    for (d = 0; d < stripe->ndev; d++)
     {
-        //myprintf("block_counter: %d, 0x%x, 0x%x\r\n", block_counter, (uint8_t)(block_counter>>5), (uint8_t)(block_counter<<3));
-        at45db_active();
+        at45db_dev_blkerase(stripe->dev[d], block);
+    }
 
-        cmd[0] = AT45DB_BLKERASE;
-        cmd[1] = (uint8_t)(block_counter>>5);
-        cmd[2] = (uint8_t)(block_counter<<3);
-        cmd[3] = 0x00;
+    return 1;
+}
 
-        SPI_Master_WriteReg(cmd, sizeof(cmd));
+void ErasingDataFlash(void)
+{
+    struct at45db_dev_s *priv = &g_at45db0;
+    struct at45db_erase_s plan;
 
-        block_counter++;
+    myprintf("ErasingDataFlash Start\r\n");
 
-        at45db_deactive();
+    at45db_resume(priv);
 
-        at45db_waitbusy();
+    at45db_erase_start(priv, &plan, 0, priv->npages);
+    while (!at45db_erase_poll(&plan))
+    {
+        at45db_waitbusy(priv);
     }
 
-    myprintf("ErasingDataFlash End\r\n");
+    at45db_pwrdown(priv);
+
+    myprintf("ErasingDataFlash End: estimated %u us, actual %u us\r\n", (unsigned long)plan.estusec,
+             (unsigned long)plan.usec);
 }
 
 void FlashBuffer1Write(uint16_t start_addr, uint16_t len, uint8_t *buffer)
 {
-    //uint8_t cmd[4] = {0, };
-    uint8_t cmd[128] = {0, };
+    struct at45db_dev_s *priv = &g_at45db0;
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
 
     myprintf("FlashBuffer1Write Start\r\n");
 
+    at45db_resume(priv);
+
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    at45db_active();
-
     cmd[0] = AT45DB_WRBF1;
     cmd[1] = 0x00;
     cmd[2] = (uint8_t)(start_addr>>8);
     cmd[3] = (uint8_t)(start_addr);
 
-    CopyArray(&buffer[0], &cmd[4], len);
-
-    SPI_Master_WriteReg(cmd, 4 + len);
-
-    //SPI_Master_WriteReg(buffer, len);
-
-    at45db_deactive();
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.txData = buffer;
+    xfer.dataLen = len;
+    xfer.speed = SPI_SPEED_FAST;
+    at45db_xfer(priv, &xfer);
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
+    at45db_pwrdown(priv);
+
     myprintf("FlashBuffer1Write End\r\n");
 }
 
 void FlashBuffer1Read(uint16_t start_addr, uint16_t len, uint8_t *buffer)
 {
-    uint8_t cmd[5] = {0, };
+    struct at45db_dev_s *priv = &g_at45db0;
+    uint8_t cmd[4] = {0, };
+    SPI_Xfer xfer = {0};
 
     myprintf("FlashBuffer1Read Start\r\n");
 
+    at45db_resume(priv);
+
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    at45db_active();
-
     cmd[0] = AT45DB_RDBF1;
     cmd[1] = 0x00;
     cmd[2] = (uint8_t)(start_addr>>8);
     cmd[3] = (uint8_t)(start_addr);
-    cmd[4] = 0x00;  // Additional Don't Care Bytes
 
-    SPI_Master_ReadReg(cmd, sizeof(cmd), len);
-    CopyArray(ReceiveBuffer, buffer, len);
-    memset(ReceiveBuffer, 0x00, sizeof(ReceiveBuffer));
-
-    at45db_deactive();
+    xfer.cmd = cmd;
+    xfer.cmdLen = sizeof(cmd);
+    xfer.dummyLen = 1;  // Additional Don't Care Bytes
+    xfer.rxData = buffer;
+    xfer.dataLen = len;
+    xfer.speed = SPI_SPEED_FAST;
+    at45db_xfer(priv, &xfer);
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
+    at45db_pwrdown(priv);
+
     myprintf("FlashBuffer1Read End\r\n");
 }
 
 void FlashBuffer1ProgAutoErase(uint16_t star_addr)
 {
+    struct at45db_dev_s *priv = &g_at45db0;
     uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, star_addr, 0);
 
     myprintf("FlashBuffer1ProgAutoErase Start\r\n");
 
+    at45db_resume(priv);
+
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    at45db_active();
+    at45db_uncache(priv, (long)star_addr * priv->pagesize, priv->pagesize);
 
     cmd[0] = AT45DB_BF1TOMNE;
-    cmd[1] = (uint8_t)(star_addr>>8);
-    cmd[2] = (uint8_t)(star_addr);
-    cmd[3] = 0x00;
-
-    SPI_Master_WriteReg(cmd, sizeof(cmd));
+    cmd[1] = (uint8_t)(offset >> 16);
+    cmd[2] = (uint8_t)(offset >> 8);
+    cmd[3] = (uint8_t)(offset);
 
-    at45db_deactive();
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, AT45DB_BF1TOMNE);
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
+    at45db_pwrdown(priv);
+
     myprintf("FlashBuffer1ProgAutoErase End\r\n");
 }
 
 void PageToBuffer1(uint16_t star_addr)
 {
+    struct at45db_dev_s *priv = &g_at45db0;
     uint8_t cmd[4] = {0, };
+    uint32_t offset = at45db_addr(priv, star_addr, 0);
 
     myprintf("PageToBuffer1 Start\r\n");
 
+    at45db_resume(priv);
+
 #ifdef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
-    at45db_active();
-
     cmd[0] = AT45DB_MNTOBF1XFR;
-    cmd[1] = (uint8_t)(star_addr>>7);
-    cmd[2] = (uint8_t)(star_addr<<1);
-    cmd[3] = 0x00;
-
-    SPI_Master_WriteReg(cmd, sizeof(cmd));
+    cmd[1] = (uint8_t)(offset >> 16);
+    cmd[2] = (uint8_t)(offset >> 8);
+    cmd[3] = (uint8_t)(offset);
 
-    at45db_deactive();
+    at45db_cmd(priv, cmd, sizeof(cmd));
+    at45db_busystart(priv, AT45DB_MNTOBF1XFR);
 
 #ifndef CONFIG_AT45DB_PREWAIT
-    at45db_waitbusy();
+    at45db_waitbusy(priv);
 #endif
 
+    at45db_pwrdown(priv);
+
     myprintf("PageToBuffer1 End\r\n");
 }
 
+void at45db_printbusy(uint8_t opcode, uint32_t usec)
+{
+    myprintf("busy %02x: %u us\r\n", (unsigned long)opcode, (unsigned long)usec);
+}
+
 void at45db_test(void)
 {
     uint8_t string1[] = "1234567890UUAA";
@@ -730,6 +2462,8 @@ void at45db_test(void)
 
     myprintf("at45db_test Start\r\n");
 
+    at45db_setbusyhook(at45db_printbusy);
+
     ErasingDataFlash();
 
     FlashBuffer1Write(0, sizeof(string1), string1);//(uint8_t *)"1234567890UUAA");
@@ -750,6 +2484,91 @@ void at45db_test(void)
 
     myprintf("Second: %s\r\n", MyBuff1);
 
+    /* Patch 4 bytes in place, the second write finds them unchanged */
+
+    myprintf("Patch: %d pages\r\n", (unsigned long)at45db_write(2, 4, string1));
+    myprintf("Patch again: %d pages\r\n", (unsigned long)at45db_write(2, 4, string1));
+
+    memset(MyBuff1, 0, sizeof(MyBuff1));
+    at45db_read(0, sizeof(string1), MyBuff1);
+
+    myprintf("Third: %s\r\n", MyBuff1);
+
+#ifdef CONFIG_AT45DB_CACHE
+    {
+        struct pgcache_stats_s stats;
+
+        at45db_read(0, sizeof(string1), MyBuff1);
+        at45db_read(0, sizeof(string1), MyBuff1);
+
+        pgcache_stats(&stats, 0);
+        myprintf("cache: hit %d miss %d readahead %d bypass %d\r\n", (unsigned long)stats.hits,
+                 (unsigned long)stats.misses, (unsigned long)stats.readahead, (unsigned long)stats.bypass);
+    }
+#endif
+
+#ifdef CONFIG_AT45DB_PWRSAVE
+    {
+        uint32_t msec[AT45DB_PM_NSTATES];
+
+        at45db_dev_pmstats(&g_at45db0, msec);
+        myprintf("power: active %u ms standby %u ms dpd %u ms resume %d\r\n", (unsigned long)msec[AT45DB_PM_ACTIVE],
+                 (unsigned long)msec[AT45DB_PM_STANDBY], (unsigned long)msec[AT45DB_PM_DPD],
+                 (unsigned long)g_at45db0.nresume);
+    }
+#endif
+
+    myprintf("spi: timeouts %u retries %u failed %u\r\n", (unsigned long)SPI_Timeouts(),
+             (unsigned long)g_at45db0.nretries, (unsigned long)g_at45db0.nfailed);
+
     myprintf("at45db_test End\r\n");
 }
 
+#ifndef CONFIG_AT45DB_SIM
+//******************************************************************************
+// Timer and RDY/BUSY Interrupts ***********************************************
+//******************************************************************************
+
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void TIMER0_A1_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(TIMER0_A1_VECTOR))) TIMER0_A1_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    switch(__even_in_range(TA0IV, TA0IV_TAIFG))
+    {
+#ifdef CONFIG_AT45DB_PWRSAVE
+        case TA0IV_TACCR1:
+            TA0CCR1 += AT45DB_PM_TICK;
+            at45db_pm_tick();
+            break;
+#endif
+        case TA0IV_TAIFG:
+            g_tickhi++;
+            break;
+        default: break;
+    }
+}
+
+#ifdef CONFIG_AT45DB_RDYPIN
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=PORT1_VECTOR
+__interrupt void PORT1_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(PORT1_VECTOR))) PORT1_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    if (SPI_RDY_IFG & SPI_RDY_PIN)
+    {
+        SPI_RDY_IFG &= ~SPI_RDY_PIN;
+        SPI_RDY_IE &= ~SPI_RDY_PIN;
+        __bic_SR_register_on_exit(LPM3_bits);   // Exit LPM3
+    }
+}
+#endif
+#endif /* CONFIG_AT45DB_SIM */
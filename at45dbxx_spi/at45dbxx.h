@@ -1,6 +1,9 @@
 #ifndef __AT45DBXX_H__
 #define __AT45DBXX_H__
 
+#include "spi_interface.h"
+#include "blkdev.h"
+
 /* SPI Commands *********************************************************************/
 
 /* Read commands */
@@ -97,12 +100,164 @@
 #define AT45DB_SR_PROTECT   (1 << 1) /* Bit 1: PROTECT */
 #define AT45DB_SR_PGSIZE    (1 << 0) /* Bit 0: PAGE_SIZE */
 
-/* 1 Block = 16 pages; 1 sector = 256 pages */
+/* 1 Block = 8 pages; 1 sector = 128 pages on the 1, 2 and 32Mbit parts and
+ * 256 pages on the others (sectpages) */
+
+#define PG_PER_BLOCK        (8)
+
+/* Called from at45db_waitbusy with the opcode that left the device busy and
+ * how long it stayed busy, in microseconds (ACLK resolution, ~31us) */
+
+typedef void (*at45db_busyhook_t)(uint8_t opcode, uint32_t usec);
+
+/* Consumer of at45db_stream, called with each chunk as it arrives. Returns a
+ * negative value to stop the stream */
+
+typedef int (*at45db_stream_t)(const uint8_t *data, uint16_t len, void *arg);
+
+/* Geometry of the detected part, see at45db_geometry */
+
+struct at45db_geometry_s
+{
+    uint16_t blocksize;        /* Size of one read/write block (a page, 264/528/1056 in DataFlash mode) */
+    uint16_t erasesize;        /* Size of one erase block (PG_PER_BLOCK pages) */
+    uint32_t neraseblocks;     /* Number of erase blocks */
+};
+
+/* Erase command kinds, cheapest unit first */
+
+enum
+{
+    AT45DB_ERASE_PAGE = 0,
+    AT45DB_ERASE_BLOCK,
+    AT45DB_ERASE_SECTOR,
+    AT45DB_ERASE_CHIP,
+    AT45DB_ERASE_NKINDS
+};
+
+/* Power states, see CONFIG_AT45DB_PWRSAVE. A part in standby drops into deep
+ * power-down once it has been idle for pmidle; the next access resumes it.
+ */
 
-#define PG_PER_BLOCK        (16)
-#define PG_PER_SECTOR (256)
+enum
+{
+    AT45DB_PM_ACTIVE = 0,      /* Between at45db_resume and at45db_pwrdown */
+    AT45DB_PM_STANDBY,         /* Idle, CS high, ~25uA */
+    AT45DB_PM_DPD,             /* Deep power-down, ~5uA, needs tRDPD to resume */
+    AT45DB_PM_NSTATES
+};
+
+/* One DataFlash part on the SPI bus. The at45db_* API works on a default
+ * instance on SPI_CS_PIN; at45db_dev_* takes the instance explicitly. blk
+ * comes first, so a struct blkdev_s * from at45db_blkdev is the instance.
+ */
+
+struct at45db_dev_s
+{
+    struct blkdev_s blk;       /* Block device operations, pages as blocks */
+    volatile uint8_t *csOut;   /* Chip select port output register */
+    uint8_t  csPin;            /* Chip select pin, active low */
+    uint8_t  rdypin;           /* Busy wait on SPI_RDY_PIN (CONFIG_AT45DB_RDYPIN) */
+    uint8_t  cached;           /* Reads go through pgcache */
+    uint8_t  pageshift;        /* log2 of the binary page size (eg. 1 << 9 = 512) */
+    uint8_t  pabits;           /* Byte address bits below the page number */
+    uint16_t pagesize;         /* Bytes per page, 264/528/1056 in DataFlash mode */
+    uint32_t npages;           /* Number of pages in the device */
+    uint16_t sectpages;        /* Pages per sector, 128 or 256 */
+    uint8_t  busyop;           /* Opcode that left the device busy, 0 if none */
+    uint32_t busystart;        /* at45db_ticks() when busyop was issued */
+    uint32_t busyusec;         /* How long the last busyop kept the device busy */
+    at45db_busyhook_t busyhook;
+    uint32_t erasetime[AT45DB_ERASE_NKINDS];   /* Estimated usec per erase kind */
+    uint8_t  inuse;            /* Nesting of at45db_resume/at45db_pwrdown */
+    uint8_t  pmstate;          /* AT45DB_PM_* */
+    uint8_t  pmpending;        /* Idle power-down frames on the SPI queue */
+    uint8_t  pmsr;             /* Status read by the idle tick */
+    uint32_t pmidle;           /* Standby ticks before deep power-down, 0 never */
+    uint32_t pmsince;          /* at45db_ticks() at the last state change */
+    uint32_t pmticks[AT45DB_PM_NSTATES];       /* Ticks spent in each state */
+    uint16_t nresume;          /* Resumes from deep power-down */
+    SPI_Trans pmtrans;         /* Idle power-down frame */
+    uint16_t nretries;         /* Frames repeated after an SPI timeout */
+    uint16_t nfailed;          /* Frames that timed out on every try */
+};
+
+/* An erase in progress, see at45db_erase_start/at45db_erase_poll */
+
+struct at45db_erase_s
+{
+    struct at45db_dev_s *dev;
+    long     page;             /* Next page to erase */
+    long     end;              /* First page past the range */
+    uint8_t  kind;             /* Kind of the command in progress, NKINDS if none */
+    uint8_t  chip;             /* Whole device with one chip erase */
+    uint32_t started;          /* at45db_ticks() at the start */
+    uint32_t estusec;          /* Estimated time of the whole plan */
+    uint32_t usec;             /* Actual time, once done */
+};
+
+/* Logical pages striped over several parts: page n is page n / ndev of
+ * dev[n % ndev], so consecutive pages land on different chips and one chip
+ * programs while the next one is being filled.
+ */
+
+#define AT45DB_MAXSTRIPE    4
+
+struct at45db_stripe_s
+{
+    struct at45db_dev_s *dev[AT45DB_MAXSTRIPE];
+    uint8_t  ndev;
+    uint16_t pagesize;         /* Common page size of all parts */
+    uint32_t npages;           /* Logical pages, ndev times the smallest part */
+};
+
+int at45db_dev_initialize(struct at45db_dev_s *priv, volatile uint8_t *csOut, uint8_t csPin);
+int at45db_dev_geometry(struct at45db_dev_s *priv, struct at45db_geometry_s *geo);
+int at45db_dev_bread(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_dev_bwrite(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_dev_bprogram(struct at45db_dev_s *priv, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_dev_blkerase(struct at45db_dev_s *priv, long block);
+int at45db_dev_erase(struct at45db_dev_s *priv, long startblock, unsigned int nblocks);
+int at45db_dev_write(struct at45db_dev_s *priv, long offset, unsigned int nbytes, const uint8_t *buffer);
+void at45db_erase_start(struct at45db_dev_s *priv, struct at45db_erase_s *plan, long startblock,
+                        unsigned long nblocks);
+int at45db_erase_poll(struct at45db_erase_s *plan);
+int at45db_dev_read(struct at45db_dev_s *priv, long offset, unsigned int nbytes, uint8_t *buffer);
+int at45db_dev_rdarray(struct at45db_dev_s *priv, long offset, unsigned int nbytes, uint8_t *buffer);
+long at45db_dev_stream(struct at45db_dev_s *priv, long offset, unsigned long nbytes, uint8_t *buf, uint16_t chunk,
+                       at45db_stream_t consumer, void *arg);
+int at45db_dev_pgwrite_async(struct at45db_dev_s *priv, SPI_Trans *trans, uint8_t *buffer, long page,
+                             SPI_Callback done);
+int at45db_dev_sync(struct at45db_dev_s *priv);
+int at45db_dev_tune(struct at45db_dev_s *priv);
+void at45db_dev_setidle(struct at45db_dev_s *priv, uint32_t msec);
+void at45db_dev_pmstats(struct at45db_dev_s *priv, uint32_t msec[AT45DB_PM_NSTATES]);
+
+int at45db_stripe_init(struct at45db_stripe_s *stripe, struct at45db_dev_s **devs, uint8_t ndev);
+int at45db_stripe_geometry(struct at45db_stripe_s *stripe, struct at45db_geometry_s *geo);
+int at45db_stripe_bread(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_stripe_bwrite(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_stripe_bprogram(struct at45db_stripe_s *stripe, long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_stripe_blkerase(struct at45db_stripe_s *stripe, long block);
+
+/* Default instance */
 
 int at45db_initialize(void);
+int at45db_geometry(struct at45db_geometry_s *geo);
+void at45db_setbusyhook(at45db_busyhook_t hook);
+struct blkdev_s *at45db_blkdev(void);
+
+int at45db_bread(long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_bwrite(long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_bprogram(long startblock, unsigned int nblocks, uint8_t *buf);
+int at45db_blkerase(long block);
+int at45db_erase(long startblock, unsigned int nblocks);
+int at45db_read(long offset, unsigned int nbytes, uint8_t *buffer);
+int at45db_write(long offset, unsigned int nbytes, const uint8_t *buffer);
+int at45db_rdarray(long offset, unsigned int nbytes, uint8_t *buffer);
+long at45db_stream(long offset, unsigned long nbytes, uint8_t *buf, uint16_t chunk, at45db_stream_t consumer, void *arg);
+int at45db_pgwrite_async(SPI_Trans *trans, uint8_t *buffer, long page, SPI_Callback done);
+int at45db_tune(void);
 void at45db_test(void);
 
 #endif /* __AT45DBXX_H__ */
@@ -0,0 +1,905 @@
+#ifdef CONFIG_AT45DB_SIM
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "at45sim.h"
+#include "at45dbxx.h"
+#include "spi_interface.h"
+#include "myprintf.h"
+
+/* Typical AT45DB041E timing, usec */
+
+#define AT45SIM_TXFR        200        /* Page to buffer transfer */
+#define AT45SIM_TCOMP       200        /* Page to buffer compare */
+#define AT45SIM_TEP         12000      /* Page erase and program */
+#define AT45SIM_TP          2000       /* Page program */
+#define AT45SIM_TPE         8000       /* Page erase */
+#define AT45SIM_TBE         25000      /* Block erase */
+#define AT45SIM_TSE         700000UL   /* Sector erase */
+#define AT45SIM_TCE         7000000UL  /* Chip erase */
+#define AT45SIM_TRDPD       35         /* Resume from deep power-down */
+
+#define AT45SIM_BLKPAGES    8          /* Pages per block erase, also the size of sector 0a */
+#define AT45SIM_MAXPAGE     1056
+
+struct at45sim_s
+{
+    volatile uint8_t *csOut;   /* Chip select the part listens to */
+    uint8_t  csPin;
+    uint8_t  devid1;           /* Family and capacity */
+    uint8_t  binary;           /* Binary page size (SR bit 0) */
+    uint8_t  pabits;           /* Byte address bits below the page number */
+    uint16_t pagesize;
+    uint32_t npages;
+    uint16_t sectpages;        /* Pages per sector, sector 0 split in 0a/0b */
+    size_t   size;
+    uint8_t *array;            /* Memory-mapped backing file */
+    uint32_t *wear;            /* Erases per page */
+    uint8_t  buf[2][AT45SIM_MAXPAGE];
+    uint8_t  comp;             /* SR COMP of the last compare */
+    uint8_t  dpd;              /* In deep power-down */
+    uint64_t busyuntil;        /* g_simns when RDY comes back */
+    uint8_t  busybf;           /* Buffer (1 or 2) the running program reads, 0 if it blocks both */
+
+    /* Decoder state of the current frame */
+
+    uint32_t pos;
+    uint8_t  op;
+    uint8_t  ignore;
+    uint32_t addr;
+    uint32_t page;
+    uint16_t byte;
+
+    struct at45sim_stats_s stats;
+};
+
+struct at45sim_s g_sim[AT45SIM_MAXDEV];
+uint8_t g_nsim;
+
+uint64_t g_simns;              /* Simulated time */
+
+uint16_t g_simdrop;            /* Frames still to time out, at45sim_timeout */
+uint32_t g_simcut;             /* Programs until the power fails, at45sim_powercut */
+uint8_t g_simoff;              /* Power failed, no part answers */
+uint16_t SpiTimeouts;
+
+volatile uint8_t P1OUT = 0xff, P1DIR, P1IN, P1REN, P1IE, P1IES, P1IFG;
+volatile uint8_t P2OUT = 0xff, P2DIR, P3OUT = 0xff, P3DIR, P4OUT = 0xff, P4DIR;
+volatile uint16_t TA0CTL, TA0R, TA0CCR1, TA0CCTL1;
+
+uint8_t ReceiveBuffer[MAX_BUFFER_SIZE] = {0};
+
+uint16_t SpiDivisor[SPI_NSPEEDS] = {SPI_DIV_SLOW, SPI_DIV_FAST};
+uint16_t SpiSavedDiv;
+
+uint8_t at45sim_hdrlen(uint8_t op);
+uint8_t at45sim_sr(struct at45sim_s *sim);
+uint8_t at45sim_bufop(uint8_t op);
+void at45sim_busy(struct at45sim_s *sim, uint32_t usec);
+void at45sim_erase(struct at45sim_s *sim, uint32_t page, uint32_t npages);
+void at45sim_program(struct at45sim_s *sim, uint8_t bf, uint8_t erase);
+uint8_t at45sim_byte(struct at45sim_s *sim, uint8_t in);
+void at45sim_end(struct at45sim_s *sim);
+SPI_Mode at45sim_frame(const SPI_Xfer *xfer);
+
+/************************************************************************************
+ * Name: at45sim_attach
+ *
+ * Description:
+ *   Add a part on csOut/csPin, backed by the file at path. devid1 is the
+ *   second ID byte (eg. AT45DB_DEVID1_DFLASH | AT45DB_DEVID1_4MBIT) and sets
+ *   the geometry; binary selects 256/512/1024 instead of 264/528/1056 byte
+ *   pages. A new file starts out erased. Returns the part number or -1.
+ *
+ ************************************************************************************/
+
+int at45sim_attach(const char *path, volatile uint8_t *csOut, uint8_t csPin, uint8_t devid1, uint8_t binary)
+{
+    struct at45sim_s *sim;
+    struct stat st;
+    uint8_t shift;
+    int fd;
+
+    if (g_nsim >= AT45SIM_MAXDEV)
+    {
+        return -1;
+    }
+
+    sim = &g_sim[g_nsim];
+    memset(sim, 0, sizeof(*sim));
+
+    switch (devid1 & AT45DB_DEVID1_CAPMSK)
+    {
+    case AT45DB_DEVID1_1MBIT:  shift = 8;  sim->npages = 512;  sim->sectpages = 128; break;
+    case AT45DB_DEVID1_2MBIT:  shift = 8;  sim->npages = 1024; sim->sectpages = 128; break;
+    case AT45DB_DEVID1_4MBIT:  shift = 8;  sim->npages = 2048; sim->sectpages = 256; break;
+    case AT45DB_DEVID1_8MBIT:  shift = 8;  sim->npages = 4096; sim->sectpages = 256; break;
+    case AT45DB_DEVID1_16MBIT: shift = 9;  sim->npages = 4096; sim->sectpages = 256; break;
+    case AT45DB_DEVID1_32MBIT: shift = 9;  sim->npages = 8192; sim->sectpages = 128; break;
+    case AT45DB_DEVID1_64MBIT: shift = 10; sim->npages = 8192; sim->sectpages = 256; break;
+    default:
+        return -1;
+    }
+
+    sim->csOut    = csOut;
+    sim->csPin    = csPin;
+    sim->devid1   = devid1;
+    sim->binary   = binary;
+    sim->pagesize = binary ? (1 << shift) : (1 << shift) + (1 << (shift - 5));
+    sim->pabits   = binary ? shift : shift + 1;
+    sim->size     = (size_t)sim->npages * sim->pagesize;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if (st.st_size != 0 && (size_t)st.st_size != sim->size)
+    {
+        fprintf(stderr, "%s: %ld bytes, part needs %lu\n", path, (long)st.st_size, (unsigned long)sim->size);
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0 && ftruncate(fd, sim->size) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    sim->array = mmap(NULL, sim->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sim->array == MAP_FAILED)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if (st.st_size == 0)
+    {
+        memset(sim->array, 0xff, sim->size);
+    }
+
+    sim->wear = calloc(sim->npages, sizeof(uint32_t));
+    memset(sim->buf, 0xff, sizeof(sim->buf));
+
+    *csOut |= csPin;
+
+    return g_nsim++;
+}
+
+/************************************************************************************
+ * Name: at45sim_detach
+ *
+ * Description:
+ *   Write the arrays back to their files and drop all parts.
+ *
+ ************************************************************************************/
+
+void at45sim_detach(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < g_nsim; i++)
+    {
+        msync(g_sim[i].array, g_sim[i].size, MS_SYNC);
+        munmap(g_sim[i].array, g_sim[i].size);
+        free(g_sim[i].wear);
+    }
+
+    g_nsim = 0;
+}
+
+/************************************************************************************
+ * Name: at45sim_ticks
+ *
+ * Description:
+ *   Simulated time in 32768Hz ticks, what TA0 counts on the target.
+ *
+ ************************************************************************************/
+
+uint32_t at45sim_ticks(void)
+{
+    return (uint32_t)((g_simns / 1000000000ULL) * 32768 + (g_simns % 1000000000ULL) * 32768 / 1000000000ULL);
+}
+
+uint32_t at45sim_usec(void)
+{
+    return (uint32_t)(g_simns / 1000);
+}
+
+void at45sim_delay(unsigned long cycles)
+{
+    g_simns += (uint64_t)cycles * 1000000000ULL / AT45SIM_MCLK_HZ;
+}
+
+void at45sim_stats(int dev, struct at45sim_stats_s *stats, uint8_t reset)
+{
+    *stats = g_sim[dev].stats;
+    if (reset)
+    {
+        memset(&g_sim[dev].stats, 0, sizeof(g_sim[dev].stats));
+    }
+}
+
+/************************************************************************************
+ * Name: at45sim_timeout
+ *
+ * Description:
+ *   Let the next n frames time out: they never reach a part, read back all
+ *   ones and end in TIMEOUT_MODE after their deadline, as a stuck bus does on
+ *   the target.
+ *
+ ************************************************************************************/
+
+void at45sim_timeout(uint16_t n)
+{
+    g_simdrop = n;
+}
+
+/************************************************************************************
+ * Name: at45sim_powercut
+ *
+ * Description:
+ *   Let the power fail during the nth page program from now, after the
+ *   built-in erase and before the page is programmed: the page is left
+ *   erased and no part answers any more, as if the board were off. n = 0
+ *   powers the parts back on, the arrays as the cut left them.
+ *
+ ************************************************************************************/
+
+void at45sim_powercut(uint32_t n)
+{
+    g_simcut = n;
+    g_simoff = 0;
+}
+
+uint8_t at45sim_powered(void)
+{
+    return !g_simoff;
+}
+
+//******************************************************************************
+// DataFlash Model *************************************************************
+//******************************************************************************
+
+/************************************************************************************
+ * Name: at45sim_hdrlen
+ *
+ * Description:
+ *   Opcode, address and don't care bytes before the data phase of a command.
+ *
+ ************************************************************************************/
+
+uint8_t at45sim_hdrlen(uint8_t op)
+{
+    switch (op)
+    {
+    case AT45DB_RDSR:
+    case AT45DB_RDDEVID:
+    case AT45DB_PWRDOWN:
+    case AT45DB_RESUME:
+        return 1;
+    case AT45DB_RDARRAYHF:
+    case AT45DB_RDBF1:
+    case AT45DB_RDBF2:
+        return 5;
+    case AT45DB_RDARRY:
+    case AT45DB_RDMN:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+/************************************************************************************
+ * Name: at45sim_bufop
+ *
+ * Description:
+ *   Buffer (1 or 2) a buffer read or write opcode works on, 0 for opcodes that
+ *   do not stay inside one SRAM buffer.
+ *
+ ************************************************************************************/
+
+uint8_t at45sim_bufop(uint8_t op)
+{
+    switch (op)
+    {
+    case AT45DB_WRBF1:
+    case AT45DB_RDBF1:
+    case AT45DB_RDBF1LF:
+        return 1;
+    case AT45DB_WRBF2:
+    case AT45DB_RDBF2:
+    case AT45DB_RDBF2LF:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+uint8_t at45sim_sr(struct at45sim_s *sim)
+{
+    uint8_t sr = 0;
+
+    if (g_simns >= sim->busyuntil)
+    {
+        sr |= AT45DB_SR_RDY;
+    }
+
+    if (sim->comp)
+    {
+        sr |= AT45DB_SR_COMP;
+    }
+
+    /* Density code in bits 5-2: 0011 for 1Mbit ... 1111 for 64Mbit */
+
+    sr |= ((2 * (sim->devid1 & AT45DB_DEVID1_CAPMSK) - 1) << 2) & 0x3c;
+
+    if (sim->binary)
+    {
+        sr |= AT45DB_SR_PGSIZE;
+    }
+
+    return sr;
+}
+
+void at45sim_busy(struct at45sim_s *sim, uint32_t usec)
+{
+    sim->busyuntil = g_simns + (uint64_t)usec * 1000;
+    sim->busybf = 0;
+    sim->stats.busyusec += usec;
+}
+
+void at45sim_erase(struct at45sim_s *sim, uint32_t page, uint32_t npages)
+{
+    uint32_t p;
+
+    for (p = page; p < page + npages && p < sim->npages; p++)
+    {
+        memset(sim->array + (size_t)p * sim->pagesize, 0xff, sim->pagesize);
+
+        sim->stats.erases++;
+        if (++sim->wear[p] > sim->stats.maxwear)
+        {
+            sim->stats.maxwear = sim->wear[p];
+        }
+    }
+}
+
+/************************************************************************************
+ * Name: at45sim_program
+ *
+ * Description:
+ *   Program the addressed page from buffer bf. Without the built-in erase
+ *   programming can only clear bits, as on the part.
+ *
+ ************************************************************************************/
+
+void at45sim_program(struct at45sim_s *sim, uint8_t bf, uint8_t erase)
+{
+    uint8_t *dst = sim->array + (size_t)sim->page * sim->pagesize;
+    uint16_t i;
+
+    if (erase)
+    {
+        at45sim_erase(sim, sim->page, 1);
+    }
+
+    if (g_simcut && --g_simcut == 0)
+    {
+        g_simoff = 1;
+        return;
+    }
+
+    for (i = 0; i < sim->pagesize; i++)
+    {
+        dst[i] &= sim->buf[bf][i];
+    }
+
+    sim->stats.programs++;
+    at45sim_busy(sim, erase ? AT45SIM_TEP : AT45SIM_TP);
+    sim->busybf = bf + 1;
+}
+
+/************************************************************************************
+ * Name: at45sim_byte
+ *
+ * Description:
+ *   Clock one byte of the current frame into the part and return the byte it
+ *   drives on SO. While a buffer to main memory program runs, status reads
+ *   and reads or writes of the other buffer go through, as on the real part;
+ *   anything else while busy, and anything but resume while powered down, is
+ *   ignored and counted as a violation.
+ *
+ ************************************************************************************/
+
+uint8_t at45sim_byte(struct at45sim_s *sim, uint8_t in)
+{
+    uint8_t out = 0xff;
+    uint8_t hdr;
+
+    if (sim->pos == 0)
+    {
+        sim->op = in;
+        sim->addr = 0;
+
+        if ((sim->dpd && in != AT45DB_RESUME) ||
+            (!sim->dpd && g_simns < sim->busyuntil && in != AT45DB_RDSR &&
+             !(sim->busybf && at45sim_bufop(in) && at45sim_bufop(in) != sim->busybf)))
+        {
+            sim->ignore = 1;
+            sim->stats.violations++;
+            fprintf(stderr, "at45sim: opcode %02x while %s\n", in, sim->dpd ? "powered down" : "busy");
+        }
+    }
+
+    hdr = at45sim_hdrlen(sim->op);
+
+    if (sim->pos > 0 && sim->pos < 4 && hdr >= 4)
+    {
+        sim->addr = (sim->addr << 8) | in;
+        if (sim->pos == 3)
+        {
+            sim->page = (sim->addr >> sim->pabits) % sim->npages;
+            sim->byte = (sim->addr & ((1UL << sim->pabits) - 1)) % sim->pagesize;
+        }
+    }
+
+    if (!sim->ignore && sim->pos >= hdr)
+    {
+        switch (sim->op)
+        {
+        case AT45DB_RDSR:
+            out = at45sim_sr(sim);
+            break;
+
+        case AT45DB_RDDEVID:
+            switch (sim->pos - hdr)
+            {
+            case 0: out = AT45DB_MANUFACTURER; break;
+            case 1: out = sim->devid1; break;
+            default: out = 0; break;
+            }
+            break;
+
+        case AT45DB_RDARRAYHF:
+        case AT45DB_RDARRAYLF:
+        case AT45DB_RDARRY:
+        case AT45DB_RDMN:
+            out = sim->array[(size_t)sim->page * sim->pagesize + sim->byte];
+            sim->stats.rdbytes++;
+            if (++sim->byte == sim->pagesize)
+            {
+                /* Continuous reads run on into the next page, page reads wrap */
+
+                sim->byte = 0;
+                if (sim->op != AT45DB_RDMN)
+                {
+                    sim->page = (sim->page + 1) % sim->npages;
+                }
+            }
+            break;
+
+        case AT45DB_RDBF1:
+        case AT45DB_RDBF1LF:
+        case AT45DB_RDBF2:
+        case AT45DB_RDBF2LF:
+            out = sim->buf[sim->op == AT45DB_RDBF1 || sim->op == AT45DB_RDBF1LF ? 0 : 1][sim->byte];
+            sim->byte = (sim->byte + 1) % sim->pagesize;
+            break;
+
+        case AT45DB_WRBF1:
+        case AT45DB_MNTHRUBF1:
+            sim->buf[0][sim->byte] = in;
+            sim->byte = (sim->byte + 1) % sim->pagesize;
+            break;
+
+        case AT45DB_WRBF2:
+        case AT45DB_MNTHRUBF2:
+            sim->buf[1][sim->byte] = in;
+            sim->byte = (sim->byte + 1) % sim->pagesize;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    sim->pos++;
+
+    return out;
+}
+
+/************************************************************************************
+ * Name: at45sim_end
+ *
+ * Description:
+ *   Chip select went high: start the internal operation of the command.
+ *
+ ************************************************************************************/
+
+void at45sim_end(struct at45sim_s *sim)
+{
+    uint32_t page;
+
+    if (sim->ignore || sim->pos < at45sim_hdrlen(sim->op))
+    {
+        return;
+    }
+
+    sim->stats.frames++;
+
+    switch (sim->op)
+    {
+    case AT45DB_BF1TOMNE:
+    case AT45DB_MNTHRUBF1:
+        at45sim_program(sim, 0, 1);
+        break;
+    case AT45DB_BF2TOMNE:
+    case AT45DB_MNTHRUBF2:
+        at45sim_program(sim, 1, 1);
+        break;
+    case AT45DB_BF1TOMN:
+        at45sim_program(sim, 0, 0);
+        break;
+    case AT45DB_BF2TOMN:
+        at45sim_program(sim, 1, 0);
+        break;
+
+    case AT45DB_PGERASE:
+        at45sim_erase(sim, sim->page, 1);
+        at45sim_busy(sim, AT45SIM_TPE);
+        break;
+
+    case AT45DB_BLKERASE:
+        at45sim_erase(sim, sim->page & ~(AT45SIM_BLKPAGES - 1), AT45SIM_BLKPAGES);
+        at45sim_busy(sim, AT45SIM_TBE);
+        break;
+
+    case AT45DB_SECTERASE:
+        if (sim->page < AT45SIM_BLKPAGES)
+        {
+            at45sim_erase(sim, 0, AT45SIM_BLKPAGES);                                   /* 0a */
+        }
+        else if (sim->page < sim->sectpages)
+        {
+            at45sim_erase(sim, AT45SIM_BLKPAGES, sim->sectpages - AT45SIM_BLKPAGES);     /* 0b */
+        }
+        else
+        {
+            page = sim->page & ~((uint32_t)sim->sectpages - 1);
+            at45sim_erase(sim, page, sim->sectpages);
+        }
+        at45sim_busy(sim, AT45SIM_TSE);
+        break;
+
+    case AT45DB_CHIPERASE1:
+        if (sim->addr == (((uint32_t)AT45DB_CHIPERASE2 << 16) | (AT45DB_CHIPERASE3 << 8) | AT45DB_CHIPERASE4))
+        {
+            at45sim_erase(sim, 0, sim->npages);
+            at45sim_busy(sim, AT45SIM_TCE);
+        }
+        break;
+
+    case AT45DB_MNTOBF1XFR:
+    case AT45DB_MNTOBF2XFR:
+        memcpy(sim->buf[sim->op == AT45DB_MNTOBF1XFR ? 0 : 1], sim->array + (size_t)sim->page * sim->pagesize,
+               sim->pagesize);
+        at45sim_busy(sim, AT45SIM_TXFR);
+        break;
+
+    case AT45DB_MNBF1CMP:
+    case AT45DB_MNBF2CMP:
+        sim->comp = memcmp(sim->buf[sim->op == AT45DB_MNBF1CMP ? 0 : 1],
+                           sim->array + (size_t)sim->page * sim->pagesize, sim->pagesize) != 0;
+        at45sim_busy(sim, AT45SIM_TCOMP);
+        break;
+
+    case AT45DB_AUTOWRBF1:
+    case AT45DB_AUTOWRBF2:
+        at45sim_busy(sim, AT45SIM_TEP);
+        break;
+
+    case AT45DB_PWRDOWN:
+        sim->dpd = 1;
+        break;
+
+    case AT45DB_RESUME:
+        sim->dpd = 0;
+        at45sim_busy(sim, AT45SIM_TRDPD);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/************************************************************************************
+ * Name: at45sim_frame
+ *
+ * Description:
+ *   Clock a frame to whichever part has its chip select low, or into the void
+ *   if none has. The frame takes its SPI byte time at the divisor of its
+ *   speed class. Returns IDLE_MODE, or TIMEOUT_MODE for a dropped frame.
+ *
+ ************************************************************************************/
+
+SPI_Mode at45sim_frame(const SPI_Xfer *xfer)
+{
+    struct at45sim_s *sim = NULL;
+    uint64_t nsec;
+    uint32_t i;
+    uint8_t out;
+
+    nsec = (uint64_t)(xfer->cmdLen + xfer->dummyLen + xfer->dataLen) * 8 *
+           SpiDivisor[xfer->speed < SPI_NSPEEDS ? xfer->speed : SPI_SPEED_SLOW] * 1000000000ULL / AT45SIM_MCLK_HZ;
+
+    if (g_simdrop)
+    {
+        g_simdrop--;
+        SpiTimeouts++;
+
+        if (xfer->rxData)
+        {
+            memset(xfer->rxData, 0xff, xfer->dataLen);
+        }
+
+        g_simns += 2 * nsec;
+        return TIMEOUT_MODE;
+    }
+
+    for (i = 0; i < g_nsim && !g_simoff; i++)
+    {
+        if ((*g_sim[i].csOut & g_sim[i].csPin) == 0)
+        {
+            if (sim)
+            {
+                fprintf(stderr, "at45sim: more than one chip select low\n");
+            }
+            sim = &g_sim[i];
+        }
+    }
+
+    /* A frame without command bytes is clocked under a chip select still held
+     * low from the previous one (at45db_stream) and continues its command.
+     */
+
+    if (sim && xfer->cmdLen)
+    {
+        sim->pos = 0;
+        sim->ignore = 0;
+    }
+
+    for (i = 0; i < xfer->cmdLen; i++)
+    {
+        if (sim)
+        {
+            at45sim_byte(sim, xfer->cmd[i]);
+        }
+    }
+
+    for (i = 0; i < xfer->dummyLen; i++)
+    {
+        if (sim)
+        {
+            at45sim_byte(sim, DUMMY);
+        }
+    }
+
+    for (i = 0; i < xfer->dataLen; i++)
+    {
+        out = sim ? at45sim_byte(sim, xfer->txData ? xfer->txData[i] : DUMMY) : 0xff;
+        if (xfer->rxData)
+        {
+            xfer->rxData[i] = out;
+        }
+    }
+
+    g_simns += nsec;
+
+    if (sim && xfer->cmdLen)
+    {
+        at45sim_end(sim);
+    }
+
+    return IDLE_MODE;
+}
+
+//******************************************************************************
+// spi_interface.c Replacement *************************************************
+//******************************************************************************
+
+/* Frames complete as soon as they are started, so queued descriptors run
+ * and call back inside SPI_Queue_Submit and the queue is never pending.
+ */
+
+void initSPI(void)
+{
+}
+
+void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count)
+{
+    memcpy(dest, source, count);
+}
+
+SPI_Mode SPI_Master_Transfer(const SPI_Xfer *xfer)
+{
+    return at45sim_frame(xfer);
+}
+
+SPI_Mode SPI_Master_WriteReg(uint8_t *reg_data, uint8_t count)
+{
+    SPI_Xfer xfer = {0};
+
+    xfer.cmd = reg_data;
+    xfer.cmdLen = count;
+
+    return SPI_Master_Transfer(&xfer);
+}
+
+SPI_Mode SPI_Master_ReadReg(uint8_t *reg_addr, uint8_t count, uint8_t rxCount)
+{
+    SPI_Xfer xfer = {0};
+
+    if (rxCount > MAX_BUFFER_SIZE)
+        rxCount = MAX_BUFFER_SIZE;
+
+    xfer.cmd = reg_addr;
+    xfer.cmdLen = count;
+    xfer.rxData = ReceiveBuffer;
+    xfer.dataLen = rxCount;
+
+    return SPI_Master_Transfer(&xfer);
+}
+
+uint8_t SPI_Queue_Submit(SPI_Trans *trans)
+{
+    trans->status = TX_REG_ADDRESS_MODE;
+
+    if (trans->csOut)
+    {
+        *trans->csOut &= ~trans->csPin;
+    }
+
+    trans->status = at45sim_frame(&trans->xfer);
+
+    if (trans->csOut)
+    {
+        *trans->csOut |= trans->csPin;
+    }
+
+    if (trans->done)
+    {
+        trans->done(trans);
+    }
+
+    return 1;
+}
+
+uint8_t SPI_Queue_Pending(void)
+{
+    return 0;
+}
+
+/* Divisors only set the simulated byte time; the file keeps no FRAM */
+
+void SPI_Set_Divisor(SPI_Speed speed, uint16_t div)
+{
+    SpiDivisor[speed] = div < SPI_DIV_MIN ? SPI_DIV_MIN : div;
+}
+
+uint16_t SPI_Get_Divisor(SPI_Speed speed)
+{
+    return SpiDivisor[speed];
+}
+
+void SPI_Save_Divisor(void)
+{
+    SpiSavedDiv = SpiDivisor[SPI_SPEED_FAST];
+}
+
+uint16_t SPI_Saved_Divisor(void)
+{
+    return SpiSavedDiv;
+}
+
+uint8_t SPI_Master_Busy(void)
+{
+    return 0;
+}
+
+uint16_t SPI_Timeouts(void)
+{
+    return SpiTimeouts;
+}
+
+void SPI_Queue_Flush(void)
+{
+}
+
+//******************************************************************************
+// myprintf.c Replacement ******************************************************
+//******************************************************************************
+
+void uart_init(void)
+{
+}
+
+/* Same conversions as myprintf.c (%s %c %d %u %x %X, width, '0' and '-'),
+ * every numeric argument passed as unsigned long.
+ */
+
+int myprintf(char *format, ...)
+{
+    va_list args;
+    char spec[16];
+    int n = 0;
+    int i;
+
+    va_start(args, format);
+
+    for (; *format; format++)
+    {
+        if (*format != '%')
+        {
+            putchar(*format);
+            n++;
+            continue;
+        }
+
+        spec[0] = '%';
+        for (i = 1, format++; *format && strchr("-0123456789", *format) && i < 12; format++)
+        {
+            spec[i++] = *format;
+        }
+
+        switch (*format)
+        {
+        case 's':
+            spec[i++] = 's';
+            spec[i] = 0;
+            n += printf(spec, va_arg(args, char *));
+            break;
+        case 'c':
+            putchar((int)va_arg(args, unsigned long));
+            n++;
+            break;
+        case 'd':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[i++] = 'l';
+            spec[i++] = *format;
+            spec[i] = 0;
+            if (*format == 'd')
+                n += printf(spec, (long)va_arg(args, unsigned long));
+            else
+                n += printf(spec, va_arg(args, unsigned long));
+            break;
+        case '%':
+            putchar('%');
+            n++;
+            break;
+        default:
+            format--;
+            break;
+        }
+    }
+
+    va_end(args);
+
+    return n;
+}
+
+#endif /* CONFIG_AT45DB_SIM */
@@ -0,0 +1,87 @@
+#ifndef __AT45SIM_H__
+#define __AT45SIM_H__
+
+#include <stdint.h>
+
+/* Host simulator of the AT45DB (CONFIG_AT45DB_SIM)
+ *
+ * Built on a Linux host with -DCONFIG_AT45DB_SIM, at45sim.c stands in for
+ * spi_interface.c and myprintf.c: every SPI frame goes byte by byte through
+ * a model of the DataFlash command set (array reads, the two SRAM buffers,
+ * program, erase, compare, status register, deep power-down) with the array
+ * kept in a memory-mapped file. at45dbxx.c, ftl.c and logstore.c build
+ * unchanged on top of it.
+ *
+ * Time is simulated: SPI bytes, __delay_cycles and the busy periods of
+ * program and erase advance a clock that at45db_ticks reads, so busy
+ * measurements and throughput figures come out as on the target, only
+ * without waiting for them.
+ * at45sim_timeout and at45sim_powercut inject a stuck bus and a power loss
+ * in the middle of a page program.
+ *
+ * This header also replaces <msp430.h> for the files above, with plain
+ * variables for the registers they touch.
+ */
+
+#define AT45SIM_MAXDEV      4
+#define AT45SIM_MCLK_HZ     16000000UL /* __delay_cycles rate, SCK = MCLK / divisor */
+
+/* msp430.h stand-ins *****************************************************/
+
+#define BIT0    0x01
+#define BIT1    0x02
+#define BIT2    0x04
+#define BIT3    0x08
+#define BIT4    0x10
+#define BIT5    0x20
+#define BIT6    0x40
+#define BIT7    0x80
+
+extern volatile uint8_t P1OUT, P1DIR, P1IN, P1REN, P1IE, P1IES, P1IFG;
+extern volatile uint8_t P2OUT, P2DIR, P3OUT, P3DIR, P4OUT, P4DIR;
+extern volatile uint16_t TA0CTL, TA0R, TA0CCR1, TA0CCTL1;
+
+#define TASSEL__ACLK    0x0100
+#define MC__CONTINUOUS  0x0020
+#define MC_3            0x0030
+#define TACLR           0x0004
+#define TAIE            0x0002
+#define TAIFG           0x0001
+#define CCIE            0x0010
+
+#define GIE             0x0008
+#define CPUOFF          0x0010
+#define LPM3_bits       0x00d0
+
+#define __get_interrupt_state()     0
+#define __set_interrupt_state(x)    ((void)(x))
+#define __disable_interrupt()
+#define __enable_interrupt()
+#define __no_operation()
+#define __bis_SR_register(x)
+#define __delay_cycles(n)           at45sim_delay(n)
+
+/* Simulator ***************************************************************/
+
+struct at45sim_stats_s
+{
+    uint32_t frames;           /* Chip select frames addressed to the part */
+    uint32_t rdbytes;          /* Bytes read from the array */
+    uint32_t programs;         /* Page programs */
+    uint32_t erases;           /* Pages erased, by any erase command */
+    uint32_t maxwear;          /* Most erases of a single page */
+    uint32_t busyusec;         /* Time spent busy */
+    uint32_t violations;       /* Commands sent while busy or powered down */
+};
+
+int at45sim_attach(const char *path, volatile uint8_t *csOut, uint8_t csPin, uint8_t devid1, uint8_t binary);
+void at45sim_detach(void);
+uint32_t at45sim_ticks(void);
+uint32_t at45sim_usec(void);
+void at45sim_delay(unsigned long cycles);
+void at45sim_stats(int dev, struct at45sim_stats_s *stats, uint8_t reset);
+void at45sim_timeout(uint16_t n);
+void at45sim_powercut(uint32_t n);
+uint8_t at45sim_powered(void);
+
+#endif /* __AT45SIM_H__ */
@@ -0,0 +1,39 @@
+#ifndef __BLKDEV_H__
+#define __BLKDEV_H__
+
+#include <stdint.h>
+
+/* Block device interface
+ *
+ * The storage layers only need whole-block read, write and erase, so they can
+ * run on anything that fills in these operations: the AT45DB driver (the
+ * struct blkdev_s is the first member of struct at45db_dev_s), or the same
+ * driver on the host simulator (at45sim.c).
+ *
+ * All operations return the number of blocks done, or a negative value on
+ * error; sync and geometry return 1 on success.
+ */
+
+struct blkdev_geometry_s
+{
+    uint16_t blocksize;        /* Bytes per read/write block */
+    uint16_t eraseblocks;      /* Blocks per erase unit */
+    uint32_t nblocks;          /* Blocks in the device */
+};
+
+struct blkdev_s
+{
+    int (*read)(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf);
+    int (*write)(struct blkdev_s *dev, long startblock, unsigned int nblocks, uint8_t *buf);
+    int (*erase)(struct blkdev_s *dev, long startblock, unsigned int nblocks);
+    int (*sync)(struct blkdev_s *dev);
+    int (*geometry)(struct blkdev_s *dev, struct blkdev_geometry_s *geo);
+};
+
+#define blkdev_read(d, s, n, b)   ((d)->read((d), (s), (n), (b)))
+#define blkdev_write(d, s, n, b)  ((d)->write((d), (s), (n), (b)))
+#define blkdev_erase(d, s, n)     ((d)->erase((d), (s), (n)))
+#define blkdev_sync(d)            ((d)->sync(d))
+#define blkdev_geometry(d, g)     ((d)->geometry((d), (g)))
+
+#endif /* __BLKDEV_H__ */
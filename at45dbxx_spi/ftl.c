@@ -0,0 +1,607 @@
+
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
+#include <msp430.h>
+#endif
+#include <string.h>
+
+#include "at45dbxx.h"
+#include "ftl.h"
+#include "myprintf.h"
+
+#define FTL_MAGIC           0xa5
+#define FTL_SEALMAGIC       0x5ea1
+#define FTL_SEQMASK         0x00ffffffUL
+
+/* Newest of two 24-bit sequence numbers, tolerant of wrap around */
+
+#define FTL_SEQNEWER(a, b)  ((((a) - (b)) & FTL_SEQMASK) < 0x00800000UL)
+
+/* Page header, stored in the last FTL_HDRSIZE bytes of every programmed page */
+
+struct ftl_hdr_s
+{
+    uint16_t lpage;            /* Logical sector held by this page */
+    uint16_t ecount;           /* Erase count of the block when programmed */
+    uint8_t  seq[3];           /* 24-bit write sequence, the newest copy wins */
+    uint8_t  check;            /* ~XOR of the bytes above */
+};
+
+struct ftl_dev_s
+{
+    uint16_t pagesize;         /* Physical page size */
+    uint16_t sectsize;         /* Logical sector size, the header follows it */
+    uint16_t npages;           /* Physical pages managed */
+    uint16_t nblocks;          /* Erase blocks managed */
+    uint16_t nsectors;         /* Logical sectors exported */
+    uint16_t nfree;            /* Fully erased blocks, not counting active */
+    uint16_t active;           /* Block being filled, FTL_FREE if none */
+    uint8_t  next;             /* Next erased page in the active block */
+    uint32_t seq;              /* Sequence number of the next program */
+};
+
+/* Seal over the FRAM maps. Cleared while a program or erase is under way,
+ * so the maps only count as current if it is intact at mount.
+ */
+
+struct ftl_seal_s
+{
+    uint16_t magic;            /* FTL_SEALMAGIC when the maps match the flash */
+    uint16_t pagesize;         /* Geometry the maps were built for */
+    uint16_t nblocks;
+    uint32_t seq;              /* g_ftl.seq at the last update */
+};
+
+struct ftl_dev_s g_ftl;
+
+/* The maps do not fit the 2KB of RAM, so they live in FRAM. g_ecount also
+ * survives resets; the ecount in each page header backs it up at mount.
+ */
+
+#if defined(CONFIG_AT45DB_SIM)
+#define FTL_FRAM
+#elif defined(__TI_COMPILER_VERSION__)
+#pragma PERSISTENT(g_l2p)
+#pragma PERSISTENT(g_p2l)
+#pragma PERSISTENT(g_ecount)
+#pragma PERSISTENT(g_ftlseal)
+#define FTL_FRAM
+#elif defined(__GNUC__)
+#define FTL_FRAM __attribute__ ((persistent))
+#else
+#error Compiler not supported!
+#endif
+
+FTL_FRAM uint16_t g_l2p[FTL_MAXPAGES] = {0};      /* Sector -> page */
+FTL_FRAM uint16_t g_p2l[FTL_MAXPAGES] = {0};      /* Page -> sector, FTL_FREE or FTL_STALE */
+FTL_FRAM uint16_t g_ecount[FTL_MAXBLOCKS] = {0};  /* Erase count per block */
+FTL_FRAM volatile struct ftl_seal_s g_ftlseal = {0};
+
+uint8_t g_ftlpage[FTL_MAXPAGESIZE];
+
+uint8_t ftl_check(struct ftl_hdr_s *hdr);
+int ftl_rdhdr(uint16_t page, struct ftl_hdr_s *hdr);
+void ftl_seal(void);
+void ftl_scan(void);
+void ftl_program(uint16_t sector, uint16_t page);
+uint16_t ftl_freeblock(void);
+uint16_t ftl_take(void);
+int ftl_gc(void);
+
+/************************************************************************************
+ * Name: ftl_check
+ ************************************************************************************/
+
+uint8_t ftl_check(struct ftl_hdr_s *hdr)
+{
+    uint8_t *ptr = (uint8_t *)hdr;
+    uint8_t check = FTL_MAGIC;
+    uint8_t i;
+
+    for (i = 0; i < FTL_HDRSIZE - 1; i++)
+    {
+        check ^= ptr[i];
+    }
+
+    return ~check;
+}
+
+/************************************************************************************
+ * Name: ftl_rdhdr
+ *
+ * Description:
+ *   Read the header of a physical page. Returns 0 if the page is erased, 1 if
+ *   the header is valid and -1 for anything else (torn or foreign data).
+ *
+ ************************************************************************************/
+
+int ftl_rdhdr(uint16_t page, struct ftl_hdr_s *hdr)
+{
+    uint8_t *ptr = (uint8_t *)hdr;
+    uint8_t i;
+
+    at45db_read((long)page * g_ftl.pagesize + g_ftl.sectsize, FTL_HDRSIZE, ptr);
+
+    for (i = 0; i < FTL_HDRSIZE && ptr[i] == 0xff; i++);
+    if (i == FTL_HDRSIZE)
+    {
+        return 0;
+    }
+
+    return (ftl_check(hdr) == hdr->check) ? 1 : -1;
+}
+
+/************************************************************************************
+ * Name: ftl_seal
+ *
+ * Description:
+ *   Mark the FRAM maps as matching the flash again. The magic goes last, so a
+ *   reset half way through leaves the seal broken.
+ *
+ ************************************************************************************/
+
+void ftl_seal(void)
+{
+    g_ftlseal.pagesize = g_ftl.pagesize;
+    g_ftlseal.nblocks  = g_ftl.nblocks;
+    g_ftlseal.seq      = g_ftl.seq;
+    g_ftlseal.magic    = FTL_SEALMAGIC;
+}
+
+/************************************************************************************
+ * Name: ftl_program
+ *
+ * Description:
+ *   Seal g_ftlpage with a header for sector and program it into the erased
+ *   page, then retire the previous copy.
+ *
+ ************************************************************************************/
+
+void ftl_program(uint16_t sector, uint16_t page)
+{
+    struct ftl_hdr_s hdr;
+    uint16_t old;
+
+    hdr.lpage  = sector;
+    hdr.ecount = g_ecount[page / PG_PER_BLOCK];
+    hdr.seq[0] = g_ftl.seq & 0xff;
+    hdr.seq[1] = (g_ftl.seq >> 8) & 0xff;
+    hdr.seq[2] = (g_ftl.seq >> 16) & 0xff;
+    hdr.check  = ftl_check(&hdr);
+    g_ftl.seq  = (g_ftl.seq + 1) & FTL_SEQMASK;
+
+    memcpy(&g_ftlpage[g_ftl.sectsize], &hdr, FTL_HDRSIZE);
+    memset(&g_ftlpage[g_ftl.sectsize + FTL_HDRSIZE], 0xff, g_ftl.pagesize - g_ftl.sectsize - FTL_HDRSIZE);
+
+    g_ftlseal.magic = 0;
+    at45db_bprogram(page, 1, g_ftlpage);
+
+    old = g_l2p[sector];
+    if (old != FTL_FREE)
+    {
+        g_p2l[old] = FTL_STALE;
+    }
+
+    g_l2p[sector] = page;
+    g_p2l[page] = sector;
+
+    ftl_seal();
+}
+
+/************************************************************************************
+ * Name: ftl_freeblock
+ *
+ * Description:
+ *   Dynamic wear leveling: of all fully erased blocks, return the one with the
+ *   fewest erases.
+ *
+ ************************************************************************************/
+
+uint16_t ftl_freeblock(void)
+{
+    uint16_t best = FTL_FREE;
+    uint16_t b, p;
+
+    for (b = 0; b < g_ftl.nblocks; b++)
+    {
+        if (b == g_ftl.active)
+        {
+            continue;
+        }
+
+        for (p = b * PG_PER_BLOCK; p < (b + 1) * PG_PER_BLOCK && g_p2l[p] == FTL_FREE; p++);
+        if (p < (b + 1) * PG_PER_BLOCK)
+        {
+            continue;
+        }
+
+        if (best == FTL_FREE || g_ecount[b] < g_ecount[best])
+        {
+            best = b;
+        }
+    }
+
+    return best;
+}
+
+/************************************************************************************
+ * Name: ftl_take
+ *
+ * Description:
+ *   Return the next erased page, opening a new block when the active one is
+ *   full. Never collects garbage, so it is safe to call from ftl_gc.
+ *
+ ************************************************************************************/
+
+uint16_t ftl_take(void)
+{
+    uint16_t b;
+
+    if (g_ftl.active == FTL_FREE || g_ftl.next >= PG_PER_BLOCK)
+    {
+        b = ftl_freeblock();
+        if (b == FTL_FREE)
+        {
+            return FTL_FREE;
+        }
+
+        g_ftl.active = b;
+        g_ftl.next = 0;
+        g_ftl.nfree--;
+    }
+
+    return g_ftl.active * PG_PER_BLOCK + g_ftl.next++;
+}
+
+/************************************************************************************
+ * Name: ftl_gc
+ *
+ * Description:
+ *   Pick the block with the most stale pages (fewest erases on a tie), move
+ *   its live pages to the active block and erase it with one block erase.
+ *
+ ************************************************************************************/
+
+int ftl_gc(void)
+{
+    uint16_t victim = FTL_FREE;
+    uint16_t nstale, beststale = 0;
+    uint16_t b, p, page, sector;
+    uint8_t i;
+
+    for (b = 0; b < g_ftl.nblocks; b++)
+    {
+        if (b == g_ftl.active)
+        {
+            continue;
+        }
+
+        nstale = 0;
+        for (p = b * PG_PER_BLOCK; p < (b + 1) * PG_PER_BLOCK; p++)
+        {
+            if (g_p2l[p] == FTL_STALE)
+            {
+                nstale++;
+            }
+        }
+
+        if (nstale > beststale ||
+            (nstale && nstale == beststale && g_ecount[b] < g_ecount[victim]))
+        {
+            victim = b;
+            beststale = nstale;
+        }
+    }
+
+    if (victim == FTL_FREE)
+    {
+        return -1;             /* Every page is live: the FTL is full */
+    }
+
+    for (i = 0; i < PG_PER_BLOCK; i++)
+    {
+        p = victim * PG_PER_BLOCK + i;
+        sector = g_p2l[p];
+        if (sector >= FTL_STALE)
+        {
+            continue;
+        }
+
+        page = ftl_take();
+        if (page == FTL_FREE)
+        {
+            return -1;
+        }
+
+        at45db_bread(p, 1, g_ftlpage);
+        ftl_program(sector, page);
+    }
+
+    g_ftlseal.magic = 0;
+    at45db_blkerase(victim);
+    g_ecount[victim]++;
+
+    for (p = victim * PG_PER_BLOCK; p < (victim + 1) * PG_PER_BLOCK; p++)
+    {
+        g_p2l[p] = FTL_FREE;
+    }
+
+    ftl_seal();
+
+    g_ftl.nfree++;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: ftl_scan
+ *
+ * Description:
+ *   Rebuild the logical to physical map from the page headers. When two pages
+ *   claim the same sector (power lost before the old copy was reclaimed) the
+ *   newer sequence number wins.
+ *
+ ************************************************************************************/
+
+void ftl_scan(void)
+{
+    struct ftl_hdr_s hdr;
+    struct ftl_hdr_s prev;
+    uint32_t seq, prevseq;
+    uint16_t p, b, old;
+    uint8_t first = 1;
+    int ret;
+
+    for (p = 0; p < g_ftl.npages; p++)
+    {
+        g_l2p[p] = FTL_FREE;
+    }
+
+    for (p = 0; p < g_ftl.npages; p++)
+    {
+        g_p2l[p] = FTL_FREE;
+
+        ret = ftl_rdhdr(p, &hdr);
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        g_p2l[p] = FTL_STALE;
+        if (ret < 0)
+        {
+            continue;
+        }
+
+        b = p / PG_PER_BLOCK;
+        if (hdr.ecount > g_ecount[b])
+        {
+            g_ecount[b] = hdr.ecount;
+        }
+
+        seq = hdr.seq[0] | ((uint32_t)hdr.seq[1] << 8) | ((uint32_t)hdr.seq[2] << 16);
+        if (first || FTL_SEQNEWER(seq, g_ftl.seq))
+        {
+            g_ftl.seq = seq;
+            first = 0;
+        }
+
+        if (hdr.lpage >= g_ftl.nsectors)
+        {
+            continue;
+        }
+
+        old = g_l2p[hdr.lpage];
+        if (old != FTL_FREE)
+        {
+            ftl_rdhdr(old, &prev);
+            prevseq = prev.seq[0] | ((uint32_t)prev.seq[1] << 8) | ((uint32_t)prev.seq[2] << 16);
+            if (!FTL_SEQNEWER(seq, prevseq))
+            {
+                continue;
+            }
+
+            g_p2l[old] = FTL_STALE;
+        }
+
+        g_l2p[hdr.lpage] = p;
+        g_p2l[p] = hdr.lpage;
+    }
+
+    g_ftl.seq = first ? 0 : ((g_ftl.seq + 1) & FTL_SEQMASK);
+}
+
+/************************************************************************************
+ * Name: ftl_mount
+ *
+ * Description:
+ *   Pick up the FRAM maps if the seal shows they match the flash, otherwise
+ *   scan every page header to rebuild them.
+ *
+ ************************************************************************************/
+
+int ftl_mount(void)
+{
+    struct at45db_geometry_s geo;
+    uint16_t p, b;
+    uint8_t sealed;
+    uint8_t i;
+
+    if (at45db_geometry(&geo) < 0 || geo.blocksize > FTL_MAXPAGESIZE)
+    {
+        return -1;
+    }
+
+    /* In DataFlash page mode (264/528 bytes) the header fits the bytes above the
+     * power of 2, so sectors keep the binary size. In binary page mode it comes
+     * out of the sector.
+     */
+
+    g_ftl.pagesize = geo.blocksize;
+    for (g_ftl.sectsize = 1; g_ftl.sectsize * 2 <= geo.blocksize; g_ftl.sectsize <<= 1);
+    if (geo.blocksize - g_ftl.sectsize < FTL_HDRSIZE)
+    {
+        g_ftl.sectsize = geo.blocksize - FTL_HDRSIZE;
+    }
+
+    g_ftl.nblocks = (geo.neraseblocks < FTL_MAXBLOCKS) ? geo.neraseblocks : FTL_MAXBLOCKS;
+    g_ftl.npages = g_ftl.nblocks * PG_PER_BLOCK;
+    g_ftl.nsectors = (g_ftl.nblocks - FTL_RESERVE_BLOCKS) * PG_PER_BLOCK;
+    g_ftl.active = FTL_FREE;
+    g_ftl.next = 0;
+    g_ftl.nfree = 0;
+    g_ftl.seq = 0;
+
+    sealed = (g_ftlseal.magic == FTL_SEALMAGIC && g_ftlseal.pagesize == g_ftl.pagesize &&
+              g_ftlseal.nblocks == g_ftl.nblocks);
+    if (sealed)
+    {
+        g_ftl.seq = g_ftlseal.seq;
+    }
+    else
+    {
+        ftl_scan();
+    }
+
+    /* Count the erased blocks and carry on filling a block that was only
+     * partly programmed before the reset.
+     */
+
+    for (b = 0; b < g_ftl.nblocks; b++)
+    {
+        for (i = PG_PER_BLOCK; i > 0 && g_p2l[b * PG_PER_BLOCK + i - 1] == FTL_FREE; i--);
+
+        if (i == 0)
+        {
+            g_ftl.nfree++;
+        }
+        else if (i < PG_PER_BLOCK && g_ftl.active == FTL_FREE)
+        {
+            g_ftl.active = b;
+            g_ftl.next = i;
+        }
+    }
+
+    /* After a scan the first page after the last header may be a torn program,
+     * only keep writing there if it really is erased. With the seal intact no
+     * program was cut short.
+     */
+
+    if (!sealed && g_ftl.active != FTL_FREE)
+    {
+        b = g_ftl.active * PG_PER_BLOCK + g_ftl.next;
+        at45db_bread(b, 1, g_ftlpage);
+        for (p = 0; p < g_ftl.pagesize && g_ftlpage[p] == 0xff; p++);
+        if (p < g_ftl.pagesize)
+        {
+            g_p2l[b] = FTL_STALE;
+            g_ftl.next++;
+        }
+    }
+
+    ftl_seal();
+
+    myprintf("ftl: %d sectors of %d bytes, %d free blocks\r\n", (unsigned long)g_ftl.nsectors,
+             (unsigned long)g_ftl.sectsize, (unsigned long)g_ftl.nfree);
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: ftl_format
+ ************************************************************************************/
+
+int ftl_format(void)
+{
+    uint16_t b;
+
+    if (g_ftl.nblocks == 0 && ftl_mount() < 0)
+    {
+        return -1;
+    }
+
+    g_ftlseal.magic = 0;
+    for (b = 0; b < g_ftl.nblocks; b++)
+    {
+        at45db_blkerase(b);
+        g_ecount[b]++;
+    }
+
+    return ftl_mount();
+}
+
+/************************************************************************************
+ * Name: ftl_read
+ ************************************************************************************/
+
+int ftl_read(uint16_t sector, uint8_t *buffer)
+{
+    uint16_t page;
+
+    if (sector >= g_ftl.nsectors)
+    {
+        return -1;
+    }
+
+    page = g_l2p[sector];
+    if (page == FTL_FREE)
+    {
+        memset(buffer, 0xff, g_ftl.sectsize);
+        return 1;
+    }
+
+    return (at45db_read((long)page * g_ftl.pagesize, g_ftl.sectsize, buffer) > 0) ? 1 : -1;
+}
+
+/************************************************************************************
+ * Name: ftl_write
+ ************************************************************************************/
+
+int ftl_write(uint16_t sector, uint8_t *buffer)
+{
+    uint16_t page;
+
+    if (sector >= g_ftl.nsectors)
+    {
+        return -1;
+    }
+
+    /* Opening a new block: keep one erased block back so that garbage
+     * collection always has somewhere to move live pages to.
+     */
+
+    while ((g_ftl.active == FTL_FREE || g_ftl.next >= PG_PER_BLOCK) && g_ftl.nfree < 2)
+    {
+        if (ftl_gc() < 0)
+        {
+            return -1;
+        }
+    }
+
+    page = ftl_take();
+    if (page == FTL_FREE)
+    {
+        return -1;
+    }
+
+    memcpy(g_ftlpage, buffer, g_ftl.sectsize);
+    ftl_program(sector, page);
+
+    return 1;
+}
+
+uint16_t ftl_sectsize(void)
+{
+    return g_ftl.sectsize;
+}
+
+uint16_t ftl_nsectors(void)
+{
+    return g_ftl.nsectors;
+}
+
+uint16_t ftl_erasecount(uint16_t block)
+{
+    return (block < g_ftl.nblocks) ? g_ecount[block] : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __FTL_H__
+#define __FTL_H__
+
+#include <stdint.h>
+
+#include "at45dbxx.h"
+
+/* Flash translation layer over the AT45DB
+ *
+ * Logical sectors are remapped to any physical page on every write, so a
+ * sector that is rewritten all the time does not wear out one page. Pages
+ * are only programmed into pre-erased blocks; garbage collection moves the
+ * live pages out of a block and erases the whole block (PG_PER_BLOCK pages)
+ * at once.
+ *
+ * Each programmed page carries an FTL_HDRSIZE header after the sector data,
+ * which is all ftl_mount needs to rebuild the maps. On a part in DataFlash
+ * page mode the header lives in the 8 extra bytes of the 264 byte page.
+ * The maps stay in FRAM across resets, so ftl_mount only reads the headers
+ * when a program or erase was cut short and left them unsealed.
+ */
+
+#define FTL_MAXPAGES        2048   /* Physical pages tracked (AT45DB041) */
+#define FTL_MAXBLOCKS       (FTL_MAXPAGES / PG_PER_BLOCK)
+#define FTL_RESERVE_BLOCKS  4      /* Blocks kept back for garbage collection */
+#define FTL_MAXPAGESIZE     264    /* Largest page g_ftlpage can hold */
+#define FTL_HDRSIZE         8
+
+#define FTL_FREE            0xffff /* p2l: erased page, l2p: unmapped sector */
+#define FTL_STALE           0xfffe /* p2l: superseded copy, reclaimed by GC */
+
+int ftl_mount(void);
+int ftl_format(void);
+int ftl_read(uint16_t sector, uint8_t *buffer);
+int ftl_write(uint16_t sector, uint8_t *buffer);
+uint16_t ftl_sectsize(void);
+uint16_t ftl_nsectors(void);
+uint16_t ftl_erasecount(uint16_t block);
+
+#endif /* __FTL_H__ */
@@ -0,0 +1,498 @@
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
+#include <msp430.h>
+#endif
+#include <string.h>
+
+#include "at45dbxx.h"
+#include "kvstore.h"
+#include "logstore.h"
+#include "myprintf.h"
+
+#define KVSTORE_MAGIC       0x4b56 /* "KV" */
+
+#define KVSTORE_EMPTY       0xffff /* Slot never used */
+#define KVSTORE_DEAD        0xfffe /* Slot of a dropped key, reusable */
+
+/* Index entry: where the newest record of a key is */
+
+struct kvstore_slot_s
+{
+    uint16_t key;              /* KVSTORE_EMPTY, KVSTORE_DEAD or the key */
+    uint8_t  page;             /* Page relative to start */
+    uint8_t  len;              /* Value length, KVSTORE_DELETED if deleted */
+    uint16_t off;              /* Record offset in the page */
+};
+
+struct kvstore_dev_s
+{
+    long     start;            /* First page of the store */
+    uint16_t npages;           /* Pages in the store */
+    uint16_t pagesize;
+    uint32_t seq;              /* Sequence of the next page */
+    uint32_t tailseq;          /* Oldest live page */
+    uint16_t used;             /* Bytes staged in g_kvpage, 0 outside a transaction */
+    uint8_t  nused;            /* Slots holding a key */
+    uint8_t  nnew;             /* Keys the staged transaction may add */
+};
+
+struct kvstore_dev_s g_kv;
+
+/* The index is rebuilt at mount, FRAM only saves the RAM */
+
+#if defined(CONFIG_AT45DB_SIM)
+#define KVSTORE_FRAM
+#elif defined(__TI_COMPILER_VERSION__)
+#pragma PERSISTENT(g_kvslot)
+#define KVSTORE_FRAM
+#elif defined(__GNUC__)
+#define KVSTORE_FRAM __attribute__ ((persistent))
+#else
+#error Compiler not supported!
+#endif
+
+KVSTORE_FRAM struct kvstore_slot_s g_kvslot[KVSTORE_SLOTS] = {{0}};
+
+uint8_t g_kvpage[KVSTORE_PAGESIZE];
+
+#define kvstore_page(s)     ((uint8_t)(((s) - 1) % g_kv.npages))
+#define kvstore_free()      (g_kv.npages - (uint16_t)(g_kv.seq - g_kv.tailseq))
+#define kvstore_addr(p, o)  ((g_kv.start + (p)) * g_kv.pagesize + (o))
+
+int kvstore_find(uint16_t key);
+int kvstore_insert(uint16_t key, uint8_t page, uint16_t off, uint8_t len);
+int kvstore_probe(uint8_t page, struct kvstore_hdr_s *hdr);
+void kvstore_apply(uint8_t page);
+void kvstore_flush(uint16_t used);
+int kvstore_reclaim(void);
+
+/************************************************************************************
+ * Name: kvstore_find
+ *
+ * Description:
+ *   Index slot of key, -1 if the key has never been written (or was deleted
+ *   and compacted away). Linear probing from the multiplicative hash.
+ *
+ ************************************************************************************/
+
+int kvstore_find(uint16_t key)
+{
+    uint8_t i = (uint16_t)(key * 40503U) >> (16 - KVSTORE_SLOTBITS);
+    uint8_t n;
+
+    for (n = 0; n < KVSTORE_SLOTS; n++)
+    {
+        if (g_kvslot[i].key == key)
+        {
+            return i;
+        }
+
+        if (g_kvslot[i].key == KVSTORE_EMPTY)
+        {
+            break;
+        }
+
+        i = (i + 1) & (KVSTORE_SLOTS - 1);
+    }
+
+    return -1;
+}
+
+int kvstore_insert(uint16_t key, uint8_t page, uint16_t off, uint8_t len)
+{
+    int slot = kvstore_find(key);
+    uint8_t i;
+
+    if (slot < 0)
+    {
+        i = (uint16_t)(key * 40503U) >> (16 - KVSTORE_SLOTBITS);
+        while (g_kvslot[i].key != KVSTORE_EMPTY && g_kvslot[i].key != KVSTORE_DEAD)
+        {
+            i = (i + 1) & (KVSTORE_SLOTS - 1);
+        }
+
+        slot = i;
+        g_kvslot[slot].key = key;
+        g_kv.nused++;
+    }
+
+    g_kvslot[slot].page = page;
+    g_kvslot[slot].off  = off;
+    g_kvslot[slot].len  = len;
+
+    return slot;
+}
+
+/************************************************************************************
+ * Name: kvstore_probe
+ *
+ * Description:
+ *   Read a whole page into g_kvpage and check it. Returns 1 with its header
+ *   for a committed page, 0 otherwise (erased, torn or foreign).
+ *
+ ************************************************************************************/
+
+int kvstore_probe(uint8_t page, struct kvstore_hdr_s *hdr)
+{
+    uint16_t end = g_kv.pagesize - KVSTORE_CRCSIZE;
+    uint32_t crc;
+
+    at45db_bread(g_kv.start + page, 1, g_kvpage);
+
+    memcpy(hdr, g_kvpage, sizeof(*hdr));
+    memcpy(&crc, &g_kvpage[end], KVSTORE_CRCSIZE);
+
+    return hdr->magic == KVSTORE_MAGIC && hdr->used <= end && logstore_crc(g_kvpage, end) == crc;
+}
+
+/************************************************************************************
+ * Name: kvstore_apply
+ *
+ * Description:
+ *   Point the index at every record of the page in g_kvpage. Later records
+ *   of a key override earlier ones.
+ *
+ ************************************************************************************/
+
+void kvstore_apply(uint8_t page)
+{
+    struct kvstore_hdr_s *hdr = (struct kvstore_hdr_s *)g_kvpage;
+    uint16_t off = KVSTORE_HDRSIZE;
+    uint16_t key;
+    uint8_t len;
+
+    while (off + KVSTORE_RECHDR <= hdr->used)
+    {
+        key = g_kvpage[off] | (g_kvpage[off + 1] << 8);
+        len = g_kvpage[off + 2];
+
+        kvstore_insert(key, page, off, len);
+
+        off += KVSTORE_RECHDR + (len == KVSTORE_DELETED ? 0 : len);
+    }
+}
+
+/************************************************************************************
+ * Name: kvstore_flush
+ *
+ * Description:
+ *   Seal g_kvpage (used bytes of header and records) and program it as the
+ *   head page, then index its records.
+ *
+ ************************************************************************************/
+
+void kvstore_flush(uint16_t used)
+{
+    struct kvstore_hdr_s *hdr = (struct kvstore_hdr_s *)g_kvpage;
+    uint16_t end = g_kv.pagesize - KVSTORE_CRCSIZE;
+    uint8_t page = kvstore_page(g_kv.seq);
+    uint32_t crc;
+
+    hdr->seq     = g_kv.seq;
+    hdr->tailseq = g_kv.tailseq;
+    hdr->magic   = KVSTORE_MAGIC;
+    hdr->used    = used;
+
+    memset(&g_kvpage[used], 0xff, end - used);
+    crc = logstore_crc(g_kvpage, end);
+    memcpy(&g_kvpage[end], &crc, KVSTORE_CRCSIZE);
+
+    at45db_bwrite(g_kv.start + page, 1, g_kvpage);
+    g_kv.seq++;
+
+    kvstore_apply(page);
+}
+
+/************************************************************************************
+ * Name: kvstore_reclaim
+ *
+ * Description:
+ *   Release the oldest pages until more than KVSTORE_MINFREE are free. The live
+ *   records of each released page (those the index still points at) are
+ *   gathered into g_kvpage and programmed at the head; deletion records are
+ *   dropped with the page, as no older record of their key is left. The tail
+ *   is only recorded in the next page written, so a power loss before that
+ *   brings the released pages back intact. That holds as long as the pages
+ *   written here and by the commit were free before the pass: at least one
+ *   is on entry, and every flush releases one or more, so one page stays
+ *   free after the relocation and the commit.
+ *
+ *   Returns 1, or -1 if the store is full of live records.
+ *
+ ************************************************************************************/
+
+int kvstore_reclaim(void)
+{
+    struct kvstore_slot_s *slot;
+    uint16_t end = g_kv.pagesize - KVSTORE_CRCSIZE;
+    uint16_t used = KVSTORE_HDRSIZE;
+    uint16_t need, flushes = 0;
+    uint8_t page, i;
+
+    while (kvstore_free() <= KVSTORE_MINFREE && g_kv.tailseq < g_kv.seq)
+    {
+        page = kvstore_page(g_kv.tailseq);
+
+        need = 0;
+        for (i = 0, slot = g_kvslot; i < KVSTORE_SLOTS; i++, slot++)
+        {
+            if (slot->key <= KVSTORE_MAXKEY && slot->page == page && slot->len != KVSTORE_DELETED)
+            {
+                need += KVSTORE_RECHDR + slot->len;
+            }
+        }
+
+        if (used + need > end)
+        {
+            /* Moving pages that are all live gains nothing */
+
+            if (++flushes > g_kv.npages)
+            {
+                return -1;
+            }
+
+            kvstore_flush(used);
+            used = KVSTORE_HDRSIZE;
+            continue;
+        }
+
+        for (i = 0, slot = g_kvslot; i < KVSTORE_SLOTS; i++, slot++)
+        {
+            if (slot->key > KVSTORE_MAXKEY || slot->page != page)
+            {
+                continue;
+            }
+
+            if (slot->len == KVSTORE_DELETED)
+            {
+                slot->key = KVSTORE_DEAD;
+                g_kv.nused--;
+            }
+            else
+            {
+                at45db_read(kvstore_addr(page, slot->off), KVSTORE_RECHDR + slot->len, &g_kvpage[used]);
+                used += KVSTORE_RECHDR + slot->len;
+            }
+        }
+
+        g_kv.tailseq++;
+    }
+
+    if (used > KVSTORE_HDRSIZE)
+    {
+        kvstore_flush(used);
+    }
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: kvstore_mount
+ *
+ * Description:
+ *   Find the newest committed page of the store in pages [start, start +
+ *   npages) and rebuild the index from its tail on.
+ *
+ ************************************************************************************/
+
+int kvstore_mount(long start, uint16_t npages)
+{
+    struct at45db_geometry_s geo;
+    struct kvstore_hdr_s hdr;
+    uint32_t newest = 0, tailseq = 1, seq;
+    uint16_t p;
+
+    if (at45db_geometry(&geo) < 0 || geo.blocksize > KVSTORE_PAGESIZE ||
+        npages <= KVSTORE_MINFREE || npages > KVSTORE_MAXPAGES)
+    {
+        return -1;
+    }
+
+    g_kv.start    = start;
+    g_kv.npages   = npages;
+    g_kv.pagesize = geo.blocksize;
+    g_kv.used     = 0;
+    g_kv.nused    = 0;
+
+    memset(g_kvslot, 0xff, sizeof(g_kvslot));
+
+    for (p = 0; p < npages; p++)
+    {
+        if (kvstore_probe(p, &hdr) && hdr.seq > newest)
+        {
+            newest  = hdr.seq;
+            tailseq = hdr.tailseq;
+        }
+    }
+
+    if (newest >= npages && tailseq <= newest - npages)
+    {
+        tailseq = newest - npages + 1;
+    }
+
+    for (seq = tailseq; seq <= newest; seq++)
+    {
+        p = kvstore_page(seq);
+        if (kvstore_probe(p, &hdr) && hdr.seq == seq)
+        {
+            kvstore_apply(p);
+        }
+        else
+        {
+            myprintf("kv: page %d lost\r\n", (unsigned long)p);
+        }
+    }
+
+    g_kv.seq     = newest + 1;
+    g_kv.tailseq = tailseq;
+
+    myprintf("kv: %d keys, %d of %d pages free\r\n", (unsigned long)g_kv.nused,
+             (unsigned long)kvstore_free(), (unsigned long)npages);
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: kvstore_format
+ ************************************************************************************/
+
+int kvstore_format(void)
+{
+    if (g_kv.npages == 0)
+    {
+        return -1;
+    }
+
+    at45db_erase(g_kv.start, g_kv.npages);
+
+    return kvstore_mount(g_kv.start, g_kv.npages);
+}
+
+/************************************************************************************
+ * Name: kvstore_get
+ *
+ * Description:
+ *   Copy up to maxlen bytes of the value of key. Returns the full value
+ *   length, or -1 if the key is not set.
+ *
+ ************************************************************************************/
+
+int kvstore_get(uint16_t key, uint8_t *value, uint8_t maxlen)
+{
+    struct kvstore_slot_s *slot;
+    int i = kvstore_find(key);
+
+    if (i < 0 || g_kvslot[i].len == KVSTORE_DELETED)
+    {
+        return -1;
+    }
+
+    slot = &g_kvslot[i];
+    at45db_read(kvstore_addr(slot->page, slot->off + KVSTORE_RECHDR),
+                slot->len < maxlen ? slot->len : maxlen, value);
+
+    return slot->len;
+}
+
+/************************************************************************************
+ * Name: kvstore_begin
+ *
+ * Description:
+ *   Start a transaction. Compacts first if the store runs out of pages, so
+ *   the commit always has one.
+ *
+ ************************************************************************************/
+
+int kvstore_begin(void)
+{
+    if (g_kv.npages == 0 || kvstore_reclaim() < 0)
+    {
+        return -1;
+    }
+
+    g_kv.used = KVSTORE_HDRSIZE;
+    g_kv.nnew = 0;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: kvstore_put
+ *
+ * Description:
+ *   Stage a value for the commit. All records of a transaction share one
+ *   page, so this fails once the page is full.
+ *
+ ************************************************************************************/
+
+int kvstore_put(uint16_t key, const uint8_t *value, uint8_t len)
+{
+    uint16_t end = g_kv.pagesize - KVSTORE_CRCSIZE;
+    uint16_t n = KVSTORE_RECHDR + (len == KVSTORE_DELETED ? 0 : len);
+
+    if (g_kv.used == 0 || key > KVSTORE_MAXKEY || g_kv.used + n > end)
+    {
+        return -1;
+    }
+
+    if (kvstore_find(key) < 0)
+    {
+        /* Keep a quarter of the index empty so probes stay short */
+
+        if (g_kv.nused + g_kv.nnew >= KVSTORE_SLOTS * 3 / 4)
+        {
+            return -1;
+        }
+
+        g_kv.nnew++;
+    }
+
+    g_kvpage[g_kv.used]     = key & 0xff;
+    g_kvpage[g_kv.used + 1] = key >> 8;
+    g_kvpage[g_kv.used + 2] = len;
+    if (len != KVSTORE_DELETED)
+    {
+        memcpy(&g_kvpage[g_kv.used + KVSTORE_RECHDR], value, len);
+    }
+
+    g_kv.used += n;
+
+    return 1;
+}
+
+int kvstore_del(uint16_t key)
+{
+    return kvstore_put(key, 0, KVSTORE_DELETED);
+}
+
+/************************************************************************************
+ * Name: kvstore_commit
+ *
+ * Description:
+ *   Program the staged records as one page. Either all of them are visible
+ *   after a power loss or none.
+ *
+ ************************************************************************************/
+
+int kvstore_commit(void)
+{
+    if (g_kv.used == 0)
+    {
+        return -1;
+    }
+
+    if (g_kv.used > KVSTORE_HDRSIZE)
+    {
+        kvstore_flush(g_kv.used);
+    }
+
+    g_kv.used = 0;
+
+    return 1;
+}
+
+void kvstore_abort(void)
+{
+    g_kv.used = 0;
+}
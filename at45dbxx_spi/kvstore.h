@@ -0,0 +1,57 @@
+#ifndef __KVSTORE_H__
+#define __KVSTORE_H__
+
+#include <stdint.h>
+
+#include "at45dbxx.h"
+
+/* Key-value store for configuration on a range of AT45DB pages
+ *
+ * Values are written log structured: every commit programs one new page at
+ * the head of the range with all the records of the transaction, so a
+ * commit of several keys is atomic (the page CRC either checks or the whole
+ * page is ignored). A hash index in FRAM maps each key to the page and
+ * offset of its newest record, so a lookup is a single read of the value.
+ * The index is rebuilt from the pages at mount.
+ *
+ * When no more than KVSTORE_MINFREE pages are free, kvstore_begin copies
+ * the live records of the oldest pages forward and releases them. One page
+ * more than the relocation and the commit need stays free, so neither is
+ * ever programmed over a page released in the same pass, whose records
+ * would then only exist in RAM.
+ *
+ * Page layout:
+ *   struct kvstore_hdr_s | (key, len, value) ... | 0xff ... | page CRC32
+ */
+
+#define KVSTORE_PAGESIZE    264    /* Largest page the RAM buffer holds */
+#define KVSTORE_HDRSIZE     12
+#define KVSTORE_CRCSIZE     4
+#define KVSTORE_RECHDR      3      /* Key (LE) and value length */
+
+#define KVSTORE_MAXPAGES    256
+#define KVSTORE_MINFREE     2      /* Pages for a commit plus compaction, one more stays free */
+#define KVSTORE_SLOTBITS    6
+#define KVSTORE_SLOTS       (1 << KVSTORE_SLOTBITS)
+
+#define KVSTORE_MAXKEY      0xfffd /* 0xfffe and 0xffff mark index slots */
+#define KVSTORE_DELETED     0xff   /* Length of a deletion record */
+
+struct kvstore_hdr_s
+{
+    uint32_t seq;              /* Page sequence, page (seq - 1) % npages */
+    uint32_t tailseq;          /* Oldest page still live when this one was written */
+    uint16_t magic;            /* KVSTORE_MAGIC */
+    uint16_t used;             /* Bytes of header and records */
+};
+
+int kvstore_mount(long start, uint16_t npages);
+int kvstore_format(void);
+int kvstore_get(uint16_t key, uint8_t *value, uint8_t maxlen);
+int kvstore_begin(void);
+int kvstore_put(uint16_t key, const uint8_t *value, uint8_t len);
+int kvstore_del(uint16_t key);
+int kvstore_commit(void);
+void kvstore_abort(void);
+
+#endif /* __KVSTORE_H__ */
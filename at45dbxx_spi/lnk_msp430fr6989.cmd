@@ -167,6 +167,8 @@ SECTIONS
 #else
     .text             : {} >> FRAM2 | FRAM  /* Code                              */
 #endif
+
+    .pgcache          : type = NOINIT {} > FRAM2 /* AT45DB page cache (pgcache.c)  */
 #ifdef __TI_COMPILER_VERSION__
   #if __TI_COMPILER_VERSION__ >= 15009000
     #ifndef __LARGE_CODE_MODEL__
@@ -0,0 +1,559 @@
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
+#include <msp430.h>
+#endif
+#include <string.h>
+
+#include "at45dbxx.h"
+#include "logstore.h"
+#include "logpack.h"
+#include "myprintf.h"
+
+#define LOGPACK_MAXRAW      (5 + 3 * LOGPACK_MAXCH)    /* Varint bytes of one record */
+#define LOGPACK_MAXLEN      130    /* Longest match, token 0xff */
+#define LOGPACK_MINLEN      3      /* Shortest match worth its 2 byte token */
+
+/* Zig-zag: small negative and positive deltas both become small varints */
+
+#define logpack_zz(n)       (((uint32_t)(n) << 1) ^ (uint32_t)((int32_t)(n) >> 31))
+#define logpack_unzz(v)     ((int32_t)(((v) >> 1) ^ (0 - ((v) & 1))))
+
+uint8_t logpack_putv(uint8_t *out, uint32_t v);
+uint8_t logpack_encode(struct logpack_s *pack, const struct logpack_rec_s *rec, uint8_t *raw);
+uint8_t logpack_byte(struct logpack_state_s *st, const uint8_t *raw, int i);
+uint8_t logpack_lz(struct logpack_state_s *st, const uint8_t *raw, uint8_t n, uint8_t *out);
+void logpack_push(struct logpack_state_s *st, const uint8_t *data, uint8_t n);
+void logpack_reset(struct logpack_s *pack);
+int logpack_flush(struct logpack_s *pack);
+int logpack_getc(struct logpack_cursor_s *cur);
+int logpack_getv(struct logpack_cursor_s *cur, uint32_t *v);
+int logpack_decode(struct logpack_cursor_s *cur, uint8_t nch, struct logpack_rec_s *rec);
+
+/************************************************************************************
+ * Name: logpack_putv
+ *
+ * Description:
+ *   Varint, 7 bits per byte LSB first, bit 7 set on all but the last byte.
+ *
+ ************************************************************************************/
+
+uint8_t logpack_putv(uint8_t *out, uint32_t v)
+{
+    uint8_t n = 0;
+
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+
+    out[n++] = (uint8_t)v;
+
+    return n;
+}
+
+/************************************************************************************
+ * Name: logpack_encode
+ *
+ * Description:
+ *   Varint bytes of rec: absolute values as the first record of a block,
+ *   otherwise the change of the timestamp step and the sample deltas.
+ *
+ ************************************************************************************/
+
+uint8_t logpack_encode(struct logpack_s *pack, const struct logpack_rec_s *rec, uint8_t *raw)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)pack->block;
+    struct logpack_state_s *st = &pack->enc;
+    uint32_t dt;
+    uint8_t n, c;
+
+    if (hdr->nrecs == 0)
+    {
+        n = logpack_putv(raw, rec->time);
+        for (c = 0; c < pack->nch; c++)
+        {
+            n += logpack_putv(raw + n, logpack_zz(rec->sample[c]));
+        }
+    }
+    else
+    {
+        dt = rec->time - st->prev.time;
+        n = logpack_putv(raw, logpack_zz(dt - (uint32_t)st->prevdt));
+        for (c = 0; c < pack->nch; c++)
+        {
+            n += logpack_putv(raw + n, logpack_zz((int32_t)rec->sample[c] - st->prev.sample[c]));
+        }
+    }
+
+    return n;
+}
+
+/************************************************************************************
+ * Name: logpack_byte
+ *
+ * Description:
+ *   Byte i of the record being packed, negative i going back into the
+ *   history of the block.
+ *
+ ************************************************************************************/
+
+uint8_t logpack_byte(struct logpack_state_s *st, const uint8_t *raw, int i)
+{
+    if (i < 0)
+    {
+        return st->hist[(st->hpos + i) & (LOGPACK_WINDOW - 1)];
+    }
+
+    return raw[i];
+}
+
+/************************************************************************************
+ * Name: logpack_lz
+ *
+ * Description:
+ *   Pack the n varint bytes of a record into tokens:
+ *     0LLLLLLL + L+1 bytes   literal run
+ *     1LLLLLLL DDDDDDDD      copy L+3 bytes from D+1 bytes back
+ *   Matches may overlap the bytes they produce (runs of zero deltas). The
+ *   search is exhaustive over the window, which is cheap at 64 bytes. The
+ *   history is left alone, the caller pushes the record once it is taken.
+ *
+ ************************************************************************************/
+
+uint8_t logpack_lz(struct logpack_state_s *st, const uint8_t *raw, uint8_t n, uint8_t *out)
+{
+    uint8_t p = 0, m = 0, lit = 0, nlit = 0;
+    uint8_t d, len, best, dist = 0;
+
+    while (p < n)
+    {
+        best = 0;
+        for (d = 1; d <= LOGPACK_WINDOW && d <= st->hlen + p; d++)
+        {
+            for (len = 0; p + len < n && len < LOGPACK_MAXLEN; len++)
+            {
+                if (logpack_byte(st, raw, p + len - d) != raw[p + len])
+                {
+                    break;
+                }
+            }
+
+            if (len > best)
+            {
+                best = len;
+                dist = d;
+            }
+        }
+
+        if (best >= LOGPACK_MINLEN)
+        {
+            out[m++] = 0x80 | (best - LOGPACK_MINLEN);
+            out[m++] = dist - 1;
+            p += best;
+            nlit = 0;
+        }
+        else
+        {
+            if (nlit == 0 || nlit == 128)
+            {
+                lit = m++;
+                nlit = 0;
+            }
+
+            out[lit] = nlit++;
+            out[m++] = raw[p++];
+        }
+    }
+
+    return m;
+}
+
+void logpack_push(struct logpack_state_s *st, const uint8_t *data, uint8_t n)
+{
+    while (n-- > 0)
+    {
+        st->hist[st->hpos] = *data++;
+        st->hpos = (st->hpos + 1) & (LOGPACK_WINDOW - 1);
+        if (st->hlen < LOGPACK_WINDOW)
+        {
+            st->hlen++;
+        }
+    }
+}
+
+/************************************************************************************
+ * Name: logpack_reset
+ *
+ * Description:
+ *   Start an empty block.
+ *
+ ************************************************************************************/
+
+void logpack_reset(struct logpack_s *pack)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)pack->block;
+
+    hdr->nrecs = 0;
+    hdr->flags = pack->flags;
+    hdr->nch   = pack->nch;
+    hdr->used  = LOGPACK_HDRSIZE;
+
+    memset(&pack->enc, 0, sizeof(pack->enc));
+}
+
+/************************************************************************************
+ * Name: logpack_flush
+ *
+ * Description:
+ *   Hand the block to the log, which commits it as one page.
+ *
+ ************************************************************************************/
+
+int logpack_flush(struct logpack_s *pack)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)pack->block;
+    int ret;
+
+    if (hdr->nrecs == 0)
+    {
+        return 0;
+    }
+
+    memset(&pack->block[hdr->used], 0xff, pack->blksize - hdr->used);
+    ret = logstore_append(&pack->log, pack->block);
+
+    logpack_reset(pack);
+
+    return ret;
+}
+
+/************************************************************************************
+ * Name: logpack_open
+ *
+ * Description:
+ *   Open the log in pages [start, start + npages) for records of nch samples.
+ *   flags (LOGPACK_LZ) only applies to new blocks, old ones keep theirs.
+ *
+ ************************************************************************************/
+
+int logpack_open(struct logpack_s *pack, long start, uint16_t npages, uint8_t nch, uint8_t flags)
+{
+    struct at45db_geometry_s geo;
+
+    if (nch == 0 || nch > LOGPACK_MAXCH ||
+        at45db_geometry(&geo) < 0 || geo.blocksize > LOGSTORE_PAGESIZE)
+    {
+        return -1;
+    }
+
+    /* One block per logstore page: the log header, the block and its record
+     * CRC, the page CRC
+     */
+
+    pack->nch      = nch;
+    pack->flags    = flags;
+    pack->blksize  = geo.blocksize - LOGSTORE_HDRSIZE - 2 * LOGSTORE_CRCSIZE;
+    pack->inbytes  = 0;
+    pack->outbytes = 0;
+
+    logpack_reset(pack);
+
+    return logstore_open(&pack->log, start, npages, pack->blksize);
+}
+
+/************************************************************************************
+ * Name: logpack_append
+ *
+ * Description:
+ *   Add a record to the block, committing the block first if the record no
+ *   longer fits. Returns 1 if a page was committed, 0 if not.
+ *
+ ************************************************************************************/
+
+int logpack_append(struct logpack_s *pack, const struct logpack_rec_s *rec)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)pack->block;
+    struct logpack_state_s *st = &pack->enc;
+    uint8_t raw[LOGPACK_MAXRAW];
+    uint8_t lz[LOGPACK_MAXRAW + 2];
+    uint8_t *out;
+    uint8_t n, m, pass;
+    int ret = 0;
+
+    /* The second pass starts a new block, where the record always fits */
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        n = logpack_encode(pack, rec, raw);
+        out = raw;
+        m = n;
+
+        if (pack->flags & LOGPACK_LZ)
+        {
+            m = logpack_lz(st, raw, n, lz);
+            out = lz;
+        }
+
+        if (hdr->used + m <= pack->blksize)
+        {
+            break;
+        }
+
+        if ((ret = logpack_flush(pack)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    memcpy(&pack->block[hdr->used], out, m);
+    hdr->used += m;
+
+    st->prevdt = hdr->nrecs++ ? (int32_t)(rec->time - st->prev.time) : 0;
+    st->prev   = *rec;
+    logpack_push(st, raw, n);
+
+    pack->inbytes  += sizeof(rec->time) + pack->nch * sizeof(rec->sample[0]);
+    pack->outbytes += m;
+
+    return ret;
+}
+
+/************************************************************************************
+ * Name: logpack_sync
+ *
+ * Description:
+ *   Commit the records still in RAM as a short block.
+ *
+ ************************************************************************************/
+
+int logpack_sync(struct logpack_s *pack)
+{
+    return logpack_flush(pack);
+}
+
+/************************************************************************************
+ * Name: logpack_rewind
+ *
+ * Description:
+ *   Point a cursor at the oldest record.
+ *
+ ************************************************************************************/
+
+void logpack_rewind(struct logpack_s *pack, struct logpack_cursor_s *cur)
+{
+    logstore_rewind(&pack->log, &cur->log);
+    cur->rec   = 0;
+    cur->nrecs = 0;
+}
+
+/************************************************************************************
+ * Name: logpack_seek
+ *
+ * Description:
+ *   Point a cursor at the first record of a block, counted from the oldest.
+ *   Blocks decode on their own, so nothing before it is read.
+ *
+ ************************************************************************************/
+
+int logpack_seek(struct logpack_s *pack, struct logpack_cursor_s *cur, uint16_t block)
+{
+    if (block >= pack->log.used)
+    {
+        return -1;
+    }
+
+    logpack_rewind(pack, cur);
+    cur->log.page = (uint16_t)((pack->log.tail + (uint32_t)block) % pack->log.npages);
+    cur->log.left -= block;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: logpack_getc
+ *
+ * Description:
+ *   Next varint byte of the block at the cursor, undoing the LZ pass. -1 past
+ *   the end of the block or on a bad token.
+ *
+ ************************************************************************************/
+
+int logpack_getc(struct logpack_cursor_s *cur)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)cur->block;
+    struct logpack_state_s *st = &cur->dec;
+    uint8_t tok, b;
+
+    if (!(hdr->flags & LOGPACK_LZ))
+    {
+        return cur->pos < hdr->used ? cur->block[cur->pos++] : -1;
+    }
+
+    if (cur->mlen == 0 && cur->lit == 0)
+    {
+        if (cur->pos >= hdr->used)
+        {
+            return -1;
+        }
+
+        tok = cur->block[cur->pos++];
+        if (tok & 0x80)
+        {
+            if (cur->pos >= hdr->used)
+            {
+                return -1;
+            }
+
+            cur->mlen  = (tok & 0x7f) + LOGPACK_MINLEN;
+            cur->mdist = cur->block[cur->pos++] + 1;
+            if (cur->mdist > st->hlen)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            cur->lit = tok + 1;
+        }
+    }
+
+    if (cur->mlen)
+    {
+        b = st->hist[(st->hpos - cur->mdist) & (LOGPACK_WINDOW - 1)];
+        cur->mlen--;
+    }
+    else
+    {
+        if (cur->pos >= hdr->used)
+        {
+            return -1;
+        }
+
+        b = cur->block[cur->pos++];
+        cur->lit--;
+    }
+
+    logpack_push(st, &b, 1);
+
+    return b;
+}
+
+int logpack_getv(struct logpack_cursor_s *cur, uint32_t *v)
+{
+    uint8_t shift;
+    int c;
+
+    *v = 0;
+    for (shift = 0; shift < 35; shift += 7)
+    {
+        if ((c = logpack_getc(cur)) < 0)
+        {
+            return -1;
+        }
+
+        *v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+/************************************************************************************
+ * Name: logpack_decode
+ *
+ * Description:
+ *   Undo logpack_encode for the next record of the block.
+ *
+ ************************************************************************************/
+
+int logpack_decode(struct logpack_cursor_s *cur, uint8_t nch, struct logpack_rec_s *rec)
+{
+    struct logpack_state_s *st = &cur->dec;
+    uint32_t v;
+    int32_t dt = 0;
+    uint8_t c;
+
+    if (logpack_getv(cur, &v) < 0)
+    {
+        return -1;
+    }
+
+    if (cur->rec == 0)
+    {
+        rec->time = v;
+    }
+    else
+    {
+        dt = (int32_t)((uint32_t)st->prevdt + (uint32_t)logpack_unzz(v));
+        rec->time = st->prev.time + dt;
+    }
+
+    memset(rec->sample, 0, sizeof(rec->sample));
+    for (c = 0; c < nch; c++)
+    {
+        if (logpack_getv(cur, &v) < 0)
+        {
+            return -1;
+        }
+
+        rec->sample[c] = (int16_t)(logpack_unzz(v) + (cur->rec ? st->prev.sample[c] : 0));
+    }
+
+    st->prevdt = dt;
+    st->prev   = *rec;
+    cur->rec++;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: logpack_read
+ *
+ * Description:
+ *   Read the next record at the cursor. Blocks are read whole through
+ *   logstore_read (and checked by its CRC); the rest of a block that does not
+ *   decode is skipped.
+ *
+ *   Returns 1 with a record in rec, 0 at the end of the log.
+ *
+ ************************************************************************************/
+
+int logpack_read(struct logpack_s *pack, struct logpack_cursor_s *cur, struct logpack_rec_s *rec)
+{
+    struct logpack_hdr_s *hdr = (struct logpack_hdr_s *)cur->block;
+
+    for (;;)
+    {
+        while (cur->rec >= cur->nrecs)
+        {
+            if (logstore_read(&pack->log, &cur->log, cur->block) == 0)
+            {
+                return 0;
+            }
+
+            cur->rec   = 0;
+            cur->nrecs = 0;
+            if (hdr->nch == pack->nch && hdr->used >= LOGPACK_HDRSIZE && hdr->used <= pack->blksize)
+            {
+                cur->nrecs = hdr->nrecs;
+                cur->pos   = LOGPACK_HDRSIZE;
+                cur->lit   = 0;
+                cur->mlen  = 0;
+                memset(&cur->dec, 0, sizeof(cur->dec));
+            }
+        }
+
+        if (logpack_decode(cur, pack->nch, rec) > 0)
+        {
+            return 1;
+        }
+
+        myprintf("pack: bad block\r\n");
+        cur->nrecs = 0;
+    }
+}
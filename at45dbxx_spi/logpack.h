@@ -0,0 +1,91 @@
+#ifndef __LOGPACK_H__
+#define __LOGPACK_H__
+
+#include <stdint.h>
+
+#include "logstore.h"
+
+/* Compressed sensor record log on top of logstore
+ *
+ * Records (a timestamp and up to LOGPACK_MAXCH samples) are encoded into a
+ * block that fills one logstore page, so every page decodes on its own:
+ *
+ *   - the first record of a block is stored as is, as varints
+ *   - later records store the change of the timestamp step (0 for a steady
+ *     sample rate) and the change of each sample, as zig-zag varints
+ *   - with LOGPACK_LZ, the varint bytes of each record are further packed
+ *     against the last LOGPACK_WINDOW bytes of the block (literal runs and
+ *     back references, a token never spans two records)
+ *
+ * RAM is one block and the window for the writer, the same again for each
+ * read cursor.
+ *
+ * Block layout:
+ *   struct logpack_hdr_s | encoded records | 0xff ...
+ */
+
+#define LOGPACK_MAXCH       8
+#define LOGPACK_HDRSIZE     4
+#define LOGPACK_BLKSIZE     (LOGSTORE_PAGESIZE - LOGSTORE_HDRSIZE - 2 * LOGSTORE_CRCSIZE)
+#define LOGPACK_WINDOW      64     /* LZ history, a power of two */
+
+#define LOGPACK_LZ          0x01   /* Flag: LZ pass over the varints */
+
+struct logpack_rec_s
+{
+    uint32_t time;                 /* RTC or tick timestamp */
+    int16_t  sample[LOGPACK_MAXCH];
+};
+
+struct logpack_hdr_s
+{
+    uint8_t  nrecs;                /* Records in the block */
+    uint8_t  flags;                /* LOGPACK_LZ */
+    uint8_t  nch;                  /* Samples per record */
+    uint8_t  used;                 /* Bytes of header and records */
+};
+
+/* Encoder or decoder state of one block */
+
+struct logpack_state_s
+{
+    struct logpack_rec_s prev;     /* Last record */
+    int32_t  prevdt;               /* Last timestamp step */
+    uint8_t  hpos;                 /* Next history slot */
+    uint8_t  hlen;                 /* History bytes so far, up to LOGPACK_WINDOW */
+    uint8_t  hist[LOGPACK_WINDOW];
+};
+
+struct logpack_s
+{
+    struct logstore_s log;
+    uint8_t  nch;
+    uint8_t  flags;
+    uint8_t  blksize;              /* Block bytes, one logstore record */
+    uint32_t inbytes;              /* Raw record bytes appended */
+    uint32_t outbytes;             /* Block bytes they took */
+    struct logpack_state_s enc;
+    uint8_t  block[LOGPACK_BLKSIZE];
+};
+
+struct logpack_cursor_s
+{
+    struct logstore_cursor_s log;
+    uint8_t  rec;                  /* Next record in the block */
+    uint8_t  nrecs;                /* Records in the block, 0 before it is read */
+    uint8_t  pos;                  /* Next block byte */
+    uint8_t  lit;                  /* Literal bytes left in the token */
+    uint8_t  mlen;                 /* Match bytes left in the token */
+    uint8_t  mdist;                /* Match distance */
+    struct logpack_state_s dec;
+    uint8_t  block[LOGPACK_BLKSIZE];
+};
+
+int logpack_open(struct logpack_s *pack, long start, uint16_t npages, uint8_t nch, uint8_t flags);
+int logpack_append(struct logpack_s *pack, const struct logpack_rec_s *rec);
+int logpack_sync(struct logpack_s *pack);
+void logpack_rewind(struct logpack_s *pack, struct logpack_cursor_s *cur);
+int logpack_seek(struct logpack_s *pack, struct logpack_cursor_s *cur, uint16_t block);
+int logpack_read(struct logpack_s *pack, struct logpack_cursor_s *cur, struct logpack_rec_s *rec);
+
+#endif /* __LOGPACK_H__ */
@@ -0,0 +1,355 @@
+
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
+#include <msp430.h>
+#endif
+#include <string.h>
+
+#include "at45dbxx.h"
+#include "logstore.h"
+#include "myprintf.h"
+
+#define LOGSTORE_MAGIC      0x4c47 /* "LG" */
+
+int logstore_probe(struct logstore_s *log, uint16_t page, uint32_t *seq);
+int logstore_commit(struct logstore_s *log);
+
+/************************************************************************************
+ * Name: logstore_crc
+ *
+ * Description:
+ *   CRC32 (ISO 3309) of a byte string on the CRC32 module, the register
+ *   equivalent of driverlib CRC32_setSeed/CRC32_set8BitData/CRC32_getResult.
+ *
+ ************************************************************************************/
+
+uint32_t logstore_crc(const uint8_t *data, uint16_t len)
+{
+#ifdef CONFIG_AT45DB_SIM
+    uint32_t crc = 0xffffffffUL;
+    uint8_t i;
+
+    /* Bitwise, LSB first like the module */
+
+    while (len-- > 0)
+    {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320UL & -(crc & 1));
+        }
+    }
+
+    return crc;
+#else
+    CRC32INIRESW1 = 0xffff;    /* Seed, high word first */
+    CRC32INIRESW0 = 0xffff;
+
+    while (len-- > 0)
+    {
+        CRC32DIW0_L = *data++;
+    }
+
+    return ((uint32_t)CRC32INIRESW1 << 16) | CRC32INIRESW0;
+#endif
+}
+
+/************************************************************************************
+ * Name: logstore_probe
+ *
+ * Description:
+ *   Read a whole page into log->page and check its page CRC. Returns 1 and the
+ *   page sequence if it holds a committed log page, 0 otherwise (erased, torn
+ *   or foreign).
+ *
+ ************************************************************************************/
+
+int logstore_probe(struct logstore_s *log, uint16_t page, uint32_t *seq)
+{
+    struct logstore_hdr_s *hdr = (struct logstore_hdr_s *)log->page;
+    uint16_t end = log->pagesize - LOGSTORE_CRCSIZE;
+    uint32_t crc;
+
+    at45db_bread(log->start + page, 1, log->page);
+
+    memcpy(&crc, &log->page[end], LOGSTORE_CRCSIZE);
+    if (hdr->magic != LOGSTORE_MAGIC || hdr->recsize != log->recsize ||
+        logstore_crc(log->page, end) != crc)
+    {
+        return 0;
+    }
+
+    *seq = hdr->seq;
+    return 1;
+}
+
+/************************************************************************************
+ * Name: logstore_open
+ *
+ * Description:
+ *   Find the newest committed page with a binary search. Pages are committed
+ *   in order around the region, so the sequence numbers form one increasing run
+ *   (the newest pages) followed by another (the oldest ones). The newest page
+ *   is the last one whose sequence is not below that of page 0, which takes
+ *   log2(npages) page reads instead of a scan.
+ *
+ ************************************************************************************/
+
+int logstore_open(struct logstore_s *log, long start, uint16_t npages, uint8_t recsize)
+{
+    struct at45db_geometry_s geo;
+    uint32_t first, newest, seq;
+    uint16_t lo, hi, mid, next;
+
+    if (at45db_geometry(&geo) < 0 || geo.blocksize > LOGSTORE_PAGESIZE || npages < 2)
+    {
+        return -1;
+    }
+
+    log->start    = start;
+    log->npages   = npages;
+    log->pagesize = geo.blocksize;
+    log->recsize  = recsize;
+    log->perpage  = (geo.blocksize - LOGSTORE_HDRSIZE - LOGSTORE_CRCSIZE) /
+                    (recsize + LOGSTORE_CRCSIZE);
+    log->head     = 0;
+    log->tail     = 0;
+    log->used     = 0;
+    log->seq      = 0;
+    log->nrecs    = 0;
+
+    if (log->perpage == 0)
+    {
+        return -1;
+    }
+
+    if (logstore_probe(log, 0, &first))
+    {
+        /* Invariant: page lo belongs to the newest run, page hi does not */
+
+        lo = 0;
+        hi = npages;
+        while (hi - lo > 1)
+        {
+            mid = lo + (hi - lo) / 2;
+            if (logstore_probe(log, mid, &seq) && seq >= first)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+    }
+    else if (logstore_probe(log, npages - 1, &seq))
+    {
+        /* The log wrapped and page 0 was torn by a power loss */
+
+        lo = npages - 1;
+    }
+    else
+    {
+        return 1;              /* Empty log */
+    }
+
+    logstore_probe(log, lo, &newest);
+    log->head = (lo + 1 == npages) ? 0 : lo + 1;
+    log->seq  = newest + 1;
+
+    /* Commits take consecutive sequence numbers, so the oldest page is the
+     * first valid one after the head (the page right after it if the head
+     * page itself was torn) and the page count follows from its sequence.
+     */
+
+    if (logstore_probe(log, log->head, &seq))
+    {
+        log->tail = log->head;
+    }
+    else
+    {
+        next = (log->head + 1 == npages) ? 0 : log->head + 1;
+        if (logstore_probe(log, next, &seq) && seq < newest)
+        {
+            log->tail = next;
+        }
+        else
+        {
+            logstore_probe(log, 0, &seq);
+            log->tail = 0;
+        }
+    }
+
+    log->used = newest - seq + 1;
+
+    myprintf("log: %d pages used, head %d, %d records/page\r\n", (unsigned long)log->used,
+             (unsigned long)log->head, (unsigned long)log->perpage);
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: logstore_commit
+ *
+ * Description:
+ *   Seal the RAM page with its header and page CRC and program it into the
+ *   head page through the SRAM buffer (built-in erase). The head page is the
+ *   oldest one once the log is full, so the tail moves on with it.
+ *
+ ************************************************************************************/
+
+int logstore_commit(struct logstore_s *log)
+{
+    struct logstore_hdr_s *hdr = (struct logstore_hdr_s *)log->page;
+    uint16_t end = log->pagesize - LOGSTORE_CRCSIZE;
+    uint16_t used = LOGSTORE_HDRSIZE + log->nrecs * (log->recsize + LOGSTORE_CRCSIZE);
+    uint32_t crc;
+
+    if (log->nrecs == 0)
+    {
+        return 0;
+    }
+
+    hdr->seq     = log->seq;
+    hdr->nrecs   = log->nrecs;
+    hdr->recsize = log->recsize;
+    hdr->magic   = LOGSTORE_MAGIC;
+
+    memset(&log->page[used], 0xff, end - used);
+    crc = logstore_crc(log->page, end);
+    memcpy(&log->page[end], &crc, LOGSTORE_CRCSIZE);
+
+    if (log->used == log->npages)
+    {
+        log->tail = (log->tail + 1 == log->npages) ? 0 : log->tail + 1;
+    }
+    else
+    {
+        log->used++;
+    }
+
+    at45db_bwrite(log->start + log->head, 1, log->page);
+
+    log->head  = (log->head + 1 == log->npages) ? 0 : log->head + 1;
+    log->seq++;
+    log->nrecs = 0;
+
+    return 1;
+}
+
+/************************************************************************************
+ * Name: logstore_append
+ *
+ * Description:
+ *   Add one record (log->recsize bytes) with its own CRC to the RAM page and
+ *   commit the page as soon as it is full.
+ *
+ ************************************************************************************/
+
+int logstore_append(struct logstore_s *log, const uint8_t *rec)
+{
+    uint8_t *slot = &log->page[LOGSTORE_HDRSIZE + log->nrecs * (log->recsize + LOGSTORE_CRCSIZE)];
+    uint32_t crc;
+
+    memcpy(slot, rec, log->recsize);
+    crc = logstore_crc(rec, log->recsize);
+    memcpy(slot + log->recsize, &crc, LOGSTORE_CRCSIZE);
+
+    if (++log->nrecs == log->perpage)
+    {
+        return logstore_commit(log);
+    }
+
+    return 0;
+}
+
+/************************************************************************************
+ * Name: logstore_sync
+ *
+ * Description:
+ *   Commit the records still in RAM as a short page. The next records start a
+ *   new page rather than rewriting this one, so a committed page is never put
+ *   at risk again by a later power loss.
+ *
+ ************************************************************************************/
+
+int logstore_sync(struct logstore_s *log)
+{
+    return logstore_commit(log);
+}
+
+/************************************************************************************
+ * Name: logstore_rewind
+ *
+ * Description:
+ *   Point a cursor at the oldest committed record.
+ *
+ ************************************************************************************/
+
+void logstore_rewind(struct logstore_s *log, struct logstore_cursor_s *cur)
+{
+    cur->page  = log->tail;
+    cur->left  = log->used;
+    cur->rec   = 0;
+    cur->nrecs = 0;
+}
+
+/************************************************************************************
+ * Name: logstore_read
+ *
+ * Description:
+ *   Read the next record at the cursor straight from the array, one record and
+ *   its CRC at a time, so the whole log can be streamed out without a page
+ *   buffer. Records that fail their CRC are skipped.
+ *
+ *   Returns 1 with a record in rec, 0 at the end of the log.
+ *
+ ************************************************************************************/
+
+int logstore_read(struct logstore_s *log, struct logstore_cursor_s *cur, uint8_t *rec)
+{
+    struct logstore_hdr_s hdr;
+    uint8_t crcbuf[LOGSTORE_CRCSIZE];
+    uint32_t crc;
+    long addr;
+
+    while (cur->left > 0)
+    {
+        addr = (log->start + cur->page) * log->pagesize;
+
+        if (cur->nrecs == 0)
+        {
+            at45db_read(addr, sizeof(hdr), (uint8_t *)&hdr);
+            if (hdr.magic == LOGSTORE_MAGIC && hdr.recsize == log->recsize &&
+                hdr.nrecs <= log->perpage)
+            {
+                cur->nrecs = hdr.nrecs;
+            }
+        }
+
+        while (cur->rec < cur->nrecs)
+        {
+            addr += LOGSTORE_HDRSIZE + cur->rec * (log->recsize + LOGSTORE_CRCSIZE);
+            cur->rec++;
+
+            at45db_read(addr, log->recsize, rec);
+            at45db_read(addr + log->recsize, LOGSTORE_CRCSIZE, crcbuf);
+            memcpy(&crc, crcbuf, LOGSTORE_CRCSIZE);
+
+            if (logstore_crc(rec, log->recsize) == crc)
+            {
+                return 1;
+            }
+
+            addr = (log->start + cur->page) * log->pagesize;
+        }
+
+        cur->page  = (cur->page + 1 == log->npages) ? 0 : cur->page + 1;
+        cur->left--;
+        cur->rec   = 0;
+        cur->nrecs = 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef __LOGSTORE_H__
+#define __LOGSTORE_H__
+
+#include <stdint.h>
+
+#include "at45dbxx.h"
+
+/* Append-only record log on a range of AT45DB pages
+ *
+ * Fixed size records are batched in a RAM page and committed a page at a
+ * time through the DataFlash SRAM buffer. Committed pages are never touched
+ * again until the log wraps around, so a power loss can only cost the
+ * records that were still in RAM.
+ *
+ * Page layout:
+ *   struct logstore_hdr_s | nrecs * (record, CRC32) | ... | page CRC32
+ */
+
+#define LOGSTORE_PAGESIZE   264    /* Largest page the RAM buffer holds */
+#define LOGSTORE_HDRSIZE    8
+#define LOGSTORE_CRCSIZE    4
+
+struct logstore_hdr_s
+{
+    uint32_t seq;              /* Commit sequence, strictly increasing */
+    uint8_t  nrecs;            /* Records in this page */
+    uint8_t  recsize;          /* Record size without its CRC */
+    uint16_t magic;            /* LOGSTORE_MAGIC */
+};
+
+struct logstore_s
+{
+    long     start;            /* First page of the log region */
+    uint16_t npages;           /* Pages in the log region */
+    uint16_t pagesize;
+    uint8_t  recsize;          /* Record size without its CRC */
+    uint8_t  perpage;          /* Records that fit one page */
+    uint16_t head;             /* Next page to commit, relative to start */
+    uint16_t tail;             /* Oldest committed page, relative to start */
+    uint16_t used;             /* Committed pages */
+    uint32_t seq;              /* Sequence of the next commit */
+    uint8_t  nrecs;            /* Records waiting in page[] */
+    uint8_t  page[LOGSTORE_PAGESIZE];
+};
+
+struct logstore_cursor_s
+{
+    uint16_t page;             /* Page being read, relative to start */
+    uint16_t left;             /* Pages left including this one */
+    uint8_t  rec;              /* Next record in the page */
+    uint8_t  nrecs;            /* Records in the page, 0 before its header is read */
+};
+
+uint32_t logstore_crc(const uint8_t *data, uint16_t len);
+int logstore_open(struct logstore_s *log, long start, uint16_t npages, uint8_t recsize);
+int logstore_append(struct logstore_s *log, const uint8_t *rec);
+int logstore_sync(struct logstore_s *log);
+void logstore_rewind(struct logstore_s *log, struct logstore_cursor_s *cur);
+int logstore_read(struct logstore_s *log, struct logstore_cursor_s *cur, uint8_t *rec);
+
+#endif /* __LOGSTORE_H__ */
@@ -34,6 +34,7 @@
 
 #include "spi_gpio.h"
 #include "spi_interface.h"
+#include "bustrace.h"
 #include "myprintf.h"
 
 #include "at45dbxx.h"
@@ -85,6 +86,21 @@ void initClockTo16MHz()
     CSCTL0_H = 0;                             // Lock CS registers
 }
 
+void initLFXT()
+{
+    // ACLK = LFXT 32768Hz is the AT45DB busy-time base (TA0)
+    PJSEL0 |= BIT4 | BIT5;                    // LFXT pins
+
+    CSCTL0_H = CSKEY_H;                       // Unlock CS registers
+    CSCTL4 &= ~LFXTOFF;
+    do
+    {
+        CSCTL5 &= ~LFXTOFFG;                  // Clear LFXT fault flag
+        SFRIFG1 &= ~OFIFG;
+    } while (SFRIFG1 & OFIFG);                // Test oscillator fault flag
+    CSCTL0_H = 0;                             // Lock CS registers
+}
+
 int main(void)
 {
     unsigned int i;
@@ -92,12 +108,18 @@ int main(void)
 
     initClockTo16MHz();
     initGPIO();
+    initLFXT();
     initSPI();
+    bustrace_init();
 
     uart_init();
 
     myprintf("\r\n\r\nat45dbxx program start\r\n");
 
+#ifdef SPI_INTERFACE_BENCH
+    spiBenchmark();
+#endif
+
     SPI_RST_OUT &= ~SPI_RST_PIN;        // Now with SPI signals initialized,
     __delay_cycles(16000); // 1ms
     SPI_RST_OUT |= SPI_RST_PIN;         // reset slave
@@ -110,6 +132,7 @@ int main(void)
 
     at45db_initialize();
     at45db_test();
+    bustrace_report();
 
     __bis_SR_register(LPM0_bits + GIE);
     __no_operation();
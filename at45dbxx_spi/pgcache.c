@@ -0,0 +1,341 @@
+
+#ifdef CONFIG_AT45DB_SIM
+#include "at45sim.h"
+#else
+#include <msp430.h>
+#endif
+#include <string.h>
+
+#include "at45dbxx.h"
+#include "pgcache.h"
+#include "myprintf.h"
+
+#ifdef CONFIG_AT45DB_CACHE
+
+#define PGCACHE_MAGIC       0x5043 /* "PC" */
+#define PGCACHE_INVALID     0xffff
+
+struct pgcache_s
+{
+    uint16_t magic;
+    uint32_t devsize;          /* Device the lines were read from */
+    uint16_t tag[PGCACHE_SETS][PGCACHE_WAYS];  /* Line number or PGCACHE_INVALID */
+    uint8_t  age[PGCACHE_SETS][PGCACHE_WAYS];  /* LRU rank, 0 = most recently used */
+    uint8_t  line[PGCACHE_SETS][PGCACHE_WAYS][PGCACHE_LINESIZE];
+};
+
+/* The .pgcache section is placed in FRAM2 by lnk_msp430fr6989.cmd (NOINIT, so
+ * the startup code leaves it alone).
+ */
+
+#if defined(__TI_COMPILER_VERSION__)
+#pragma DATA_SECTION(g_pgcache, ".pgcache")
+#define PGCACHE_FRAM2
+#elif defined(__GNUC__)
+#define PGCACHE_FRAM2 __attribute__ ((section(".pgcache")))
+#else
+#error Compiler not supported!
+#endif
+
+PGCACHE_FRAM2 struct pgcache_s g_pgcache;
+
+struct at45db_dev_s *g_pgdev;          /* Device being cached */
+struct pgcache_stats_s g_pgstats;
+uint16_t g_pgseq = PGCACHE_INVALID;    /* Last line of the current sequential run */
+uint16_t g_pgmpu;                      /* MPUSAM saved by pgcache_unlock */
+
+uint8_t pgcache_unlock(void);
+void pgcache_lock(void);
+void pgcache_touch(uint16_t set, uint16_t way);
+uint8_t *pgcache_lookup(uint16_t line);
+uint8_t *pgcache_fill(uint16_t line);
+
+/************************************************************************************
+ * Name: pgcache_unlock
+ *
+ * Description:
+ *   FRAM2 lies in MPU segment 3 (read/execute) as set up by libmpu_init, so
+ *   write access is only granted while the cache is being updated. Returns 0
+ *   if the MPU registers are locked, in which case the cache is not used.
+ *
+ ************************************************************************************/
+
+uint8_t pgcache_unlock(void)
+{
+    if (MPUCTL0 & MPULOCK)
+    {
+        return 0;
+    }
+
+    MPUCTL0 = MPUPW | (MPUCTL0 & (MPUENA | MPUSEGIE));
+    g_pgmpu = MPUSAM;
+    MPUSAM |= MPUSEG3WE;
+
+    return 1;
+}
+
+void pgcache_lock(void)
+{
+    MPUSAM = g_pgmpu;
+    MPUCTL0_H = 0x00;          /* Disable access to MPU registers */
+}
+
+/************************************************************************************
+ * Name: pgcache_touch
+ *
+ * Description:
+ *   Make a way the most recently used one of its set.
+ *
+ ************************************************************************************/
+
+void pgcache_touch(uint16_t set, uint16_t way)
+{
+    uint8_t *age = g_pgcache.age[set];
+    uint16_t w;
+
+    for (w = 0; w < PGCACHE_WAYS; w++)
+    {
+        if (age[w] < age[way])
+        {
+            age[w]++;
+        }
+    }
+
+    age[way] = 0;
+}
+
+uint8_t *pgcache_lookup(uint16_t line)
+{
+    uint16_t set = line & (PGCACHE_SETS - 1);
+    uint16_t w;
+
+    for (w = 0; w < PGCACHE_WAYS; w++)
+    {
+        if (g_pgcache.tag[set][w] == line)
+        {
+            pgcache_touch(set, w);
+            return g_pgcache.line[set][w];
+        }
+    }
+
+    return 0;
+}
+
+/************************************************************************************
+ * Name: pgcache_fill
+ *
+ * Description:
+ *   Read a line from the array into the least recently used way of its set.
+ *   The tag is only written once the data is in, so a reset during the read
+ *   leaves an invalid line behind rather than a wrong one. A read that timed
+ *   out leaves the way invalid too and returns NULL.
+ *
+ ************************************************************************************/
+
+uint8_t *pgcache_fill(uint16_t line)
+{
+    uint16_t set = line & (PGCACHE_SETS - 1);
+    uint16_t way = 0;
+    uint16_t w;
+
+    for (w = 0; w < PGCACHE_WAYS; w++)
+    {
+        if (g_pgcache.tag[set][w] == PGCACHE_INVALID)
+        {
+            way = w;
+            break;
+        }
+
+        if (g_pgcache.age[set][w] > g_pgcache.age[set][way])
+        {
+            way = w;
+        }
+    }
+
+    g_pgcache.tag[set][way] = PGCACHE_INVALID;
+    if (at45db_dev_rdarray(g_pgdev, (long)line << PGCACHE_LINESHIFT, PGCACHE_LINESIZE,
+                           g_pgcache.line[set][way]) < 0)
+    {
+        return 0;
+    }
+
+    g_pgcache.tag[set][way] = line;
+
+    pgcache_touch(set, way);
+
+    return g_pgcache.line[set][way];
+}
+
+/************************************************************************************
+ * Name: pgcache_init
+ *
+ * Description:
+ *   Keep the lines left in FRAM2 by the last run if they came from a device of
+ *   the same size, otherwise start empty.
+ *
+ ************************************************************************************/
+
+void pgcache_init(struct at45db_dev_s *dev)
+{
+    uint32_t devsize = dev->npages * dev->pagesize;
+
+    g_pgdev = dev;
+    dev->cached = 1;
+
+    if (g_pgcache.magic != PGCACHE_MAGIC || g_pgcache.devsize != devsize)
+    {
+        pgcache_flush();
+
+        if (pgcache_unlock())
+        {
+            g_pgcache.devsize = devsize;
+            g_pgcache.magic = PGCACHE_MAGIC;
+            pgcache_lock();
+        }
+    }
+
+    memset(&g_pgstats, 0, sizeof(g_pgstats));
+    g_pgseq = PGCACHE_INVALID;
+}
+
+/************************************************************************************
+ * Name: pgcache_read
+ *
+ * Description:
+ *   at45db_read through the cache. Two lines in a row make a sequential run,
+ *   which keeps the next line read ahead so the following call hits. Returns
+ *   nbytes, or -1 if a line could not be read from the array.
+ *
+ ************************************************************************************/
+
+int pgcache_read(long offset, unsigned int nbytes, uint8_t *buffer)
+{
+    unsigned int left = nbytes;
+    unsigned int pos, n;
+    uint16_t line;
+    uint8_t *data;
+
+    if (nbytes >= PGCACHE_BYPASS || !pgcache_unlock())
+    {
+        g_pgstats.bypass++;
+        return at45db_dev_rdarray(g_pgdev, offset, nbytes, buffer);
+    }
+
+    while (left > 0)
+    {
+        line = offset >> PGCACHE_LINESHIFT;
+        pos  = offset & (PGCACHE_LINESIZE - 1);
+        n    = PGCACHE_LINESIZE - pos;
+        if (n > left)
+        {
+            n = left;
+        }
+
+        data = pgcache_lookup(line);
+        if (data)
+        {
+            g_pgstats.hits++;
+        }
+        else
+        {
+            g_pgstats.misses++;
+            data = pgcache_fill(line);
+            if (!data)
+            {
+                pgcache_lock();
+                return -1;
+            }
+        }
+
+        memcpy(buffer, data + pos, n);
+
+        if (line == (uint16_t)(g_pgseq + 1) && !pgcache_lookup(line + 1))
+        {
+            g_pgstats.readahead++;
+            pgcache_fill(line + 1);
+        }
+
+        g_pgseq = line;
+
+        buffer += n;
+        offset += n;
+        left   -= n;
+    }
+
+    pgcache_lock();
+
+    return nbytes;
+}
+
+/************************************************************************************
+ * Name: pgcache_invalidate
+ *
+ * Description:
+ *   Drop every line overlapping [offset, offset + nbytes). Called before a
+ *   program or erase command is issued.
+ *
+ ************************************************************************************/
+
+void pgcache_invalidate(long offset, uint32_t nbytes)
+{
+    uint16_t first = offset >> PGCACHE_LINESHIFT;
+    uint16_t last  = (offset + nbytes - 1) >> PGCACHE_LINESHIFT;
+    uint16_t set, w, tag;
+
+    if (!pgcache_unlock())
+    {
+        return;
+    }
+
+    for (set = 0; set < PGCACHE_SETS; set++)
+    {
+        for (w = 0; w < PGCACHE_WAYS; w++)
+        {
+            tag = g_pgcache.tag[set][w];
+            if (tag != PGCACHE_INVALID && tag >= first && tag <= last)
+            {
+                g_pgcache.tag[set][w] = PGCACHE_INVALID;
+                g_pgstats.invalidates++;
+            }
+        }
+    }
+
+    pgcache_lock();
+}
+
+void pgcache_flush(void)
+{
+    uint16_t set, w;
+
+    if (!pgcache_unlock())
+    {
+        return;
+    }
+
+    for (set = 0; set < PGCACHE_SETS; set++)
+    {
+        for (w = 0; w < PGCACHE_WAYS; w++)
+        {
+            g_pgcache.tag[set][w] = PGCACHE_INVALID;
+            g_pgcache.age[set][w] = w;
+        }
+    }
+
+    pgcache_lock();
+}
+
+/************************************************************************************
+ * Name: pgcache_stats
+ ************************************************************************************/
+
+void pgcache_stats(struct pgcache_stats_s *stats, uint8_t reset)
+{
+    memcpy(stats, &g_pgstats, sizeof(g_pgstats));
+
+    if (reset)
+    {
+        memset(&g_pgstats, 0, sizeof(g_pgstats));
+    }
+}
+
+#endif /* CONFIG_AT45DB_CACHE */
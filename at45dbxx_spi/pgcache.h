@@ -0,0 +1,49 @@
+#ifndef __PGCACHE_H__
+#define __PGCACHE_H__
+
+#include <stdint.h>
+
+#include "at45dbxx.h"
+
+/* FRAM2 and the MPU only exist on the target */
+
+#ifndef CONFIG_AT45DB_SIM
+#define CONFIG_AT45DB_CACHE
+#endif
+
+/* Set associative read cache of the AT45DB array in FRAM2
+ *
+ * The array is cached in PGCACHE_LINESIZE lines, independent of the device
+ * page size. Lines and tags live in FRAM2 (.pgcache), so the cache is still
+ * warm after a reset; every program and erase invalidates the lines it
+ * touches before the command goes out.
+ */
+
+#define PGCACHE_LINESHIFT   8
+#define PGCACHE_LINESIZE    (1 << PGCACHE_LINESHIFT)
+#define PGCACHE_SETS        16     /* Power of 2 */
+#define PGCACHE_WAYS        4
+#define PGCACHE_BYPASS      (2 * PGCACHE_LINESIZE) /* Bigger reads go straight to the array */
+
+struct pgcache_stats_s
+{
+    uint32_t hits;             /* Lines served from FRAM */
+    uint32_t misses;           /* Lines read from the array on demand */
+    uint32_t readahead;        /* Lines read ahead of a sequential stream */
+    uint32_t bypass;           /* Reads not cached */
+    uint32_t invalidates;      /* Lines dropped by program and erase */
+};
+
+#ifdef CONFIG_AT45DB_CACHE
+void pgcache_init(struct at45db_dev_s *dev);
+int pgcache_read(long offset, unsigned int nbytes, uint8_t *buffer);
+void pgcache_invalidate(long offset, uint32_t nbytes);
+void pgcache_flush(void);
+void pgcache_stats(struct pgcache_stats_s *stats, uint8_t reset);
+#else
+#define pgcache_init(d)
+#define pgcache_invalidate(o, n)
+#define pgcache_flush()
+#endif
+
+#endif /* __PGCACHE_H__ */
@@ -0,0 +1,175 @@
+/* Host test: power loss during kvstore commits and reclaims
+ *
+ * Builds against the AT45DB simulator (README, 14):
+ *
+ *   cd at45dbxx_spi
+ *   gcc -DCONFIG_AT45DB_SIM -I. -o kvstore_cut simtest/kvstore_cut.c \
+ *       at45sim.c at45dbxx.c pgcache.c logstore.c kvstore.c
+ *   ./kvstore_cut
+ *
+ * The store is brought into steady state, where every kvstore_begin copies
+ * live records off the tail page. Then the power fails in the 1st, 2nd ...
+ * page program from there on. After each cut the store is mounted again
+ * and every key must read back its last committed value; only the keys of
+ * the commit the cut hit may also have the new one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "at45sim.h"
+#include "at45dbxx.h"
+#include "kvstore.h"
+
+#define TEST_FILE       "kvstore_cut.bin"
+#define TEST_START      1200       /* First page of the store */
+#define TEST_NPAGES     6
+#define TEST_NKEYS      8
+#define TEST_VALLEN     20
+#define TEST_WARMUP     40         /* Commits before the cut is armed */
+#define TEST_MAXCUT     24         /* Programs after which the cut is tried */
+
+/* Value of key as committed by commit n, 0 for never written */
+
+uint16_t g_want[TEST_NKEYS];
+uint16_t g_maybe[TEST_NKEYS];
+
+void test_value(uint8_t *v, uint16_t key, uint16_t n)
+{
+    uint8_t i;
+
+    for (i = 0; i < TEST_VALLEN; i++)
+    {
+        v[i] = (uint8_t)(key * 31 + n + i);
+    }
+}
+
+/* Commit n writes two keys; key 0 is only written by the first commit, so
+ * its record always has to be relocated when its page reaches the tail.
+ */
+
+int test_commit(uint16_t n, uint16_t keys[2])
+{
+    uint8_t v[TEST_VALLEN];
+    uint8_t k;
+
+    keys[0] = (n == 1) ? 0 : 1 + n % 3;
+    keys[1] = 4 + n % (TEST_NKEYS - 4);
+
+    if (kvstore_begin() < 0)
+    {
+        return -1;
+    }
+
+    for (k = 0; k < 2; k++)
+    {
+        test_value(v, keys[k], n);
+        kvstore_put(keys[k], v, TEST_VALLEN);
+    }
+
+    return kvstore_commit();
+}
+
+int test_power_on(void)
+{
+    if (at45sim_attach(TEST_FILE, &P1OUT, BIT4, AT45DB_DEVID1_DFLASH | AT45DB_DEVID1_4MBIT, 0) < 0 ||
+        at45db_initialize() != 1)
+    {
+        return -1;
+    }
+
+    return kvstore_mount(TEST_START, TEST_NPAGES);
+}
+
+int test_cut(uint32_t cut)
+{
+    uint8_t v[TEST_VALLEN], want[TEST_VALLEN], maybe[TEST_VALLEN];
+    uint16_t keys[2];
+    uint16_t n, k;
+    int bad = 0;
+    int len;
+
+    remove(TEST_FILE);
+    memset(g_want, 0, sizeof(g_want));
+
+    if (test_power_on() < 0 || kvstore_format() < 0)
+    {
+        return -1;
+    }
+
+    for (n = 1; n <= TEST_WARMUP; n++)
+    {
+        if (test_commit(n, keys) < 0)
+        {
+            return -1;
+        }
+        g_want[keys[0]] = n;
+        g_want[keys[1]] = n;
+    }
+
+    /* The cut lands somewhere in the next commits */
+
+    at45sim_powercut(cut);
+
+    memcpy(g_maybe, g_want, sizeof(g_maybe));
+    for (; at45sim_powered(); n++)
+    {
+        test_commit(n, keys);
+        g_maybe[keys[0]] = n;
+        g_maybe[keys[1]] = n;
+
+        if (at45sim_powered())
+        {
+            g_want[keys[0]] = n;
+            g_want[keys[1]] = n;
+        }
+    }
+
+    at45sim_detach();
+    at45sim_powercut(0);
+
+    if (test_power_on() < 0)
+    {
+        return -1;
+    }
+
+    for (k = 0; k < TEST_NKEYS; k++)
+    {
+        len = kvstore_get(k, v, sizeof(v));
+        test_value(want, k, g_want[k]);
+        test_value(maybe, k, g_maybe[k]);
+
+        if (len != TEST_VALLEN ||
+            (memcmp(v, want, TEST_VALLEN) != 0 && memcmp(v, maybe, TEST_VALLEN) != 0))
+        {
+            printf("cut %u: key %u lost (len %d, commit %u)\n", (unsigned)cut, (unsigned)k, len,
+                   (unsigned)g_want[k]);
+            bad++;
+        }
+    }
+
+    at45sim_detach();
+
+    return bad;
+}
+
+int main(void)
+{
+    uint32_t cut;
+    int bad, failed = 0;
+
+    for (cut = 1; cut <= TEST_MAXCUT; cut++)
+    {
+        bad = test_cut(cut);
+        if (bad != 0)
+        {
+            failed++;
+        }
+    }
+
+    remove(TEST_FILE);
+
+    printf("kvstore_cut: %d of %d cuts lost data\n", failed, TEST_MAXCUT);
+
+    return failed != 0;
+}
@@ -0,0 +1,133 @@
+#ifndef __SIMTEST_MSP430_H__
+#define __SIMTEST_MSP430_H__
+
+#include <stdint.h>
+
+/* Register model of the MSP430FR6989 peripherals spi_interface.c drives
+ *
+ * Stands in for <msp430.h> when spi_interface.c is built on the host with
+ * -Isimtest (see spi_queue.c). The registers are plain variables, except
+ * that every write to UCA0TXBUF lands in a staging word the model picks up,
+ * so the eUSCI_A0 shifter, DMA0/DMA1 and TA2 can be stepped by spim_run
+ * while the CPU sits in LPM0. Interrupt handlers are called from there with
+ * the status register saved and restored as the hardware does.
+ */
+
+/* Host gcc has no MSP430 interrupt or persistent attributes */
+
+#define interrupt(vector)
+#define persistent
+
+/* spi_interface.c hands register addresses to __data16_write_addr as 16-bit
+ * values; on the host they are only used to tell the DMA registers apart.
+ */
+
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#define BIT0    0x01
+#define BIT1    0x02
+#define BIT2    0x04
+#define BIT3    0x08
+#define BIT4    0x10
+#define BIT5    0x20
+#define BIT6    0x40
+#define BIT7    0x80
+
+/* Status register ********************************************************/
+
+#define GIE             0x0008
+#define CPUOFF          0x0010
+
+#define __get_interrupt_state()         (g_spim_sr & GIE)
+#define __set_interrupt_state(x)        (g_spim_sr = (g_spim_sr & ~GIE) | ((x) & GIE))
+#define __disable_interrupt()           (g_spim_sr &= ~GIE)
+#define __enable_interrupt()            (g_spim_sr |= GIE)
+#define __bis_SR_register(x)            spim_bis_sr(x)
+#define __bic_SR_register_on_exit(x)    (g_spim_exitclr |= (x))
+#define __even_in_range(x, y)           (x)
+#define __data16_write_addr(reg, addr)  spim_write_addr(reg, addr)
+
+extern volatile uint16_t g_spim_sr;
+extern volatile uint16_t g_spim_exitclr;
+
+void spim_bis_sr(uint16_t bits);
+void spim_write_addr(unsigned short reg, unsigned long addr);
+
+/* eUSCI_A0, SPI mode *****************************************************/
+
+#define UCA0TXBUF       (*spim_txbuf())
+
+extern volatile uint16_t UCA0CTLW0, UCA0BRW, UCA0RXBUF, UCA0IE, UCA0IFG, UCA0IV;
+
+volatile uint16_t *spim_txbuf(void);
+
+#define UCSWRST         0x0001
+#define UCSSEL__SMCLK   0x0080
+#define UCSYNC          0x0100
+#define UCMST           0x0800
+#define UCMSB           0x2000
+#define UCCKPL          0x4000
+
+#define UCRXIE          0x0001
+#define UCRXIFG         0x0001
+#define UCTXIFG         0x0002
+
+#define USCI_NONE           0x00
+#define USCI_SPI_UCRXIFG    0x02
+#define USCI_SPI_UCTXIFG    0x04
+
+/* DMA ********************************************************************/
+
+struct spim_dma_s
+{
+    volatile uint16_t ctl;
+    volatile unsigned long sa;
+    volatile unsigned long da;
+    volatile uint16_t sz;
+};
+
+extern struct spim_dma_s g_spim_dma[2];
+extern volatile uint16_t DMACTL0, DMAIV;
+
+#define DMA0CTL         g_spim_dma[0].ctl
+#define DMA0SA          g_spim_dma[0].sa
+#define DMA0DA          g_spim_dma[0].da
+#define DMA0SZ          g_spim_dma[0].sz
+#define DMA1CTL         g_spim_dma[1].ctl
+#define DMA1SA          g_spim_dma[1].sa
+#define DMA1DA          g_spim_dma[1].da
+#define DMA1SZ          g_spim_dma[1].sz
+
+#define DMA0TSEL__UCA0RXIFG 0x000e
+#define DMA1TSEL__UCA0TXIFG 0x0f00
+
+#define DMADT_0         0x0000
+#define DMASRCINCR_0    0x0000
+#define DMASRCINCR_3    0x0300
+#define DMADSTINCR_0    0x0000
+#define DMADSTINCR_3    0x0c00
+#define DMASRCBYTE      0x0040
+#define DMADSTBYTE      0x0080
+#define DMAEN           0x0010
+#define DMAIFG          0x0008
+#define DMAIE           0x0004
+
+#define DMAIV_NONE      0x00
+#define DMAIV_DMA0IFG   0x02
+#define DMAIV_DMA1IFG   0x04
+#define DMAIV_DMA2IFG   0x06
+
+/* TA2, frame deadlines ***************************************************/
+
+extern volatile uint16_t TA2CTL, TA2R, TA2CCR0, TA2CCTL0;
+
+#define TASSEL__ACLK    0x0100
+#define MC__CONTINUOUS  0x0020
+#define TACLR           0x0004
+#define CCIE            0x0010
+
+/* Chip selects ***********************************************************/
+
+extern volatile uint8_t P1OUT, P1DIR;
+
+#endif /* __SIMTEST_MSP430_H__ */
@@ -1,56 +1,109 @@
 
 #include <msp430.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "spi_interface.h"
+#include "bustrace.h"
 #include "myprintf.h"
 
 /* Used to track the state of the software state machine*/
 SPI_Mode MasterMode = IDLE_MODE;
 
-/* The Register Address/Command to use*/
-uint8_t TransmitRegAddr = 0;
-
-/* ReceiveBuffer: Buffer used to receive data in the ISR
- * RXByteCtr: Number of bytes left to receive
- * ReceiveIndex: The index of the next byte to be received in ReceiveBuffer
- * TransmitBuffer: Buffer used to transmit data in the ISR
- * TXByteCtr: Number of bytes left to transfer
- * TransmitIndex: The index of the next byte to be transmitted in TransmitBuffer
+/* ReceiveBuffer: Buffer SPI_Master_ReadReg receives into
+ * ActiveXfer: The frame being clocked
+ * SegTx: Next byte to transmit in the current segment, NULL sends DUMMY
+ * SegRx: Where the next received byte goes, NULL drops it
+ * SegCtr: Number of bytes left in the current segment
  * */
 uint8_t ReceiveBuffer[MAX_BUFFER_SIZE] = {0};
-uint8_t RXByteCtr = 0;
-uint8_t ReceiveIndex = 0;
-uint8_t TransmitBuffer[MAX_BUFFER_SIZE] = {0};
-uint8_t TXByteCtr = 0;
-uint8_t TransmitIndex = 0;
+const SPI_Xfer *ActiveXfer = 0;
+const uint8_t *SegTx = 0;
+uint8_t *SegRx = 0;
+uint16_t SegCtr = 0;
+
+/* Transaction queue, see SPI_Queue_Submit
+ * TransQueue: Ring of submitted descriptors
+ * QueueHead: Next free slot, only advanced by the submitter
+ * QueueTail: Descriptor on the bus, only advanced by the ISR
+ * QueueBusy: Set while the ring owns the bus
+ * */
+SPI_Trans *TransQueue[SPI_QUEUE_SIZE] = {0};
+volatile uint8_t QueueHead = 0;
+volatile uint8_t QueueTail = 0;
+volatile uint8_t QueueBusy = 0;
+
+/* Bus speed, see SPI_Set_Divisor
+ * SpiDivisor: UCA0BRW for each SPI_Speed class
+ * SpiSavedDiv: Tuned SPI_SPEED_FAST divisor, 0 if never tuned. In FRAM, so
+ *              the tuning survives resets.
+ * */
+uint16_t SpiDivisor[SPI_NSPEEDS] = {SPI_DIV_SLOW, SPI_DIV_FAST};
+
+#if defined(__TI_COMPILER_VERSION__)
+#pragma PERSISTENT(SpiSavedDiv)
+#define SPI_FRAM
+#elif defined(__GNUC__)
+#define SPI_FRAM __attribute__ ((persistent))
+#else
+#error Compiler not supported!
+#endif
+
+SPI_FRAM uint16_t SpiSavedDiv = 0;
+
+/* Frames aborted by their TA2 deadline */
+uint16_t SpiTimeouts = 0;
+
+/* Engine used by SPI_Master_Transfer */
+#ifdef USE_SPI_DMA
+SPI_Engine TransferEngine = SPI_ENGINE_DMA;
+#else
+SPI_Engine TransferEngine = SPI_ENGINE_ISR;
+#endif
 
 /* SPI Write and Read Functions */
 
+/* Clocks one frame: xfer->cmd, xfer->dummyLen dummy bytes, then the payload.
+ * The payload is sent from xfer->txData and received into xfer->rxData
+ * directly, without staging through a driver buffer.
+ *
+ * *xfer: The frame to clock
+ *           Example: { cmd, 4, 1, NULL, page, 256 }
+ *  */
+SPI_Mode SPI_Master_Transfer(const SPI_Xfer *xfer);
+
 /* For slave device, writes the data specified in *reg_data
  *
- * reg_addr: The register or command to send to the slave.
- *           Example: CMD_TYPE_0_MASTER
- * *reg_data: The buffer to write
+ * *reg_data: The command followed by the data to write
  *           Example: MasterType0
  * count: The length of *reg_data
  *           Example: TYPE_0_LENGTH
  *  */
-//SPI_Mode SPI_Master_WriteReg(uint8_t reg_addr, uint8_t *reg_data, uint8_t count);
 SPI_Mode SPI_Master_WriteReg(uint8_t *reg_data, uint8_t count);
 
-/* For slave device, read the data specified in slaves reg_addr.
+/* For slave device, sends the command in *reg_addr and reads the reply.
  * The received data is available in ReceiveBuffer
  *
- * reg_addr: The register or command to send to the slave.
+ * *reg_addr: The command to send to the slave.
  *           Example: CMD_TYPE_0_SLAVE
- * count: The length of data to read
+ * count: The length of *reg_addr
+ * rxCount: The length of data to read, at most MAX_BUFFER_SIZE
  *           Example: TYPE_0_LENGTH
  *  */
-//SPI_Mode SPI_Master_ReadReg(uint8_t reg_addr, uint8_t count);
 SPI_Mode SPI_Master_ReadReg(uint8_t *reg_addr, uint8_t count, uint8_t rxCount);
 void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count);
 void SendUCA0Data(uint8_t val);
+uint8_t SPI_Next_Segment(void);
+uint8_t SPI_Start_Frame(const SPI_Xfer *xfer);
+uint8_t SPI_Frame_Done(void);
+uint8_t SPI_Queue_Start(void);
+void SPI_Apply_Speed(uint8_t speed);
+void SPI_Arm_Timeout(const SPI_Xfer *xfer);
+uint8_t SPI_Abort(void);
+
+#ifdef USE_SPI_DMA
+void SPI_Dma_Segment(void);
+#endif
 
 void SendUCA0Data(uint8_t val)
 {
@@ -67,94 +120,538 @@ void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count)
     }
 }
 
-#if 1
-SPI_Mode SPI_Master_WriteReg(uint8_t *reg_data, uint8_t count)
+/* Moves MasterMode to the next non-empty segment of ActiveXfer
+ *
+ * TX_REG_ADDRESS_MODE: command bytes
+ * RX_REG_ADDRESS_MODE: dummy bytes between command and payload
+ * TX_DATA_MODE / RX_DATA_MODE: payload without / with a receive buffer
+ *
+ * Returns 0 once the frame is complete.
+ *  */
+uint8_t SPI_Next_Segment(void)
+{
+    const SPI_Xfer *xfer = ActiveXfer;
+
+    switch (MasterMode)
+    {
+        case IDLE_MODE:
+            if (xfer->cmdLen)
+            {
+                MasterMode = TX_REG_ADDRESS_MODE;
+                SegTx = xfer->cmd;
+                SegRx = 0;
+                SegCtr = xfer->cmdLen;
+                return 1;
+            }
+            // fall through
+        case TX_REG_ADDRESS_MODE:
+            if (xfer->dummyLen)
+            {
+                MasterMode = RX_REG_ADDRESS_MODE;
+                SegTx = 0;
+                SegRx = 0;
+                SegCtr = xfer->dummyLen;
+                return 1;
+            }
+            // fall through
+        case RX_REG_ADDRESS_MODE:
+            if (xfer->dataLen)
+            {
+                MasterMode = xfer->rxData ? RX_DATA_MODE : TX_DATA_MODE;
+                SegTx = xfer->txData;
+                SegRx = xfer->rxData;
+                SegCtr = xfer->dataLen;
+                return 1;
+            }
+            // fall through
+        default:
+            MasterMode = IDLE_MODE;
+            return 0;
+    }
+}
+
+/* Switches UCA0BRW to the divisor of a speed class. The divisor can only
+ * change in reset, which also clears UCA0IE, so this runs between frames.
+ *  */
+void SPI_Apply_Speed(uint8_t speed)
 {
-    MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_data[0];
+    uint16_t div = SpiDivisor[speed < SPI_NSPEEDS ? speed : SPI_SPEED_SLOW];
 
-    //Copy register data to TransmitBuffer
-    CopyArray(&reg_data[1], TransmitBuffer, count-1);
+    if (UCA0BRW == div)
+        return;
 
-    TXByteCtr = count-1;
-    RXByteCtr = 0;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    UCA0CTLW0 |= UCSWRST;
+    UCA0BRW = div;
+    UCA0CTLW0 &= ~UCSWRST;
+    UCA0IE |= UCRXIE;
+}
 
-    //SPI_CS_OUT &= ~(SPI_CS_PIN);
-    SendUCA0Data(TransmitRegAddr);
+/* Clocks the first byte of xfer (ISR engine) or arms its first segment (DMA
+ * engine). Returns 0 if the frame is empty.
+ *  */
+uint8_t SPI_Start_Frame(const SPI_Xfer *xfer)
+{
+    ActiveXfer = xfer;
+    MasterMode = IDLE_MODE;
 
-    __bis_SR_register(CPUOFF + GIE);              // Enter LPM0 w/ interrupts
+    SPI_Apply_Speed(xfer->speed);
 
-    //SPI_CS_OUT |= SPI_CS_PIN;
-    return MasterMode;
+    if (!SPI_Next_Segment())
+        return 0;
+
+    bustrace_begin(BUSTRACE_SPI, 0, xfer->cmdLen ? xfer->cmd[0] : BUSTRACE_OP_DATA);
+    SPI_Arm_Timeout(xfer);
+
+#ifdef USE_SPI_DMA
+    if (TransferEngine == SPI_ENGINE_DMA)
+    {
+        UCA0IE &= ~UCRXIE;                     // DMA0 owns UCRXIFG for the frame
+        SPI_Dma_Segment();
+        return 1;
+    }
+#endif
+
+    SendUCA0Data(SegTx ? *SegTx++ : DUMMY);
+    return 1;
 }
-#else
-SPI_Mode SPI_Master_WriteReg(uint8_t reg_addr, uint8_t *reg_data, uint8_t count)
+
+/* Called by USCI_A0_ISR or DMA_ISR once the last byte of a frame is in, or
+ * by TIMER2_A0_ISR with TIMEOUT_MODE once the frame was aborted.
+ * Returns 1 if the CPU should leave LPM0.
+ *  */
+uint8_t SPI_Frame_Done(void)
 {
-    MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_addr;
+    TA2CCTL0 = 0;                              // Disarm the deadline
 
-    //Copy register data to TransmitBuffer
-    CopyArray(reg_data, TransmitBuffer, count);
+    bustrace_end(BUSTRACE_SPI, ActiveXfer->cmdLen + ActiveXfer->dummyLen + ActiveXfer->dataLen,
+                 MasterMode == TIMEOUT_MODE ? BUSTRACE_TIMEOUT : BUSTRACE_OK);
 
-    TXByteCtr = count;
-    RXByteCtr = 0;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    UCA0IE |= UCRXIE;
 
-    //SPI_CS_OUT &= ~(SPI_CS_PIN);
-    SendUCA0Data(TransmitRegAddr);
+    if (QueueBusy)
+    {
+        TransQueue[QueueTail]->status = MasterMode;
+        return SPI_Queue_Start() == 0;         // Wake once the ring drained
+    }
+
+    return 1;
+}
+
+SPI_Mode SPI_Master_Transfer(const SPI_Xfer *xfer)
+{
+    unsigned short istate;
+
+    SPI_Queue_Flush();                         // The ring releases the bus first
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();                     // The ISR must not run before LPM0
+
+    if (!SPI_Start_Frame(xfer))
+    {
+        __set_interrupt_state(istate);
+        return MasterMode;
+    }
 
     __bis_SR_register(CPUOFF + GIE);              // Enter LPM0 w/ interrupts
 
-    //SPI_CS_OUT |= SPI_CS_PIN;
     return MasterMode;
 }
-#endif
 
-#if 1
+SPI_Mode SPI_Master_WriteReg(uint8_t *reg_data, uint8_t count)
+{
+    SPI_Xfer xfer = {0};
+
+    xfer.cmd = reg_data;
+    xfer.cmdLen = count;
+
+    return SPI_Master_Transfer(&xfer);
+}
+
 SPI_Mode SPI_Master_ReadReg(uint8_t *reg_addr, uint8_t count, uint8_t rxCount)
 {
-    MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_addr[0];
+    SPI_Xfer xfer = {0};
 
-    //Copy register data to TransmitBuffer
-    if (count == 1)
-        ;//MasterMode = RX_DATA_MODE;
-    else
-        CopyArray(&reg_addr[1], TransmitBuffer, count-1);
+    if (rxCount > MAX_BUFFER_SIZE)
+        rxCount = MAX_BUFFER_SIZE;
 
-    TXByteCtr = count;
-    RXByteCtr = rxCount;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    xfer.cmd = reg_addr;
+    xfer.cmdLen = count;
+    xfer.rxData = ReceiveBuffer;
+    xfer.dataLen = rxCount;
 
-    //SPI_CS_OUT &= ~(SPI_CS_PIN);
-    SendUCA0Data(TransmitRegAddr);
+    return SPI_Master_Transfer(&xfer);
+}
 
-    __bis_SR_register(CPUOFF + GIE);              // Enter LPM0 w/ interrupts
+//******************************************************************************
+// Transaction Queue ***********************************************************
+//******************************************************************************
 
-    //SPI_CS_OUT |= SPI_CS_PIN;
-    return MasterMode;
+/* Completes the descriptor at QueueTail and starts the next non-empty one,
+ * so back-to-back frames chain inside the ISR without waking the caller.
+ * Returns 1 while the ring owns the bus.
+ *  */
+uint8_t SPI_Queue_Start(void)
+{
+    SPI_Trans *trans;
+
+    if (QueueBusy)
+    {
+        trans = TransQueue[QueueTail];
+        if (trans->csOut)
+            *trans->csOut |= trans->csPin;     // Release chip select
+        QueueTail = (QueueTail + 1) & (SPI_QUEUE_SIZE - 1);
+        QueueBusy = 0;
+        if (trans->done)
+            trans->done(trans);
+    }
+
+    /* A callback may have submitted and started a frame already */
+
+    while (!QueueBusy && QueueTail != QueueHead)
+    {
+        trans = TransQueue[QueueTail];
+        if (trans->csOut)
+            *trans->csOut &= ~trans->csPin;    // Select the slave
+
+        QueueBusy = 1;
+        if (SPI_Start_Frame(&trans->xfer))
+            return 1;
+
+        // Nothing to clock, complete it right away
+        trans->status = IDLE_MODE;
+        if (trans->csOut)
+            *trans->csOut |= trans->csPin;
+        QueueTail = (QueueTail + 1) & (SPI_QUEUE_SIZE - 1);
+        QueueBusy = 0;
+        if (trans->done)
+            trans->done(trans);
+    }
+
+    return QueueBusy;
 }
+
+/* Appends trans to the ring and starts the bus if it is idle. Call it from
+ * the main loop or from an SPI_Callback, never from another ISR while a
+ * blocking SPI_Master_Transfer may be running. Returns 0 if the ring is full.
+ *  */
+uint8_t SPI_Queue_Submit(SPI_Trans *trans)
+{
+    unsigned short istate;
+    uint8_t next;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    next = (QueueHead + 1) & (SPI_QUEUE_SIZE - 1);
+    if (next == QueueTail)
+    {
+        __set_interrupt_state(istate);
+        return 0;                              // Ring full
+    }
+
+    trans->status = TX_REG_ADDRESS_MODE;
+    TransQueue[QueueHead] = trans;
+    QueueHead = next;
+
+    if (!QueueBusy)
+        SPI_Queue_Start();
+
+    __set_interrupt_state(istate);
+    return 1;
+}
+
+/* 1 while a blocking SPI_Master_Transfer owns the bus. Lets an ISR decide
+ * whether it may submit to the ring.
+ *  */
+uint8_t SPI_Master_Busy(void)
+{
+    return MasterMode != IDLE_MODE && MasterMode != TIMEOUT_MODE && !QueueBusy;
+}
+
+uint8_t SPI_Queue_Pending(void)
+{
+    return (QueueHead - QueueTail) & (SPI_QUEUE_SIZE - 1);
+}
+
+void SPI_Queue_Flush(void)
+{
+    unsigned short istate;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+    while (QueueBusy)
+    {
+        __bis_SR_register(CPUOFF + GIE);      // Woken once the ring drained
+        __disable_interrupt();
+    }
+    __set_interrupt_state(istate);
+}
+
+#ifdef USE_SPI_DMA
+//******************************************************************************
+// DMA Transfer Engine *********************************************************
+//******************************************************************************
+
+/* DMA0 (highest priority) is triggered by UCA0RXIFG and drains UCA0RXBUF,
+ * DMA1 is triggered by UCA0TXIFG and feeds UCA0TXBUF. Only DMA0 interrupts:
+ * once it has received the last byte of a segment every byte has been
+ * shifted out, so the chip select can be released right after.
+ *
+ * DmaSink: RX bytes clocked in while the command goes out are dropped here
+ * DmaDummy: Source of the dummy bytes clocked out while receiving
+ * */
+uint8_t DmaSink = 0;
+const uint8_t DmaDummy = DUMMY;
+
+void SPI_Dma_Start(const uint8_t *tx_data, uint16_t tx_incr, uint8_t *rx_data, uint16_t rx_incr, uint16_t count)
+{
+    DMACTL0 = DMA0TSEL__UCA0RXIFG | DMA1TSEL__UCA0TXIFG;
+
+    DMA0CTL = DMADT_0 | DMASRCINCR_0 | rx_incr | DMASRCBYTE | DMADSTBYTE | DMAIE;
+    __data16_write_addr((unsigned short)&DMA0SA, (unsigned long)&UCA0RXBUF);
+    __data16_write_addr((unsigned short)&DMA0DA, (unsigned long)rx_data);
+    DMA0SZ = count;
+    DMA0CTL |= DMAEN;
+
+    // DMA1 is edge triggered, so the CPU writes the first byte and the
+    // UCTXIFG edge raised when it moves to the shift register starts DMA1
+    if (count > 1)
+    {
+        DMA1CTL = DMADT_0 | tx_incr | DMADSTINCR_0 | DMASRCBYTE | DMADSTBYTE;
+        __data16_write_addr((unsigned short)&DMA1SA, (unsigned long)(tx_incr ? &tx_data[1] : tx_data));
+        __data16_write_addr((unsigned short)&DMA1DA, (unsigned long)&UCA0TXBUF);
+        DMA1SZ = count - 1;
+        DMA1CTL |= DMAEN;
+    }
+
+    UCA0IFG &= ~UCRXIFG;                        // No stale edge for DMA0
+    SendUCA0Data(tx_data[0]);
+}
+
+void SPI_Dma_Segment(void)
+{
+    SPI_Dma_Start(SegTx ? SegTx : &DmaDummy, SegTx ? DMASRCINCR_3 : DMASRCINCR_0,
+                  SegRx ? SegRx : &DmaSink, SegRx ? DMADSTINCR_3 : DMADSTINCR_0,
+                  SegCtr);
+}
+
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=DMA_VECTOR
+__interrupt void DMA_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(DMA_VECTOR))) DMA_ISR (void)
 #else
-SPI_Mode SPI_Master_ReadReg(uint8_t reg_addr, uint8_t count)
+#error Compiler not supported!
+#endif
 {
-    MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_addr;
-    RXByteCtr = count;
-    TXByteCtr = 0;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    switch(__even_in_range(DMAIV, DMAIV_DMA2IFG))
+    {
+        case DMAIV_NONE: break;
+        case DMAIV_DMA0IFG:
+            if (SPI_Next_Segment())
+            {
+                SPI_Dma_Segment();
+                break;
+            }
 
-    SLAVE_CS_OUT &= ~(SLAVE_CS_PIN);
-    SendUCA0Data(TransmitRegAddr);
+            if (SPI_Frame_Done())
+                __bic_SR_register_on_exit(CPUOFF);  // Exit LPM0
+            break;
+        case DMAIV_DMA1IFG: break;
+        case DMAIV_DMA2IFG: break;
+        default: break;
+    }
+}
+#endif
 
-    __bis_SR_register(CPUOFF + GIE);              // Enter LPM0 w/ interrupts
+//******************************************************************************
+// Timeouts ********************************************************************
+//******************************************************************************
 
-    SLAVE_CS_OUT |= SLAVE_CS_PIN;
-    return MasterMode;
+/* Arms TA2 CCR0 for a frame: twice the time its bytes take at its divisor,
+ * or at SPI_ISR_CYCLES a byte if the ISR engine is slower than that, plus
+ * SPI_TIMEOUT_MARGIN for the interrupt latency.
+ *  */
+void SPI_Arm_Timeout(const SPI_Xfer *xfer)
+{
+    uint32_t cycles, ticks;
+    uint32_t perByte = 8UL * UCA0BRW;
+
+    if (TransferEngine == SPI_ENGINE_ISR && perByte < SPI_ISR_CYCLES)
+        perByte = SPI_ISR_CYCLES;
+
+    cycles = (uint32_t)(xfer->cmdLen + xfer->dummyLen + xfer->dataLen) * perByte;
+    ticks = 2 * cycles / (SPI_SMCLK_HZ / SPI_TIMEOUT_HZ) + SPI_TIMEOUT_MARGIN;
+    if (ticks > SPI_TIMEOUT_MAX)
+        ticks = SPI_TIMEOUT_MAX;
+
+    TA2CCR0 = TA2R + (uint16_t)ticks;
+    TA2CCTL0 = CCIE;                           // Also clears a stale CCIFG
+}
+
+/* Aborts the frame on the bus: stops the DMA channels, resets the eUSCI to
+ * drop the byte in flight and completes the frame with TIMEOUT_MODE. A queued
+ * frame has its chip select released by SPI_Queue_Start, a blocking caller
+ * releases its own on return. Returns 1 if the CPU should leave LPM0.
+ *  */
+uint8_t SPI_Abort(void)
+{
+#ifdef USE_SPI_DMA
+    DMA0CTL &= ~(DMAEN | DMAIFG);
+    DMA1CTL &= ~(DMAEN | DMAIFG);
+#endif
+
+    UCA0CTLW0 |= UCSWRST;                      // Also clears UCA0IE and UCRXIFG
+    UCA0CTLW0 &= ~UCSWRST;
+
+    MasterMode = TIMEOUT_MODE;
+    SpiTimeouts++;
+
+    return SPI_Frame_Done();
+}
+
+uint16_t SPI_Timeouts(void)
+{
+    return SpiTimeouts;
+}
+
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=TIMER2_A0_VECTOR
+__interrupt void TIMER2_A0_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(TIMER2_A0_VECTOR))) TIMER2_A0_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    TA2CCTL0 = 0;
+
+    if (SPI_Abort())
+        __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+}
+
+//******************************************************************************
+// Bus Speed *******************************************************************
+//******************************************************************************
+
+/* Sets the divisor of a speed class, applied from the next frame of that
+ * class on. div is clamped to SPI_DIV_MIN.
+ *  */
+void SPI_Set_Divisor(SPI_Speed speed, uint16_t div)
+{
+    if (div < SPI_DIV_MIN)
+        div = SPI_DIV_MIN;
+
+    SpiDivisor[speed] = div;
+}
+
+uint16_t SPI_Get_Divisor(SPI_Speed speed)
+{
+    return SpiDivisor[speed];
+}
+
+/* Keeps the current SPI_SPEED_FAST divisor in FRAM for initSPI */
+void SPI_Save_Divisor(void)
+{
+    SpiSavedDiv = SpiDivisor[SPI_SPEED_FAST];
+}
+
+uint16_t SPI_Saved_Divisor(void)
+{
+    return SpiSavedDiv;
+}
+
+#ifdef SPI_INTERFACE_BENCH
+//******************************************************************************
+// Benchmark *******************************************************************
+//******************************************************************************
+
+/* Timer_A1 counts SMCLK/64 so a full run at SMCLK/32 stays well inside the
+ * 16-bit counter. Each run clocks SPI_BENCH_FRAMES page sized frames at
+ * SPI_SPEED_FAST, once per divisor from SPI_DIV_MIN to SPI_DIV_SLOW, so the
+ * per byte cost of each engine shows up where the bus outruns the ISR.
+ * Chip select stays high while the benchmark runs, so the slave ignores the
+ * traffic.
+ * */
+#define SPI_BENCH_FRAMES    8
+#define SPI_BENCH_DIV       64
+#define SPI_BENCH_LEN       256
+
+uint8_t SpiBenchCmd[4] = {0x84, 0x00, 0x00, 0x00};
+uint8_t SpiBenchData[SPI_BENCH_LEN];
+
+uint16_t SPI_Bench_Run(const SPI_Xfer *xfer)
+{
+    uint16_t ticks;
+    uint8_t i;
+
+    TA1CTL = TASSEL__SMCLK | MC__STOP | TACLR | ID__8;
+    TA1EX0 = TAIDEX_7;                          // SMCLK/8/8
+    TA1CTL |= MC__CONTINUOUS;
+
+    for (i = 0; i < SPI_BENCH_FRAMES; i++)
+        SPI_Master_Transfer(xfer);
+
+    ticks = TA1R;
+    TA1CTL = MC__STOP;
+
+    return ticks;
+}
+
+void SPI_Bench_Report(char *name, uint16_t div, const SPI_Xfer *xfer, uint16_t ticks)
+{
+    unsigned long bytes = (unsigned long)SPI_BENCH_FRAMES * (xfer->cmdLen + xfer->dummyLen + xfer->dataLen);
+    unsigned long cycles = (unsigned long)ticks * SPI_BENCH_DIV;
+
+    if (cycles == 0)
+        cycles = 1;
+
+    myprintf("%s div %u: %u bytes %u cycles %u.%u cycles/byte %u bytes/s\r\n", name, (unsigned long)div,
+             bytes, cycles, cycles / bytes, cycles * 10 / bytes % 10, bytes * SPI_SMCLK_HZ / cycles);
+}
+
+void spiBenchmark(void)
+{
+    SPI_Engine engine = TransferEngine;
+    uint16_t fastDiv = SPI_Get_Divisor(SPI_SPEED_FAST);
+    SPI_Xfer wr = {0};
+    SPI_Xfer rd = {0};
+    uint16_t div;
+    uint16_t i;
+
+    for (i = 0; i < SPI_BENCH_LEN; i++)
+        SpiBenchData[i] = i;
+
+    wr.cmd = SpiBenchCmd;                       // Buffer write
+    wr.cmdLen = sizeof(SpiBenchCmd);
+    wr.txData = SpiBenchData;
+    wr.dataLen = SPI_BENCH_LEN;
+    wr.speed = SPI_SPEED_FAST;
+
+    rd.cmd = SpiBenchCmd;                       // Buffer read, one dummy byte
+    rd.cmdLen = sizeof(SpiBenchCmd);
+    rd.dummyLen = 1;
+    rd.rxData = SpiBenchData;
+    rd.dataLen = SPI_BENCH_LEN;
+    rd.speed = SPI_SPEED_FAST;
+
+    for (div = SPI_DIV_MIN; div <= SPI_DIV_SLOW; div <<= 1)
+    {
+        SPI_Set_Divisor(SPI_SPEED_FAST, div);
+
+        TransferEngine = SPI_ENGINE_ISR;
+        SPI_Bench_Report("isr write", div, &wr, SPI_Bench_Run(&wr));
+        SPI_Bench_Report("isr read ", div, &rd, SPI_Bench_Run(&rd));
+
+#ifdef USE_SPI_DMA
+        TransferEngine = SPI_ENGINE_DMA;
+        SPI_Bench_Report("dma write", div, &wr, SPI_Bench_Run(&wr));
+        SPI_Bench_Report("dma read ", div, &rd, SPI_Bench_Run(&rd));
+#endif
+    }
+
+    SPI_Set_Divisor(SPI_SPEED_FAST, fastDiv);
+    TransferEngine = engine;
 }
 #endif
 
@@ -164,14 +661,19 @@ SPI_Mode SPI_Master_ReadReg(uint8_t reg_addr, uint8_t count)
 
 void initSPI(void)
 {
+    if (SpiSavedDiv)
+        SpiDivisor[SPI_SPEED_FAST] = SpiSavedDiv;
+
     //Clock Polarity: The inactive state is high
     //MSB First, 8-bit, Master, 3-pin mode, Synchronous
     UCA0CTLW0 = UCSWRST;                       // **Put state machine in reset**
     UCA0CTLW0 |= UCCKPL | UCMSB | UCSYNC
                 | UCMST | UCSSEL__SMCLK;      // 3-pin, 8-bit SPI Slave
-    UCA0BRW = 0x20;
+    UCA0BRW = SpiDivisor[SPI_SPEED_SLOW];
     UCA0CTLW0 &= ~UCSWRST;                     // **Initialize USCI state machine**
     UCA0IE |= UCRXIE;                          // Enable USCI0 RX interrupt
+
+    TA2CTL = TASSEL__ACLK | MC__CONTINUOUS | TACLR;    // Frame deadlines
 }
 
 //******************************************************************************
@@ -196,71 +698,21 @@ void __attribute__ ((interrupt(USCI_A0_VECTOR))) USCI_A0_ISR (void)
 
             UCA0IFG &= ~UCRXIFG;
 
-            switch (MasterMode)
+            if (MasterMode == IDLE_MODE || MasterMode == TIMEOUT_MODE)
+                break;
+
+            if (SegRx)
+                *SegRx++ = uca0_rx_val;
+
+            if (--SegCtr == 0 && !SPI_Next_Segment())
             {
-                case TX_REG_ADDRESS_MODE:
-                    if (RXByteCtr)
-                    {
-                        if (--TXByteCtr > 0) // add by sglee
-                        {
-                            MasterMode = TX_REG_ADDRESS_MODE;
-                            SendUCA0Data(TransmitBuffer[TransmitIndex++]);
-                            break;
-                        }
-
-                        MasterMode = RX_DATA_MODE;   // Need to start receiving now
-                        //Send Dummy To Start
-                        //__delay_cycles(2000000);
-                        //__delay_cycles(16000); // 100us, 160=1us, not needed by sglee
-                        SendUCA0Data(DUMMY);
-                    }
-                    else
-                    {
-                        MasterMode = TX_DATA_MODE;        // Continue to transmision with the data in Transmit Buffer
-                        //Send First
-                        SendUCA0Data(TransmitBuffer[TransmitIndex++]);
-                        TXByteCtr--;
-                    }
-                    break;
-
-                case TX_DATA_MODE:
-                    if (TXByteCtr)
-                    {
-                      SendUCA0Data(TransmitBuffer[TransmitIndex++]);
-                      TXByteCtr--;
-                    }
-                    else
-                    {
-                      //Done with transmission
-                      MasterMode = IDLE_MODE;
-                      __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
-                    }
-                    break;
-
-                case RX_DATA_MODE:
-                    if (RXByteCtr)
-                    {
-                        ReceiveBuffer[ReceiveIndex++] = uca0_rx_val;
-                        //Transmit a dummy
-                        RXByteCtr--;
-                    }
-                    if (RXByteCtr == 0)
-                    {
-                        MasterMode = IDLE_MODE;
-                        __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
-                    }
-                    else
-                    {
-                        SendUCA0Data(DUMMY);
-                    }
-                    break;
-
-                default:
-                    __no_operation();
-                    break;
+                //Done with the frame
+                if (SPI_Frame_Done())
+                    __bic_SR_register_on_exit(CPUOFF);  // Exit LPM0
+                break;
             }
-            //__delay_cycles(1000);
-            //__delay_cycles(160); // 160 = 1us, not needed by sglee
+
+            SendUCA0Data(SegTx ? *SegTx++ : DUMMY);
             break;
         case USCI_SPI_UCTXIFG:
             break;
@@ -4,6 +4,10 @@
 #include <stdint.h>
 
 #define USE_SPI_INTERFACE
+#define USE_SPI_DMA
+//#define SPI_INTERFACE_BENCH
+
+#define SPI_SMCLK_HZ  16000000UL
 
 #define SPI_CS_OUT    P1OUT
 #define SPI_CS_DIR    P1DIR
@@ -13,6 +17,15 @@
 #define SPI_RST_DIR   P1DIR
 #define SPI_RST_PIN   BIT6
 
+#define SPI_RDY_IN    P1IN
+#define SPI_RDY_OUT   P1OUT
+#define SPI_RDY_DIR   P1DIR
+#define SPI_RDY_REN   P1REN
+#define SPI_RDY_IE    P1IE
+#define SPI_RDY_IES   P1IES
+#define SPI_RDY_IFG   P1IFG
+#define SPI_RDY_PIN   BIT7
+
 //******************************************************************************
 // General SPI State Machine ***************************************************
 //******************************************************************************
@@ -26,18 +39,133 @@ typedef enum SPI_ModeEnum{
     TIMEOUT_MODE
 } SPI_Mode;
 
+//******************************************************************************
+// Transfer Engine *************************************************************
+//******************************************************************************
+
+/* SPI_ENGINE_ISR: one USCI_A0 interrupt per byte (MasterMode state machine)
+ * SPI_ENGINE_DMA: DMA0 drains UCA0RXBUF, DMA1 feeds UCA0TXBUF, one DMA
+ *                 interrupt per frame
+ * */
+typedef enum SPI_EngineEnum{
+    SPI_ENGINE_ISR,
+    SPI_ENGINE_DMA
+} SPI_Engine;
+
+extern SPI_Engine TransferEngine;
+
 #define DUMMY   0xFF
 
+//******************************************************************************
+// Bus Speed *******************************************************************
+//******************************************************************************
+
+/* Each frame runs at the divisor of its class (UCA0BRW = SMCLK / SCK)
+ * SPI_SPEED_SLOW: Status polls, identification and short commands
+ * SPI_SPEED_FAST: Bulk array reads and buffer fills, tuned at run time and
+ *                 kept in FRAM (SPI_Save_Divisor)
+ * */
+typedef enum SPI_SpeedEnum{
+    SPI_SPEED_SLOW,
+    SPI_SPEED_FAST,
+    SPI_NSPEEDS
+} SPI_Speed;
+
+#define SPI_DIV_SLOW        32      /* 500kHz */
+#define SPI_DIV_FAST        4       /* 4MHz until a tuned divisor is saved */
+#define SPI_DIV_MIN         1       /* SCK = SMCLK */
+
+//******************************************************************************
+// Timeouts ********************************************************************
+//******************************************************************************
+
+/* Every frame is armed on TA2 (ACLK) with twice its clocking time plus
+ * SPI_TIMEOUT_MARGIN. On expiry the frame is aborted: DMA stopped, eUSCI
+ * reset, queued chip select released, TIMEOUT_MODE reported.
+ * With the ISR engine a byte takes at least SPI_ISR_CYCLES whatever the
+ * divisor, the interrupt entry and the MasterMode state machine.
+ * */
+#define SPI_TIMEOUT_HZ      32768UL
+#define SPI_TIMEOUT_MARGIN  33      /* ~1ms */
+#define SPI_TIMEOUT_MAX     0xf000  /* ~1.9s */
+#define SPI_ISR_CYCLES      128     /* SMCLK cycles per byte, ISR engine */
+
 #define MAX_BUFFER_SIZE     20
 
+/* One chip select frame, clocked in this order:
+ * cmd / cmdLen: Command and address bytes
+ * dummyLen: Don't care bytes clocked out after the command
+ * txData: Payload to send, NULL clocks out DUMMY
+ * rxData: Where the payload replies go, NULL drops them
+ * dataLen: Payload length
+ * speed: SPI_Speed class, 0 (slow) for a zeroed SPI_Xfer
+ * */
+typedef struct SPI_XferStruct{
+    const uint8_t *cmd;
+    uint8_t cmdLen;
+    uint8_t dummyLen;
+    const uint8_t *txData;
+    uint8_t *rxData;
+    uint16_t dataLen;
+    uint8_t speed;
+} SPI_Xfer;
+
+//******************************************************************************
+// Transaction Queue ***********************************************************
+//******************************************************************************
+
+/* Number of ring slots, a power of two. One slot is kept free. */
+#define SPI_QUEUE_SIZE      8
+
+typedef struct SPI_TransStruct SPI_Trans;
+
+/* Runs in interrupt context once the frame is done and chip select is
+ * released. It may submit further descriptors. */
+typedef void (*SPI_Callback)(SPI_Trans *trans);
+
+/* Queued frame, owned by the caller until done has run
+ * csOut / csPin: Chip select, driven low for the frame. NULL csOut leaves it alone
+ * cmd: Storage for the command bytes xfer.cmd usually points at
+ * xfer: The frame to clock
+ * done: Completion callback, may be NULL
+ * arg: Free for the submitter
+ * status: TX_REG_ADDRESS_MODE while queued, IDLE_MODE once done,
+ *         TIMEOUT_MODE if it was aborted
+ * */
+struct SPI_TransStruct{
+    volatile uint8_t *csOut;
+    uint8_t csPin;
+    uint8_t cmd[4];
+    SPI_Xfer xfer;
+    SPI_Callback done;
+    void *arg;
+    volatile SPI_Mode status;
+};
+
 extern uint8_t ReceiveBuffer[MAX_BUFFER_SIZE];
 
 void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count);
 
+SPI_Mode SPI_Master_Transfer(const SPI_Xfer *xfer);
+
+uint8_t SPI_Queue_Submit(SPI_Trans *trans);
+uint8_t SPI_Queue_Pending(void);
+uint8_t SPI_Master_Busy(void);
+uint16_t SPI_Timeouts(void);
+void SPI_Queue_Flush(void);
+
+void SPI_Set_Divisor(SPI_Speed speed, uint16_t div);
+uint16_t SPI_Get_Divisor(SPI_Speed speed);
+void SPI_Save_Divisor(void);
+uint16_t SPI_Saved_Divisor(void);
+
 SPI_Mode SPI_Master_WriteReg(uint8_t *reg_data, uint8_t count);
 //SPI_Mode SPI_Master_WriteReg(uint8_t reg_addr, uint8_t *reg_data, uint8_t count);
 SPI_Mode SPI_Master_ReadReg(uint8_t *reg_data, uint8_t count, uint8_t rxCount);
 void initSPI(void);
 void spiTest(void);
+#ifdef SPI_INTERFACE_BENCH
+void spiBenchmark(void);
+#endif
 
 #endif
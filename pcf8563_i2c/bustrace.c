@@ -0,0 +1,345 @@
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bustrace.h"
+#include "myclock.h"
+#include "myprintf.h"
+
+#ifdef CONFIG_BUSTRACE
+
+/* Transaction in progress on each bus */
+
+struct bustrace_open_s
+{
+    uint32_t start;
+    uint8_t  addr;
+    uint8_t  op;
+    uint8_t  active;
+};
+
+struct bustrace_open_s g_btopen[BUSTRACE_NBUS];
+
+volatile uint16_t g_bthi;      /* TB0 overflow count, upper half of bustrace_now() */
+uint32_t g_btrate;             /* TB0 ticks per second, 0 while stopped */
+
+/* TB0 input dividers by ID */
+
+const uint16_t g_btid[4] = { ID__1, ID__2, ID__4, ID__8 };
+
+#if defined(__TI_COMPILER_VERSION__)
+#pragma PERSISTENT(g_btring)
+#pragma PERSISTENT(g_bthead)
+#pragma PERSISTENT(g_bthist)
+#define BUSTRACE_FRAM
+#elif defined(__GNUC__)
+#define BUSTRACE_FRAM __attribute__ ((persistent))
+#else
+#error Compiler not supported!
+#endif
+
+BUSTRACE_FRAM struct bustrace_rec_s g_btring[BUSTRACE_NREC] = {{0}};
+BUSTRACE_FRAM uint16_t g_bthead = 0;    /* Next ring slot, counts on past BUSTRACE_NREC */
+BUSTRACE_FRAM struct bustrace_hist_s g_bthist[BUSTRACE_NHIST] = {{0}};
+
+struct bustrace_hist_s *bustrace_hist(uint8_t bus, uint8_t op);
+
+/************************************************************************************
+ * Name: bustrace_init
+ *
+ * Description:
+ *   Start TB0 for the SMCLK the clock system runs at and follow clock_init
+ *   from then on.
+ *
+ ************************************************************************************/
+
+void bustrace_init(void)
+{
+    g_btrate = 0;
+    bustrace_clock(clock_smclk());
+    clock_sethook(bustrace_clock);
+}
+
+/************************************************************************************
+ * Name: bustrace_clock
+ *
+ * Description:
+ *   Restart TB0 in continuous mode at SMCLK over the ID x TBIDEX divider that
+ *   comes closest to 1MHz. The overflow interrupt extends it to 32 bits. A
+ *   transaction open across the switch is dropped, and an unknown SMCLK (0)
+ *   leaves the time base alone.
+ *
+ ************************************************************************************/
+
+void bustrace_clock(unsigned long smclk)
+{
+    unsigned short istate;
+    uint32_t rate, err, besterr = 0xffffffffUL;
+    uint8_t id, idex, bestid = 0, bestidex = 1;
+
+    if (smclk == 0)
+    {
+        return;
+    }
+
+    for (id = 0; id < 4; id++)
+    {
+        for (idex = 1; idex <= 8; idex++)
+        {
+            rate = (smclk >> id) / idex;
+            err = (rate > 1000000UL) ? rate - 1000000UL : 1000000UL - rate;
+            if (err < besterr)
+            {
+                besterr = err;
+                bestid = id;
+                bestidex = idex;
+            }
+        }
+    }
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    g_bthi = 0;
+    memset(g_btopen, 0, sizeof(g_btopen));
+    g_btrate = (smclk >> bestid) / bestidex;
+
+    TB0CTL = TBSSEL__SMCLK | g_btid[bestid] | TBCLR;
+    TB0EX0 = bestidex - 1;                    // TBIDEX_0 is /1
+    TB0CTL |= MC__CONTINUOUS | TBIE;
+
+    __set_interrupt_state(istate);
+}
+
+/************************************************************************************
+ * Name: bustrace_now
+ ************************************************************************************/
+
+uint32_t bustrace_now(void)
+{
+    unsigned short istate;
+    uint16_t hi, lo;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    hi = g_bthi;
+    lo = TB0R;
+    if ((TB0CTL & TBIFG) && lo < 0x8000)
+    {
+        hi++;                  /* Wrapped, ISR not run yet */
+    }
+
+    __set_interrupt_state(istate);
+
+    return ((uint32_t)hi << 16) | lo;
+}
+
+/************************************************************************************
+ * Name: bustrace_begin
+ *
+ * Description:
+ *   A transaction starts on bus. Called by the drivers, in or out of their
+ *   interrupts.
+ *
+ ************************************************************************************/
+
+void bustrace_begin(uint8_t bus, uint8_t addr, uint8_t op)
+{
+    struct bustrace_open_s *open = &g_btopen[bus];
+
+    open->start  = bustrace_now();
+    open->addr   = addr;
+    open->op     = op;
+    open->active = 1;
+}
+
+/************************************************************************************
+ * Name: bustrace_hist
+ *
+ * Description:
+ *   Histogram of a command. New commands take a free entry; once the table is
+ *   full they are all counted in the last one (op BUSTRACE_OP_DATA).
+ *
+ ************************************************************************************/
+
+struct bustrace_hist_s *bustrace_hist(uint8_t bus, uint8_t op)
+{
+    struct bustrace_hist_s *hist;
+    uint8_t i;
+
+    for (i = 0, hist = g_bthist; i < BUSTRACE_NHIST - 1; i++, hist++)
+    {
+        if (hist->count == 0)
+        {
+            hist->bus = bus;
+            hist->op  = op;
+            return hist;
+        }
+
+        if (hist->bus == bus && hist->op == op)
+        {
+            return hist;
+        }
+    }
+
+    hist->bus = bus;
+    hist->op  = BUSTRACE_OP_DATA;
+    return hist;
+}
+
+/************************************************************************************
+ * Name: bustrace_end
+ *
+ * Description:
+ *   The transaction on bus is over: log it and count it.
+ *
+ ************************************************************************************/
+
+void bustrace_end(uint8_t bus, uint16_t nbytes, uint8_t status)
+{
+    struct bustrace_open_s *open = &g_btopen[bus];
+    struct bustrace_hist_s *hist;
+    struct bustrace_rec_s *rec;
+    unsigned short istate;
+    uint32_t usec, v;
+    uint8_t bin = 0;
+
+    if (!open->active)
+    {
+        return;
+    }
+
+    open->active = 0;
+    usec = bustrace_now() - open->start;
+    if (g_btrate != 1000000UL && g_btrate != 0)
+    {
+        usec = (uint32_t)((uint64_t)usec * 1000000UL / g_btrate);
+    }
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    rec = &g_btring[g_bthead % BUSTRACE_NREC];
+    rec->start  = open->start;
+    rec->usec   = usec;
+    rec->nbytes = nbytes;
+    rec->bus    = bus;
+    rec->addr   = open->addr;
+    rec->op     = open->op;
+    rec->status = status;
+    g_bthead++;
+
+    for (v = usec; v > 1 && bin < BUSTRACE_NBINS - 1; v >>= 1)
+    {
+        bin++;
+    }
+
+    hist = bustrace_hist(bus, open->op);
+    if (hist->count != 0xffff)
+    {
+        hist->count++;
+    }
+    if (hist->bins[bin] != 0xffff)
+    {
+        hist->bins[bin]++;
+    }
+    if (status != BUSTRACE_OK && hist->errors != 0xffff)
+    {
+        hist->errors++;
+    }
+    hist->nbytes += nbytes;
+    if (usec > hist->maxusec)
+    {
+        hist->maxusec = usec;
+    }
+
+    __set_interrupt_state(istate);
+}
+
+/************************************************************************************
+ * Name: bustrace_reset
+ ************************************************************************************/
+
+void bustrace_reset(void)
+{
+    unsigned short istate;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    memset(g_btring, 0, sizeof(g_btring));
+    memset(g_bthist, 0, sizeof(g_bthist));
+    g_bthead = 0;
+
+    __set_interrupt_state(istate);
+}
+
+/************************************************************************************
+ * Name: bustrace_report
+ *
+ * Description:
+ *   Print the histograms, one line per command and the buckets that are not
+ *   empty as lower bound:count.
+ *
+ ************************************************************************************/
+
+void bustrace_report(void)
+{
+    struct bustrace_hist_s hist;
+    unsigned short istate;
+    uint8_t i, b;
+
+    myprintf("trace: %u transactions\r\n", (unsigned long)g_bthead);
+
+    for (i = 0; i < BUSTRACE_NHIST; i++)
+    {
+        istate = __get_interrupt_state();
+        __disable_interrupt();
+        hist = g_bthist[i];
+        __set_interrupt_state(istate);
+
+        if (hist.count == 0)
+        {
+            continue;
+        }
+
+        myprintf("%s %02x: %u tx %u bytes %u err max %u us |", hist.bus == BUSTRACE_SPI ? "spi" : "i2c",
+                 (unsigned long)hist.op, (unsigned long)hist.count, (unsigned long)hist.nbytes,
+                 (unsigned long)hist.errors, (unsigned long)hist.maxusec);
+
+        for (b = 0; b < BUSTRACE_NBINS; b++)
+        {
+            if (hist.bins[b])
+            {
+                myprintf(" %u:%u", (unsigned long)(b ? 1UL << b : 0), (unsigned long)hist.bins[b]);
+            }
+        }
+
+        myprintf("\r\n");
+    }
+}
+
+//******************************************************************************
+// Timer Interrupt *************************************************************
+//******************************************************************************
+
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=TIMER0_B1_VECTOR
+__interrupt void TIMER0_B1_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(TIMER0_B1_VECTOR))) TIMER0_B1_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    switch(__even_in_range(TB0IV, TB0IV_TBIFG))
+    {
+        case TB0IV_TBIFG:
+            g_bthi++;
+            break;
+        default: break;
+    }
+}
+
+#endif /* CONFIG_BUSTRACE */
@@ -0,0 +1,81 @@
+#ifndef __BUSTRACE_H__
+#define __BUSTRACE_H__
+
+#include <stdint.h>
+
+/* Bus transaction tracer
+ *
+ * The SPI and I2C drivers mark the start and end of every transaction. Each
+ * one is timed on TB0 (free running, ticking as close to 1us as SMCLK
+ * divides, set again by the clock_init hook) and kept in a ring of the last
+ * BUSTRACE_NREC transactions, and counted in a latency histogram per bus and
+ * command (the first SPI byte, the I2C register).
+ * Ring and histograms are in FRAM, so they survive a reset for inspection.
+ *
+ * Comment out CONFIG_BUSTRACE to compile the tracer out: the hooks in the
+ * drivers then expand to nothing.
+ */
+
+#define CONFIG_BUSTRACE
+
+#define BUSTRACE_NREC       64     /* Transactions in the ring */
+#define BUSTRACE_NHIST      16     /* Commands with a histogram, the rest share the last */
+#define BUSTRACE_NBINS      12     /* Log2 buckets: 0-1us, 2-3us, 4-7us ... 2048us and up */
+
+#define BUSTRACE_OP_DATA    0xff   /* Frame without a command byte */
+
+enum
+{
+    BUSTRACE_SPI,
+    BUSTRACE_I2C,
+    BUSTRACE_NBUS
+};
+
+enum
+{
+    BUSTRACE_OK,
+    BUSTRACE_NACK,
+    BUSTRACE_TIMEOUT,
+    BUSTRACE_ARBLOST
+};
+
+struct bustrace_rec_s
+{
+    uint32_t start;            /* TB0 time, ticks of about 1us */
+    uint32_t usec;             /* Duration */
+    uint16_t nbytes;           /* Bytes moved */
+    uint8_t  bus;
+    uint8_t  addr;             /* I2C slave address, 0 on SPI */
+    uint8_t  op;               /* Command */
+    uint8_t  status;           /* BUSTRACE_OK, NACK, TIMEOUT or ARBLOST */
+};
+
+struct bustrace_hist_s
+{
+    uint8_t  bus;
+    uint8_t  op;
+    uint16_t count;            /* Transactions, saturating like the buckets */
+    uint16_t errors;           /* NACKs, timeouts and lost arbitrations */
+    uint32_t nbytes;
+    uint32_t maxusec;
+    uint16_t bins[BUSTRACE_NBINS];
+};
+
+#ifdef CONFIG_BUSTRACE
+void bustrace_init(void);
+void bustrace_clock(unsigned long smclk);
+uint32_t bustrace_now(void);
+void bustrace_begin(uint8_t bus, uint8_t addr, uint8_t op);
+void bustrace_end(uint8_t bus, uint16_t nbytes, uint8_t status);
+void bustrace_reset(void);
+void bustrace_report(void);
+#else
+#define bustrace_init()
+#define bustrace_clock(smclk)
+#define bustrace_begin(bus, addr, op)
+#define bustrace_end(bus, nbytes, status)
+#define bustrace_reset()
+#define bustrace_report()
+#endif
+
+#endif /* __BUSTRACE_H__ */
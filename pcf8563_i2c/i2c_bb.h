@@ -0,0 +1,66 @@
+#ifndef __I2C_BB_H
+#define __I2C_BB_H
+
+#include <stdint.h>
+
+#include "i2c_interface.h"
+
+/* Bit-banged I2C master, specialized at compile time
+ *
+ * i2c_bb_impl.h is the engine body. Each inclusion generates one bus for
+ * the pins and rate #defined just before it:
+ *
+ *     #define I2C_BB_NAME     i2cbus2         function prefix
+ *     #define I2C_BB_PORT     3               P3DIR, P3IN, P3OUT, P3SEL0/1
+ *     #define I2C_BB_SCL      BIT1
+ *     #define I2C_BB_SDA      BIT2
+ *     #define I2C_BB_HZ       100000UL        SCL rate aimed for
+ *     #define I2C_BB_MCLK     16000000UL      MCLK the bus runs at
+ *     #include "i2c_bb_impl.h"
+ *
+ * and I2C_BB_DECLARE(i2cbus2) in a header gives the prototypes. Every pin
+ * access is a single bis/bic/bit on the port register and each half bit is
+ * one __delay_cycles constant, so there is no function call per bit.
+ * Both lines are open drain: PxOUT stays low and PxDIR drives them.
+ *
+ * name_transfer takes the same I2C_Xfer as I2C_Master_Transfer, with a
+ * repeated start before the read segment, so a second bus on any free pins
+ * runs the same descriptors as eUSCI_B0.
+ *
+ * SCL is released and read back before each high phase, so a slave may
+ * stretch the clock for up to I2C_BB_STRETCH polls. Past that the bus
+ * counts as stuck: I2C_Bus_Clear frees it.
+ * */
+
+#ifndef I2C_BB_STRETCH
+#define I2C_BB_STRETCH      2000    /* Polls of SCL, ~0.6ms at 16MHz */
+#endif
+
+/* Cycles spent on pin handling per half bit, taken off the delay.
+ * Checked against the SCL rate I2C_Gpio_Bench measures.
+ * */
+#define I2C_BB_OVERHEAD     12
+
+/* Half bit delay in MCLK cycles, at least 1 */
+#define I2C_BB_HALF(hz, mclk) \
+    ((mclk) / (hz) / 2 > I2C_BB_OVERHEAD + 1 ? (mclk) / (hz) / 2 - I2C_BB_OVERHEAD : 1)
+
+/* name_start, name_stop, name_write and name_read return */
+#define I2C_BB_ACK          0x00
+#define I2C_BB_NACK         0x01    /* Slave did not acknowledge */
+#define I2C_BB_STUCK        0x02    /* SCL or SDA held low */
+
+#define I2C_BB_CAT_(a, b)   a##b
+#define I2C_BB_CAT(a, b)    I2C_BB_CAT_(a, b)
+#define I2C_BB_CAT3_(a, b, c) a##b##c
+#define I2C_BB_CAT3(a, b, c) I2C_BB_CAT3_(a, b, c)
+
+#define I2C_BB_DECLARE(name) \
+    void name##_init(void); \
+    uint8_t name##_start(void); \
+    uint8_t name##_stop(void); \
+    uint8_t name##_write(uint8_t data); \
+    uint8_t name##_read(uint8_t *data, uint8_t ack); \
+    I2C_Mode name##_transfer(const I2C_Xfer *xfer)
+
+#endif
@@ -0,0 +1,191 @@
+/* Bit-banged I2C engine body, see i2c_bb.h
+ *
+ * No include guard: included once per bus, after I2C_BB_NAME, I2C_BB_PORT,
+ * I2C_BB_SCL, I2C_BB_SDA, I2C_BB_HZ and I2C_BB_MCLK are defined. They are
+ * #undef'd at the end so the next bus can define its own.
+ * */
+
+#include "i2c_bb.h"
+
+#define I2C_BB_FN(fn)       I2C_BB_CAT(I2C_BB_NAME, fn)
+#define I2C_BB_DIR          I2C_BB_CAT3(P, I2C_BB_PORT, DIR)
+#define I2C_BB_IN           I2C_BB_CAT3(P, I2C_BB_PORT, IN)
+#define I2C_BB_OUT          I2C_BB_CAT3(P, I2C_BB_PORT, OUT)
+#define I2C_BB_SEL0         I2C_BB_CAT3(P, I2C_BB_PORT, SEL0)
+#define I2C_BB_SEL1         I2C_BB_CAT3(P, I2C_BB_PORT, SEL1)
+
+#define I2C_BB_SCL_LOW()    (I2C_BB_DIR |= I2C_BB_SCL)
+#define I2C_BB_SDA_LOW()    (I2C_BB_DIR |= I2C_BB_SDA)
+#define I2C_BB_SDA_HIGH()   (I2C_BB_DIR &= ~I2C_BB_SDA)
+#define I2C_BB_SDA_READ()   (I2C_BB_IN & I2C_BB_SDA)
+#define I2C_BB_DELAY()      __delay_cycles(I2C_BB_HALF(I2C_BB_HZ, I2C_BB_MCLK))
+
+/* Releases SCL and waits while a slave stretches it, ends a high phase
+ * early with I2C_BB_STUCK */
+#define I2C_BB_SCL_HIGH() \
+    do { \
+        uint16_t poll = I2C_BB_STRETCH; \
+        I2C_BB_DIR &= ~I2C_BB_SCL; \
+        while (!(I2C_BB_IN & I2C_BB_SCL)) \
+            if (--poll == 0) \
+                return I2C_BB_STUCK; \
+    } while (0)
+
+void I2C_BB_FN(_init)(void)
+{
+    I2C_BB_SEL0 &= ~(I2C_BB_SCL + I2C_BB_SDA);
+    I2C_BB_SEL1 &= ~(I2C_BB_SCL + I2C_BB_SDA);
+    I2C_BB_DIR  &= ~(I2C_BB_SCL + I2C_BB_SDA);      // Both released, high
+    I2C_BB_OUT  &= ~(I2C_BB_SCL + I2C_BB_SDA);      // and pulled low when driven
+}
+
+/* Start, or a repeated start when SCL is low after a byte */
+uint8_t I2C_BB_FN(_start)(void)
+{
+    I2C_BB_SDA_HIGH();
+    I2C_BB_DELAY();
+    I2C_BB_SCL_HIGH();
+    if (!I2C_BB_SDA_READ())
+        return I2C_BB_STUCK;                        // Slave or other master holds SDA
+    I2C_BB_DELAY();
+    I2C_BB_SDA_LOW();                               // SDA falls while SCL is high
+    I2C_BB_DELAY();
+    I2C_BB_SCL_LOW();
+    return I2C_BB_ACK;
+}
+
+uint8_t I2C_BB_FN(_stop)(void)
+{
+    I2C_BB_SDA_LOW();
+    I2C_BB_DELAY();
+    I2C_BB_SCL_HIGH();
+    I2C_BB_DELAY();
+    I2C_BB_SDA_HIGH();                              // SDA rises while SCL is high
+    I2C_BB_DELAY();
+    return I2C_BB_SDA_READ() ? I2C_BB_ACK : I2C_BB_STUCK;
+}
+
+/* Eight data bits MSB first, then the slave's acknowledge */
+uint8_t I2C_BB_FN(_write)(uint8_t data)
+{
+    uint8_t mask, ack;
+
+    for (mask = 0x80; mask; mask >>= 1)
+    {
+        if (data & mask)
+            I2C_BB_SDA_HIGH();
+        else
+            I2C_BB_SDA_LOW();
+        I2C_BB_DELAY();
+        I2C_BB_SCL_HIGH();
+        I2C_BB_DELAY();
+        I2C_BB_SCL_LOW();
+    }
+
+    I2C_BB_SDA_HIGH();                              // Slave drives the ACK bit
+    I2C_BB_DELAY();
+    I2C_BB_SCL_HIGH();
+    ack = I2C_BB_SDA_READ() ? I2C_BB_NACK : I2C_BB_ACK;
+    I2C_BB_DELAY();
+    I2C_BB_SCL_LOW();
+
+    return ack;
+}
+
+/* Eight data bits MSB first, then ACK if ack (more bytes to come) or NACK */
+uint8_t I2C_BB_FN(_read)(uint8_t *data, uint8_t ack)
+{
+    uint8_t i, val = 0;
+
+    I2C_BB_SDA_HIGH();
+    for (i = 0; i < 8; i++)
+    {
+        I2C_BB_DELAY();
+        I2C_BB_SCL_HIGH();
+        val <<= 1;
+        if (I2C_BB_SDA_READ())
+            val |= 1;
+        I2C_BB_DELAY();
+        I2C_BB_SCL_LOW();
+    }
+
+    if (ack)
+        I2C_BB_SDA_LOW();
+    I2C_BB_DELAY();
+    I2C_BB_SCL_HIGH();
+    I2C_BB_DELAY();
+    I2C_BB_SCL_LOW();
+    I2C_BB_SDA_HIGH();
+
+    *data = val;
+    return I2C_BB_ACK;
+}
+
+I2C_Mode I2C_BB_FN(_transfer)(const I2C_Xfer *xfer)
+{
+    uint8_t reg[2];
+    uint8_t regLen;
+    uint8_t err;
+    uint16_t i;
+
+    regLen = (xfer->flags & I2C_NOREG) ? 0 : (xfer->flags & I2C_REG16) ? 2 : 1;
+    reg[0] = (regLen == 2) ? xfer->reg >> 8 : xfer->reg;
+    reg[1] = xfer->reg;
+
+    err = I2C_BB_FN(_start)();
+
+    // Write segment, also the lone address of a probe
+    if (regLen || xfer->txLen || !xfer->rxLen)
+    {
+        if (err == I2C_BB_ACK)
+            err = I2C_BB_FN(_write)(xfer->addr << 1);
+        for (i = 0; err == I2C_BB_ACK && i < regLen; i++)
+            err = I2C_BB_FN(_write)(reg[i]);
+        for (i = 0; err == I2C_BB_ACK && i < xfer->txLen; i++)
+            err = I2C_BB_FN(_write)(xfer->txData[i]);
+
+        if (err == I2C_BB_ACK && xfer->rxLen)
+        {
+            if (xfer->flags & I2C_STOPSTART)
+                err = I2C_BB_FN(_stop)();
+            if (err == I2C_BB_ACK)
+                err = I2C_BB_FN(_start)();          // Repeated start
+        }
+    }
+
+    // Read segment, every byte ACKed but the last
+    if (xfer->rxLen)
+    {
+        if (err == I2C_BB_ACK)
+            err = I2C_BB_FN(_write)((xfer->addr << 1) | 1);
+        for (i = 0; err == I2C_BB_ACK && i < xfer->rxLen; i++)
+            err = I2C_BB_FN(_read)(&xfer->rxData[i], i + 1 < xfer->rxLen);
+    }
+
+    if (I2C_BB_FN(_stop)() != I2C_BB_ACK && err == I2C_BB_ACK)
+        err = I2C_BB_STUCK;
+
+    if (err == I2C_BB_NACK)
+        return NACK_MODE;
+    return (err == I2C_BB_ACK) ? IDLE_MODE : TIMEOUT_MODE;
+}
+
+#undef I2C_BB_SCL_HIGH
+#undef I2C_BB_DELAY
+#undef I2C_BB_SDA_READ
+#undef I2C_BB_SDA_HIGH
+#undef I2C_BB_SDA_LOW
+#undef I2C_BB_SCL_LOW
+#undef I2C_BB_SEL1
+#undef I2C_BB_SEL0
+#undef I2C_BB_OUT
+#undef I2C_BB_IN
+#undef I2C_BB_DIR
+#undef I2C_BB_FN
+
+#undef I2C_BB_NAME
+#undef I2C_BB_PORT
+#undef I2C_BB_SCL
+#undef I2C_BB_SDA
+#undef I2C_BB_HZ
+#undef I2C_BB_MCLK
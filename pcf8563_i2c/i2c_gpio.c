@@ -11,11 +11,48 @@ Description : I2C software using bit-banging.
 #include <msp430.h>
 
 #include "i2c_gpio.h"
+#include "myclock.h"
+#include "myprintf.h"
 
 /*-----------------------------------------------------------------------------*/
 /* Local Macro definitions */
 /*-----------------------------------------------------------------------------*/
 
+/*-----------------------------------------------------------------------------*/
+/* Specialized bus engines */
+/*-----------------------------------------------------------------------------*/
+#define I2C_BB_NAME     i2cgpio
+#define I2C_BB_PORT     1
+#define I2C_BB_SCL      SCL
+#define I2C_BB_SDA      SDA
+#define I2C_BB_HZ       I2C_GPIO_HZ
+#define I2C_BB_MCLK     I2C_GPIO_MCLK
+#include "i2c_bb_impl.h"
+
+#ifdef I2C_GPIO_BENCH
+// The delays are fixed at compile time, so each MCLK setting gets its own copy
+#define I2C_BB_NAME     i2cgpio1m
+#define I2C_BB_PORT     1
+#define I2C_BB_SCL      SCL
+#define I2C_BB_SDA      SDA
+#define I2C_BB_HZ       I2C_GPIO_HZ
+#define I2C_BB_MCLK     1000000UL
+#include "i2c_bb_impl.h"
+
+#define I2C_BB_NAME     i2cgpio8m
+#define I2C_BB_PORT     1
+#define I2C_BB_SCL      SCL
+#define I2C_BB_SDA      SDA
+#define I2C_BB_HZ       I2C_GPIO_HZ
+#define I2C_BB_MCLK     8000000UL
+#include "i2c_bb_impl.h"
+
+I2C_BB_DECLARE(i2cgpio1m);
+I2C_BB_DECLARE(i2cgpio8m);
+
+const unsigned long benchMclk[3] = { 1000000UL, 8000000UL, I2C_GPIO_MCLK };
+#endif
+
 /*-----------------------------------------------------------------------------*/
 /* Function prototypes */
 /*-----------------------------------------------------------------------------*/
@@ -25,17 +62,16 @@ void Clear_SCL(void);
 void Clear_SDA(void);
 
 void I2C_Init(void);
-void I2C_Start(void);
 void I2C_Stop(void);
 
-void I2C_Writebit(unsigned char bit);
-unsigned char I2C_ReadByte(void);
-
-void I2C_WriteByte(unsigned char Data);
-unsigned char I2C_ReadByte(void);
+unsigned char I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength);
+unsigned char I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength);
+unsigned char I2C_Bus_Clear(void);
 
-void I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength);
-void I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength);
+#ifdef I2C_GPIO_BENCH
+I2C_Mode I2C_Gpio_Bench(unsigned char clkType, unsigned char DevideAddr, unsigned int *cycles);
+void I2C_Gpio_Bench_Report(unsigned char clkType, I2C_Mode mode, unsigned int cycles);
+#endif
 
 /*-----------------------------------------------------------------------------*/
 /* Function implementations */
@@ -104,22 +140,8 @@ void I2C_Gpio_Init(void)
     I2C_PxOUT   &= ~(SCL + SDA);
 }
 /*--------------------------------------------------------------------------------
-Function    : I2C_Start
-Purpose     : Send start signal
-Parameters  : None
-Return      : None
---------------------------------------------------------------------------------*/
-void I2C_Start(void)
-{
-    Read_SDA();             //set SDA to 1
-    I2C_DELAY();
-    Clear_SDA();            //set SDA to 0, currently SCL is 1
-    I2C_DELAY();
-    Clear_SCL();            //set SCL to 0
-}
-/*--------------------------------------------------------------------------------
 Function    : I2C_Stop
-Purpose     : Send Stop signal
+Purpose     : Send Stop signal, ends I2C_Bus_Clear
 Parameters  : None
 Return      : None
 --------------------------------------------------------------------------------*/
@@ -132,121 +154,165 @@ void I2C_Stop(void)
     Read_SDA();             //set SDA to 1
 }
 /*--------------------------------------------------------------------------------
-Function    : I2C_Writebit
-Purpose     : Write bit to I2C bus
-Parameters  : a bit need to write
-Return      : None
---------------------------------------------------------------------------------*/
-void I2C_Writebit(unsigned char bit)
-{
-    if(bit)
-        Read_SDA();
-    else
-        Clear_SDA();
-    I2C_DELAY();
-    Read_SCL();
-    I2C_DELAY();
-    Clear_SCL();
-}
-/*--------------------------------------------------------------------------------
-Function    : I2C_Readbit
-Purpose     : Read bit to I2C bus
-Parameters  : None
-Return      : unsigned char
+Function    : I2C_WriteData
+Purpose     : Write n Byte to I2C bus, on the i2cgpio engine
+Parameters  : DevideAddr    - Devide Address
+              Register      - Register Address
+              Data          - Pointer to Data need to write
+              nLength       - Number of Byte need to write
+Return      : I2C_BB_ACK, I2C_BB_NACK if a byte was not acknowledged,
+              I2C_BB_STUCK if the bus is held
 --------------------------------------------------------------------------------*/
-unsigned char I2C_Readbit(void)
+unsigned char I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength)
 {
-    unsigned char bit;
-    //Let the slave driver data
-    Read_SDA();
-    I2C_DELAY();
-    Read_SCL();
-    bit = Read_SDA();
-    I2C_DELAY();
-    Clear_SCL();
-    return bit;
+    I2C_Xfer xfer = {0};
+
+    xfer.addr = DevideAddr;
+    xfer.reg = Register;
+    xfer.txData = Data;
+    xfer.txLen = nLength;
+
+    switch (i2cgpio_transfer(&xfer))
+    {
+        case IDLE_MODE: return I2C_BB_ACK;
+        case NACK_MODE: return I2C_BB_NACK;
+        default:        return I2C_BB_STUCK;
+    }
 }
 /*--------------------------------------------------------------------------------
-Function    : I2C_WriteByte
-Purpose     : Write a Byte to I2C bus
-Parameters  : unsigned char Data
-Return      : None
+Function    : I2C_ReadData
+Purpose     : Read n Byte from I2C bus: register address, repeated start, then
+              every byte ACKed but the last
+Parameters  : DevideAddr    - Devide Address
+              Register      - Register Address
+              Buff          - Pointer to Buffer store value
+              nLength       - Number of Byte need to read
+Return      : I2C_BB_ACK, I2C_BB_NACK if a byte was not acknowledged,
+              I2C_BB_STUCK if the bus is held
 --------------------------------------------------------------------------------*/
-void I2C_WriteByte(unsigned char Data)
+unsigned char I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength)
 {
-    unsigned char nBit;
+    I2C_Xfer xfer = {0};
+
+    xfer.addr = DevideAddr;
+    xfer.reg = Register;
+    xfer.rxData = Buff;
+    xfer.rxLen = nLength;
 
-    for(nBit = 0; nBit < 8; nBit++)
+    switch (i2cgpio_transfer(&xfer))
     {
-        I2C_Writebit((Data & 0x80) != 0);
-        Data <<= 1;
+        case IDLE_MODE: return I2C_BB_ACK;
+        case NACK_MODE: return I2C_BB_NACK;
+        default:        return I2C_BB_STUCK;
     }
-    I2C_Readbit(); // Waite NACK
 }
+
 /*--------------------------------------------------------------------------------
-Function    : I2C_ReadByte
-Purpose     : Read a Byte to I2C bus
+Function    : I2C_Bus_Clear
+Purpose     : Free a bus held by a slave stuck in the middle of a byte: clock SCL
+              up to 9 times until the slave releases SDA, then send a stop.
+              SCL and SDA must be GPIO (P1SEL0 cleared) while it runs.
 Parameters  : None
-Return      : unsigned char
+Return      : 1 if SCL and SDA are both high afterwards, 0 if still held
 --------------------------------------------------------------------------------*/
-unsigned char I2C_ReadByte(void)
+unsigned char I2C_Bus_Clear(void)
 {
-    unsigned char Buff = 0;
-    unsigned char nBit;
+    unsigned char i;
+
+    I2C_Gpio_Init();
+    I2C_DELAY();
 
-    for(nBit = 0; nBit < 8; nBit++)
+    for (i = 0; i < 9 && !Read_SDA(); i++)
     {
-        Buff = (Buff << 1) | I2C_Readbit();
+        Clear_SCL();        //set SCL to 0
+        I2C_DELAY();
+        Read_SCL();         //set SCL to 1, the slave shifts out its next bit
+        I2C_DELAY();
     }
-    return Buff;
+
+    Clear_SCL();
+    I2C_DELAY();
+    I2C_Stop();
+    I2C_DELAY();
+
+    return Read_SCL() && Read_SDA();
 }
+
+#ifdef I2C_GPIO_BENCH
 /*--------------------------------------------------------------------------------
-Function    : I2C_WriteData
-Purpose     : Write n Byte to I2C bus
-Parameters  : DevideAddr    - Devide Address
-              Register      - Register Address
-              Data          - Pointer to Data need to write
-              nLength       - Number of Byte need to write
-Return      : None
+Function    : I2C_Gpio_Bench
+Purpose     : Time a read of I2C_BENCH_BYTES bytes on the engine built for
+              clkType, in MCLK cycles on TA1 (SMCLK = MCLK). clock_init(clkType)
+              must have run and SCL/SDA must be GPIO. Without a slave the
+              address is NACKed and only it is clocked.
+Parameters  : clkType       - CLOCK_1M, CLOCK_8M or CLOCK_16M
+              DevideAddr    - Devide Address
+              cycles        - Cycles taken, 0 if TA1 overflowed
+Return      : I2C_Mode of the transfer, IDLE_MODE if every byte was clocked
 --------------------------------------------------------------------------------*/
-void I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength)
+I2C_Mode I2C_Gpio_Bench(unsigned char clkType, unsigned char DevideAddr, unsigned int *cycles)
 {
-    unsigned char nIndex;
-    I2C_Start();
-    I2C_WriteByte(DevideAddr << 1);  // byDeviceAddr is 7 bit and command is write
-    I2C_WriteByte(Register);
-    for(nIndex = 0; nIndex < nLength; nIndex++)
+    unsigned char Buff[I2C_BENCH_BYTES];
+    I2C_Mode mode;
+    I2C_Xfer xfer = {0};
+
+    xfer.addr = DevideAddr;
+    xfer.flags = I2C_NOREG;
+    xfer.rxData = Buff;
+    xfer.rxLen = sizeof(Buff);
+
+    i2cgpio_init();
+
+    TA1CTL = TASSEL__SMCLK | MC__CONTINUOUS | TACLR | ID__1;
+
+    switch (clkType)
     {
-        I2C_WriteByte(*(Data + nIndex));
+        case CLOCK_1M:  mode = i2cgpio1m_transfer(&xfer); break;
+        case CLOCK_8M:  mode = i2cgpio8m_transfer(&xfer); break;
+        default:        mode = i2cgpio_transfer(&xfer); break;
     }
-    I2C_Readbit();
-    I2C_Stop();
+
+    *cycles = TA1R;
+    if (TA1CTL & TAIFG)
+        *cycles = 0;
+    TA1CTL = MC__STOP;
+
+    return mode;
 }
 /*--------------------------------------------------------------------------------
-Function    : I2C_ReadData
-Purpose     : Read n Byte from I2C bus
-Parameters  : DevideAddr    - Devide Address
-              Register      - Register Address
-              Buff          - Pointer to Buffer store value
-              nLength       - Number of Byte need to read
+Function    : I2C_Gpio_Bench_Report
+Purpose     : Print the SCL rate an I2C_Gpio_Bench run achieved: 9 clocks for
+              the address and each byte, start and stop counted in the time.
+              A run that stopped early has no rate, only its outcome.
+Parameters  : clkType       - MCLK setting the run was made at
+              mode          - Result of I2C_Gpio_Bench
+              cycles        - Cycles I2C_Gpio_Bench measured
 Return      : None
 --------------------------------------------------------------------------------*/
-void I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength)
+void I2C_Gpio_Bench_Report(unsigned char clkType, I2C_Mode mode, unsigned int cycles)
 {
-    unsigned char nIndex;
-    I2C_Start();
-    I2C_WriteByte(DevideAddr << 1);
-    I2C_WriteByte(Register);
-    I2C_Stop();
-    _NOP();                                 // Short delay
-    I2C_Start();
-    _NOP();                                 // Short delay
-    I2C_WriteByte((DevideAddr << 1) | 1);
-    for(nIndex = 0; nIndex < nLength; nIndex++)
+    unsigned long clocks = 9UL * (I2C_BENCH_BYTES + 1);
+
+    if (mode == NACK_MODE)
     {
-        *(Buff + nIndex) = I2C_ReadByte();
-        if(nIndex > 0)I2C_Writebit(ACK);
+        myprintf("bitbang mclk %u: nack\r\n", benchMclk[clkType]);
+        return;
     }
-    I2C_Writebit(NACK);
-    I2C_Stop();
+
+    if (mode != IDLE_MODE)
+    {
+        myprintf("bitbang mclk %u: bus stuck\r\n", benchMclk[clkType]);
+        return;
+    }
+
+    if (cycles == 0)
+    {
+        myprintf("bitbang mclk %u: timer overflow\r\n", benchMclk[clkType]);
+        return;
+    }
+
+    myprintf("bitbang mclk %u: target %u Hz, %u cycles for %u clocks, scl %u Hz\r\n",
+             benchMclk[clkType], I2C_GPIO_HZ, (unsigned long)cycles, clocks,
+             benchMclk[clkType] * clocks / cycles);
 }
+#endif
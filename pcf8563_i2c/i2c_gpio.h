@@ -8,9 +8,16 @@ Description : I2C software using bit-banging.
 #ifndef __I2C_GPIO_H
 #define __I2C_GPIO_H
 
+#ifdef CONFIG_I2C_SIM
+#include "i2csim.h"
+#else
 #include <msp430.h>
+#endif
+
+#include "i2c_bb.h"
 
 //#define USE_I2C_GPIO
+//#define I2C_GPIO_BENCH
 
 /*-----------------------------------------------------------------------------*/
 /* Macro definitions  */
@@ -21,6 +28,7 @@ Description : I2C software using bit-banging.
 /*-----------------------------------------------------------------------------*/
 //#define I2C_PxSEL      P1SEL
 //#define I2C_PxSEL2      P1SEL2
+#define I2C_PxSEL0      P1SEL0
 #define I2C_PxDIR       P1DIR
 #define I2C_PxOUT       P1OUT
 #define I2C_PxIN        P1IN
@@ -33,6 +41,13 @@ Description : I2C software using bit-banging.
 
 #define TIME_DELAY 100
 #define I2C_DELAY() __delay_cycles(TIME_DELAY)
+
+// I2C_WriteData / I2C_ReadData run on i2cgpio, the i2c_bb.h engine
+// specialized for these pins at this rate and MCLK
+#define I2C_GPIO_HZ     100000UL
+#define I2C_GPIO_MCLK   16000000UL
+
+#define I2C_BENCH_BYTES 16      // Bytes read per benchmark run
 /*-----------------------------------------------------------------------------*/
 /* Function prototypes  */
 /*-----------------------------------------------------------------------------*/
@@ -46,16 +61,18 @@ void Clear_SCL(void); // Actively drive SCL signal Low
 void Clear_SDA(void); // Actively drive SDA signal Low
 
 void I2C_Gpio_Init(void);
-void I2C_Start(void);
 void I2C_Stop(void);
 
-void I2C_Writebit(unsigned char bit);
-unsigned char I2C_Readbit(void);
+unsigned char I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength);
+unsigned char I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength);
+
+unsigned char I2C_Bus_Clear(void);
 
-void I2C_WriteByte(unsigned char Data);
-unsigned char I2C_ReadByte(void);
+I2C_BB_DECLARE(i2cgpio);
 
-void I2C_WriteData(unsigned char DevideAddr, unsigned char Register, unsigned char *Data, unsigned char nLength);
-void I2C_ReadData(unsigned char DevideAddr, unsigned char Register, unsigned char *Buff, unsigned char nLength);
+#ifdef I2C_GPIO_BENCH
+I2C_Mode I2C_Gpio_Bench(unsigned char clkType, unsigned char DevideAddr, unsigned int *cycles);
+void I2C_Gpio_Bench_Report(unsigned char clkType, I2C_Mode mode, unsigned int cycles);
+#endif
 
 #endif
@@ -3,30 +3,65 @@
 #include <stdint.h>
 
 #include "i2c_interface.h"
+#include "i2c_gpio.h"
 #include "pcf8563.h"
+#include "bustrace.h"
+#include "myclock.h"
 
 /* Used to track the state of the software state machine*/
 I2C_Mode MasterMode = IDLE_MODE;
 
-/* The Register Address/Command to use*/
-uint8_t TransmitRegAddr = 0;
-
-/* ReceiveBuffer: Buffer used to receive data in the ISR
- * RXByteCtr: Number of bytes left to receive
- * ReceiveIndex: The index of the next byte to be received in ReceiveBuffer
- * TransmitBuffer: Buffer used to transmit data in the ISR
- * TXByteCtr: Number of bytes left to transfer
- * TransmitIndex: The index of the next byte to be transmitted in TransmitBuffer
+/* ReceiveBuffer: Buffer I2C_Master_ReadReg receives into
+ * ActiveXfer: The transaction on the bus
+ * RegBuf: Its register address bytes
+ * SegTx: Next byte to transmit in the current segment
+ * SegRx: Where the next received byte goes
+ * SegCtr: Number of bytes left in the current segment
+ * ByteCount: Bytes moved so far, for the tracer
  * */
 uint8_t ReceiveBuffer[MAX_BUFFER_SIZE] = {0};
-uint8_t RXByteCtr = 0;
-uint8_t ReceiveIndex = 0;
-uint8_t TransmitBuffer[MAX_BUFFER_SIZE] = {0};
-uint8_t TXByteCtr = 0;
-uint8_t TransmitIndex = 0;
+const I2C_Xfer *ActiveXfer = 0;
+uint8_t RegBuf[2] = {0};
+const uint8_t *SegTx = 0;
+uint8_t *SegRx = 0;
+uint16_t SegCtr = 0;
+uint16_t ByteCount = 0;
+
+/* Transaction queue, see I2C_Queue_Submit
+ * TransQueue: Ring of submitted descriptors
+ * QueueHead: Next free slot, only advanced by the submitter
+ * QueueTail: Descriptor on the bus, only advanced by the ISR
+ * QueueBusy: Set while the ring owns the bus
+ * */
+I2C_Trans *TransQueue[I2C_QUEUE_SIZE] = {0};
+volatile uint8_t QueueHead = 0;
+volatile uint8_t QueueTail = 0;
+volatile uint8_t QueueBusy = 0;
+
+/* Transactions aborted by their TA2 deadline */
+uint16_t I2cTimeouts = 0;
+
+/* Bus speed, see I2C_Set_Speed
+ * I2cSpeed: SCL rate asked for
+ * I2cSmclk: SMCLK UCB0BRW was computed for
+ * */
+uint32_t I2cSpeed = I2C_SPEED_STANDARD;
+uint32_t I2cSmclk = 0;
+
+/* Polls of a UCTXSTT/UCTXSTP bit before the bus counts as stuck, ~10ms */
+#define I2C_SPIN_MAX        32000
 
 /* I2C Write and Read Functions */
 
+/* Runs one transaction: start, slave address, register address and write
+ * segment, then a repeated start and the read segment. Data goes straight
+ * from xfer->txData and into xfer->rxData, without a driver buffer.
+ *
+ * *xfer: The transaction
+ *           Example: { RTC_ADDR, 0, REG_SEC, NULL, 0, buf, 7 }
+ *  */
+I2C_Mode I2C_Master_Transfer(const I2C_Xfer *xfer);
+
 /* For slave device with dev_addr, writes the data specified in *reg_data
  *
  * dev_addr: The slave device address.
@@ -47,63 +82,240 @@ I2C_Mode I2C_Master_WriteReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t *reg_da
  *           Example: SLAVE_ADDR
  * reg_addr: The register or command to send to the slave.
  *           Example: CMD_TYPE_0_SLAVE
- * count: The length of data to read
+ * count: The length of data to read, at most MAX_BUFFER_SIZE
  *           Example: TYPE_0_LENGTH
  *  */
 I2C_Mode I2C_Master_ReadReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t count);
 void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count);
+uint8_t I2C_Start_Frame(const I2C_Xfer *xfer);
+void I2C_Start_Rx(uint8_t restart);
+uint8_t I2C_Tx_Next(void);
+void I2C_Stop_Frame(void);
+uint8_t I2C_Frame_Done(void);
+uint8_t I2C_Queue_Start(void);
+uint8_t I2C_Wait_Clear(uint16_t bit);
+void I2C_Arm_Timeout(uint16_t nbytes);
+void I2C_Reset(void);
+uint8_t I2C_Abort(I2C_Mode mode);
 
+#ifdef USE_I2C_DMA
+void I2C_Dma_Start(uint16_t trigger, const volatile void *src, uint16_t src_incr, volatile void *dst,
+                   uint16_t dst_incr, uint16_t count);
+#endif
 
-I2C_Mode I2C_Master_ReadReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t count)
+/* Sends the start and slave address of xfer. The write segment (register
+ * address, then txData) follows from the TX interrupt; a read-only
+ * transaction starts as receiver right away.
+ *  */
+uint8_t I2C_Start_Frame(const I2C_Xfer *xfer)
 {
-    /* Initialize state machine */
+    uint8_t regLen;
+
+    if (!I2C_Wait_Clear(UCTXSTP))               // Stop of the last transaction
+        I2C_Recover();
+
+    ActiveXfer = xfer;
+    ByteCount = 0;
+
+    regLen = (xfer->flags & I2C_NOREG) ? 0 : (xfer->flags & I2C_REG16) ? 2 : 1;
+    RegBuf[0] = (regLen == 2) ? xfer->reg >> 8 : xfer->reg;
+    RegBuf[1] = xfer->reg;
+
+    UCB0I2CSA = xfer->addr;
+    UCB0IFG &= ~(UCTXIFG + UCRXIFG + UCSTPIFG); // Clear any pending interrupts
+
+    bustrace_begin(BUSTRACE_I2C, xfer->addr, regLen ? (uint8_t)xfer->reg : BUSTRACE_OP_DATA);
+    I2C_Arm_Timeout(1 + regLen + xfer->txLen + (xfer->rxLen ? 1 + xfer->rxLen : 0));
+
+    if (regLen == 0 && xfer->txLen == 0 && xfer->rxLen)
+    {
+        I2C_Start_Rx(0);
+        return 1;
+    }
+
     MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_addr;
-    RXByteCtr = count;
-    TXByteCtr = 0;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    SegTx = RegBuf;
+    SegCtr = regLen;
 
-    /* Initialize slave address and interrupts */
-    UCB0I2CSA = dev_addr;
-    UCB0IFG &= ~(UCTXIFG + UCRXIFG);       // Clear any pending interrupts
-    UCB0IE &= ~UCRXIE;                       // Disable RX interrupt
-    UCB0IE |= UCTXIE;                        // Enable TX interrupt
+    UCB0IE &= ~UCRXIE;                          // Disable RX interrupt
+    UCB0IE |= UCTXIE;                           // Enable TX interrupt
+    UCB0CTLW0 |= UCTR + UCTXSTT;                // I2C TX, start condition
+    return 1;
+}
 
-    UCB0CTLW0 |= UCTR + UCTXSTT;             // I2C TX, start condition
+/* Turns the bus around for the read segment: a repeated start as receiver,
+ * or a stop and a new start with I2C_STOPSTART. The stop for the last byte
+ * has to be requested while it is being received, so a single byte read
+ * sets it as soon as the address went out.
+ *  */
+void I2C_Start_Rx(uint8_t restart)
+{
+    const I2C_Xfer *xfer = ActiveXfer;
 
-    __bis_SR_register(LPM0_bits + GIE);              // Enter LPM0 w/ interrupts
+    UCB0IE &= ~UCTXIE;                          // Disable TX interrupt
+    MasterMode = RX_DATA_MODE;
+    SegRx = xfer->rxData;
+    SegCtr = xfer->rxLen;
 
-    return MasterMode;
+    if (restart && (xfer->flags & I2C_STOPSTART))
+    {
+        UCB0CTLW0 |= UCTXSTP;
+        I2C_Wait_Clear(UCTXSTP);                // A stuck bus is left to the deadline
+        UCB0IFG &= ~UCSTPIFG;                   // Not the stop that ends the transaction
+    }
+
+    UCB0CTLW0 &= ~UCTR;                         // Switch to receiver
+    UCB0IFG &= ~UCRXIFG;
+
+#ifdef USE_I2C_DMA
+    if (SegCtr >= I2C_DMA_MIN)
+    {
+        // DMA2 takes all but the last byte, DMA_ISR requests the stop
+        I2C_Dma_Start(DMA2TSEL__UCB0RXIFG0, &UCB0RXBUF, DMASRCINCR_0, SegRx, DMADSTINCR_3, SegCtr - 1);
+    }
+    else
+#endif
+    {
+        UCB0IE |= UCRXIE;                       // Enable RX interrupt
+    }
+
+    UCB0CTLW0 |= UCTXSTT;                       // Send (repeated) start
+    if (SegCtr == 1)
+    {
+        //Must send stop since this is the N-1 byte
+        I2C_Wait_Clear(UCTXSTT);
+        UCB0CTLW0 |= UCTXSTP;                   // Send stop condition
+    }
 }
 
-I2C_Mode I2C_Master_WriteReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t *reg_data, uint8_t count)
+/* Called on UCTXIFG0: loads the next byte of the write segment or moves on
+ * to the read segment or the stop. Returns 1 if the CPU should leave LPM0.
+ *  */
+uint8_t I2C_Tx_Next(void)
 {
-    /* Initialize state machine */
-    MasterMode = TX_REG_ADDRESS_MODE;
-    TransmitRegAddr = reg_addr;
+    const I2C_Xfer *xfer = ActiveXfer;
+
+    for (;;)
+    {
+        if (SegCtr)
+        {
+#ifdef USE_I2C_DMA
+            if (MasterMode == TX_DATA_MODE && SegCtr >= I2C_DMA_MIN)
+            {
+                // DMA2 is edge triggered, the CPU writes the first byte
+                UCB0IE &= ~UCTXIE;
+                I2C_Dma_Start(DMA2TSEL__UCB0TXIFG0, SegTx + 1, DMASRCINCR_3, &UCB0TXBUF, DMADSTINCR_0,
+                              SegCtr - 1);
+            }
+#endif
+            UCB0TXBUF = *SegTx++;
+            SegCtr--;
+            ByteCount++;
+            return 0;
+        }
+
+        switch (MasterMode)
+        {
+            case TX_REG_ADDRESS_MODE:
+                MasterMode = TX_DATA_MODE;      // Continue with the write segment
+                SegTx = xfer->txData;
+                SegCtr = xfer->txLen;
+                break;
+
+            case TX_DATA_MODE:
+                if (xfer->rxLen)
+                {
+                    I2C_Start_Rx(1);            // Need to start receiving now
+                    return 0;
+                }
+
+                //Done with transmission, the last byte may still be NACKed
+                I2C_Stop_Frame();
+                return 0;
+
+            default:
+                return 0;
+        }
+    }
+}
 
-    //Copy register data to TransmitBuffer
-    CopyArray(reg_data, TransmitBuffer, count);
+/* Requests the stop and leaves the completion to UCSTPIFG: UCTXIFG0 of the
+ * last byte comes before its ACK, so a write or an address-only probe is
+ * only known to be through once the stop is on the bus. A stop already
+ * requested, or already out, is not requested again; UCTXSTP is read first
+ * since the stop can go out between the two tests.
+ *  */
+void I2C_Stop_Frame(void)
+{
+    UCB0IE &= ~(UCTXIE + UCRXIE);
+    UCB0IE |= UCSTPIE;
+    if (!(UCB0CTLW0 & UCTXSTP) && !(UCB0IFG & UCSTPIFG))
+        UCB0CTLW0 |= UCTXSTP;                   // Send stop condition
+}
+
+/* Called from the ISRs once a transaction is over: on UCSTPIFG after a
+ * write or a NACK, on the last byte of a read, or from I2C_Abort with the
+ * error in MasterMode. Runs once per transaction.
+ * Returns 1 if the CPU should leave LPM0.
+ *  */
+uint8_t I2C_Frame_Done(void)
+{
+    TA2CCTL0 = 0;                               // Disarm the deadline
+
+    bustrace_end(BUSTRACE_I2C, 1 + ByteCount,
+                 MasterMode == NACK_MODE ? BUSTRACE_NACK :
+                 MasterMode == ARBLOST_MODE ? BUSTRACE_ARBLOST :
+                 MasterMode == TIMEOUT_MODE ? BUSTRACE_TIMEOUT : BUSTRACE_OK);
 
-    TXByteCtr = count;
-    RXByteCtr = 0;
-    ReceiveIndex = 0;
-    TransmitIndex = 0;
+    if (QueueBusy)
+    {
+        TransQueue[QueueTail]->status = MasterMode;
+        return I2C_Queue_Start() == 0;          // Wake once the ring drained
+    }
 
-    /* Initialize slave address and interrupts */
-    UCB0I2CSA = dev_addr;
-    UCB0IFG &= ~(UCTXIFG + UCRXIFG);       // Clear any pending interrupts
-    UCB0IE &= ~UCRXIE;                       // Disable RX interrupt
-    UCB0IE |= UCTXIE;                        // Enable TX interrupt
+    return 1;
+}
 
-    UCB0CTLW0 |= UCTR + UCTXSTT;             // I2C TX, start condition
+I2C_Mode I2C_Master_Transfer(const I2C_Xfer *xfer)
+{
+    I2C_Queue_Flush();                          // The ring releases the bus first
+
+    __disable_interrupt();                      // The ISR must not run before LPM0
+
+    I2C_Start_Frame(xfer);
 
     __bis_SR_register(LPM0_bits + GIE);              // Enter LPM0 w/ interrupts
 
     return MasterMode;
 }
 
+I2C_Mode I2C_Master_ReadReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t count)
+{
+    I2C_Xfer xfer = {0};
+
+    if (count > MAX_BUFFER_SIZE)
+        count = MAX_BUFFER_SIZE;
+
+    xfer.addr = dev_addr;
+    xfer.reg = reg_addr;
+    xfer.rxData = ReceiveBuffer;
+    xfer.rxLen = count;
+
+    return I2C_Master_Transfer(&xfer);
+}
+
+I2C_Mode I2C_Master_WriteReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t *reg_data, uint8_t count)
+{
+    I2C_Xfer xfer = {0};
+
+    xfer.addr = dev_addr;
+    xfer.reg = reg_addr;
+    xfer.txData = reg_data;
+    xfer.txLen = count;
+
+    return I2C_Master_Transfer(&xfer);
+}
+
 void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count)
 {
     uint8_t copyIndex = 0;
@@ -113,15 +325,328 @@ void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count)
     }
 }
 
+//******************************************************************************
+// Transaction Queue ***********************************************************
+//******************************************************************************
+
+/* Completes the descriptor at QueueTail and starts the next one, so
+ * transactions with several slaves chain inside the ISR without waking the
+ * caller. Returns 1 while the ring owns the bus.
+ *  */
+uint8_t I2C_Queue_Start(void)
+{
+    I2C_Trans *trans;
+
+    if (QueueBusy)
+    {
+        trans = TransQueue[QueueTail];
+        QueueTail = (QueueTail + 1) & (I2C_QUEUE_SIZE - 1);
+        QueueBusy = 0;
+        if (trans->done)
+            trans->done(trans);
+    }
+
+    /* A callback may have submitted and started a transaction already */
+
+    if (!QueueBusy && QueueTail != QueueHead)
+    {
+        QueueBusy = 1;
+        I2C_Start_Frame(&TransQueue[QueueTail]->xfer);
+    }
+
+    return QueueBusy;
+}
+
+/* Appends trans to the ring and starts the bus if it is idle. Call it from
+ * the main loop or from an I2C_Callback, never from another ISR while a
+ * blocking I2C_Master_Transfer may be running. Returns 0 if the ring is full.
+ *  */
+uint8_t I2C_Queue_Submit(I2C_Trans *trans)
+{
+    unsigned short istate;
+    uint8_t next;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+
+    next = (QueueHead + 1) & (I2C_QUEUE_SIZE - 1);
+    if (next == QueueTail)
+    {
+        __set_interrupt_state(istate);
+        return 0;                              // Ring full
+    }
+
+    trans->status = TX_REG_ADDRESS_MODE;
+    TransQueue[QueueHead] = trans;
+    QueueHead = next;
+
+    if (!QueueBusy)
+        I2C_Queue_Start();
+
+    __set_interrupt_state(istate);
+    return 1;
+}
+
+/* 1 while a blocking I2C_Master_Transfer owns the bus, the modes from
+ * TX_REG_ADDRESS_MODE on are the ones of a transaction in progress.
+ *  */
+uint8_t I2C_Master_Busy(void)
+{
+    return MasterMode >= TX_REG_ADDRESS_MODE && MasterMode < TIMEOUT_MODE && !QueueBusy;
+}
+
+uint8_t I2C_Queue_Pending(void)
+{
+    return (QueueHead - QueueTail) & (I2C_QUEUE_SIZE - 1);
+}
+
+void I2C_Queue_Flush(void)
+{
+    unsigned short istate;
+
+    istate = __get_interrupt_state();
+    __disable_interrupt();
+    while (QueueBusy)
+    {
+        __bis_SR_register(LPM0_bits + GIE);    // Woken once the ring drained
+        __disable_interrupt();
+    }
+    __set_interrupt_state(istate);
+}
+
 #ifdef USE_I2C_INTERFACE
 void i2c_interface_init(void)
 {
     UCB0CTLW0 = UCSWRST;                      // Enable SW reset
     UCB0CTLW0 |= UCMODE_3 | UCMST | UCSSEL__SMCLK | UCSYNC; // I2C master mode, SMCLK
-    UCB0BRW = 160;                            // fSCL = SMCLK/160 = ~100kHz
+    UCB0BRW = 160;                            // fSCL = SMCLK/160 = ~100kHz, unless SMCLK is known
     UCB0I2CSA = RTC_ADDR;                   // Slave Address
     UCB0CTLW0 &= ~UCSWRST;                    // Clear SW reset, resume operation
-    UCB0IE |= UCNACKIE;
+    UCB0IE |= UCNACKIE | UCALIE;
+
+    I2C_Apply_Speed(clock_smclk());           // fSCL = I2cSpeed at the real SMCLK
+    clock_sethook(I2C_Apply_Speed);
+
+    TA2CTL = TASSEL__ACLK | MC__CONTINUOUS | TACLR;    // Transaction deadlines
+
+    I2C_Recover();                            // A slave may still hold SDA from before a reset
+}
+#endif
+
+//******************************************************************************
+// Bus Speed *******************************************************************
+//******************************************************************************
+
+/* Sets the SCL rate, I2C_SPEED_STANDARD, _FAST or _FASTPLUS */
+void I2C_Set_Speed(uint32_t hz)
+{
+    I2cSpeed = hz;
+    I2C_Apply_Speed(clock_smclk());
+}
+
+/* SCL rate the bus really runs at */
+uint32_t I2C_Get_Speed(void)
+{
+    return I2cSmclk / UCB0BRW;
+}
+
+/* Recomputes UCB0BRW for SMCLK = smclk. Registered with clock_sethook, so it
+ * runs whenever clock_init switches frequency. The divisor only changes in
+ * reset, which also clears UCB0IE, so the queue is drained first.
+ *  */
+void I2C_Apply_Speed(unsigned long smclk)
+{
+    uint32_t div;
+
+    if (smclk == 0)
+        return;                                 // Unknown source, keep the divisor
+
+    I2C_Queue_Flush();
+
+    div = (smclk + I2cSpeed - 1) / I2cSpeed;
+    if (div < I2C_DIV_MIN)
+        div = I2C_DIV_MIN;
+    if (div > 0xffff)
+        div = 0xffff;
+
+    I2cSmclk = smclk;
+
+    UCB0CTLW0 |= UCSWRST;
+    UCB0BRW = div;
+    UCB0CTLW0 &= ~UCSWRST;
+    UCB0IE |= UCNACKIE | UCALIE;
+}
+
+//******************************************************************************
+// Timeouts and Recovery *******************************************************
+//******************************************************************************
+
+/* Polls until bit clears in UCB0CTLW0. Returns 0 if the bus is stuck. */
+uint8_t I2C_Wait_Clear(uint16_t bit)
+{
+    uint16_t spin;
+
+    for (spin = 0; spin < I2C_SPIN_MAX; spin++)
+    {
+        if (!(UCB0CTLW0 & bit))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Arms TA2 CCR0 for a transaction of nbytes (address bytes included):
+ * twice the time their 9 clocks each take, plus I2C_TIMEOUT_MARGIN.
+ *  */
+void I2C_Arm_Timeout(uint16_t nbytes)
+{
+    uint32_t cycles, ticks;
+
+    cycles = ((uint32_t)nbytes * 9 + 3) * UCB0BRW;
+    ticks = 2 * cycles / (I2cSmclk > I2C_TIMEOUT_HZ ? I2cSmclk / I2C_TIMEOUT_HZ : 1) + I2C_TIMEOUT_MARGIN;
+    if (ticks > I2C_TIMEOUT_MAX)
+        ticks = I2C_TIMEOUT_MAX;
+
+    TA2CCR0 = TA2R + (uint16_t)ticks;
+    TA2CCTL0 = CCIE;                            // Also clears a stale CCIFG
+}
+
+/* Resets the eUSCI back into master mode. A lost arbitration leaves it
+ * addressed as slave, and the reset also clears UCB0IE.
+ *  */
+void I2C_Reset(void)
+{
+    UCB0CTLW0 |= UCSWRST;
+    UCB0CTLW0 |= UCMST;
+    UCB0CTLW0 &= ~UCSWRST;
+    UCB0IE |= UCNACKIE | UCALIE;
+}
+
+/* Frees a bus held by a slave stuck in the middle of a byte: the eUSCI lets
+ * go of the pins, which are then driven as GPIO for the 9 clock bus clear
+ * of i2c_gpio.c, and handed back. Returns 1 if both lines are high again.
+ *  */
+uint8_t I2C_Recover(void)
+{
+    uint8_t out, dir, ok;
+
+    UCB0CTLW0 |= UCSWRST;                       // Release SCL and SDA
+
+    out = I2C_PxOUT & (SCL + SDA);
+    dir = I2C_PxDIR & (SCL + SDA);
+    I2C_PxSEL0 &= ~(SCL + SDA);
+
+    ok = I2C_Bus_Clear();
+
+    I2C_PxOUT = (I2C_PxOUT & ~(SCL + SDA)) | out;
+    I2C_PxDIR = (I2C_PxDIR & ~(SCL + SDA)) | dir;
+    I2C_PxSEL0 |= SCL + SDA;
+
+    I2C_Reset();
+    return ok;
+}
+
+/* Ends the transaction on the bus with mode: stops DMA2, and after a timeout
+ * clears the bus. Lost arbitration leaves the bus to the other master.
+ * Returns 1 if the CPU should leave LPM0.
+ *  */
+uint8_t I2C_Abort(I2C_Mode mode)
+{
+#ifdef USE_I2C_DMA
+    DMA2CTL &= ~(DMAEN | DMAIFG);
+#endif
+
+    if (mode == TIMEOUT_MODE)
+    {
+        I2cTimeouts++;
+        I2C_Recover();
+    }
+    else
+    {
+        I2C_Reset();
+    }
+
+    MasterMode = mode;
+    return I2C_Frame_Done();
+}
+
+uint16_t I2C_Timeouts(void)
+{
+    return I2cTimeouts;
+}
+
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=TIMER2_A0_VECTOR
+__interrupt void TIMER2_A0_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(TIMER2_A0_VECTOR))) TIMER2_A0_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    TA2CCTL0 = 0;
+
+    if (I2C_Abort(TIMEOUT_MODE))
+        __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+}
+
+#ifdef USE_I2C_DMA
+//******************************************************************************
+// DMA Transfer Engine *********************************************************
+//******************************************************************************
+
+/* DMA2 moves the bulk of a long segment, triggered by UCB0TXIFG0 or
+ * UCB0RXIFG0; DMA0 and DMA1 stay free for the SPI driver. Only one
+ * direction is active at a time, so one channel is enough.
+ * */
+void I2C_Dma_Start(uint16_t trigger, const volatile void *src, uint16_t src_incr, volatile void *dst,
+                   uint16_t dst_incr, uint16_t count)
+{
+    DMACTL1 = (DMACTL1 & ~DMA2TSEL_31) | trigger;  // DMA3TSEL is not ours
+
+    DMA2CTL = DMADT_0 | src_incr | dst_incr | DMASRCBYTE | DMADSTBYTE | DMAIE;
+    __data16_write_addr((unsigned short)&DMA2SA, (unsigned long)src);
+    __data16_write_addr((unsigned short)&DMA2DA, (unsigned long)dst);
+    DMA2SZ = count;
+    DMA2CTL |= DMAEN;
+}
+
+/* The segment minus its last byte is through. A write waits for UCTXIFG0 of
+ * that byte again, a read requests the stop before the last byte is in.
+ * */
+#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=DMA_VECTOR
+__interrupt void DMA_ISR(void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(DMA_VECTOR))) DMA_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    switch(__even_in_range(DMAIV, DMAIV_DMA2IFG))
+    {
+        case DMAIV_NONE: break;
+        case DMAIV_DMA0IFG: break;
+        case DMAIV_DMA1IFG: break;
+        case DMAIV_DMA2IFG:
+            ByteCount += SegCtr;
+            if (MasterMode == RX_DATA_MODE)
+            {
+                ByteCount--;
+                SegRx += SegCtr - 1;
+                SegCtr = 1;
+                UCB0CTLW0 |= UCTXSTP;          // Stop after the last byte
+                UCB0IE |= UCRXIE;
+            }
+            else
+            {
+                SegTx += SegCtr;
+                SegCtr = 0;
+                UCB0IE |= UCTXIE;
+            }
+            break;
+        default: break;
+    }
 }
 #endif
 
@@ -143,12 +668,31 @@ void __attribute__ ((interrupt(USCI_B0_VECTOR))) USCI_B0_ISR (void)
   switch(__even_in_range(UCB0IV, USCI_I2C_UCBIT9IFG))
   {
     case USCI_NONE:          break;         // Vector 0: No interrupts
-    case USCI_I2C_UCALIFG:   break;         // Vector 2: ALIFG
+    case USCI_I2C_UCALIFG:                  // Vector 2: ALIFG
+        UCB0IE &= ~(UCTXIE + UCRXIE);
+        if (I2C_Abort(ARBLOST_MODE))
+            __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+      break;
     case USCI_I2C_UCNACKIFG:                // Vector 4: NACKIFG
-        __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+#ifdef USE_I2C_DMA
+        DMA2CTL &= ~(DMAEN | DMAIFG);
+#endif
+        MasterMode = NACK_MODE;
+        I2C_Stop_Frame();                   // Release the bus, done on STPIFG
       break;
     case USCI_I2C_UCSTTIFG:  break;         // Vector 6: STTIFG
-    case USCI_I2C_UCSTPIFG:  break;         // Vector 8: STPIFG
+    case USCI_I2C_UCSTPIFG:                 // Vector 8: STPIFG
+        UCB0IE &= ~UCSTPIE;
+        if (UCB0IFG & UCNACKIFG)            // NACK of the last byte not serviced yet
+        {
+            UCB0IFG &= ~UCNACKIFG;
+            MasterMode = NACK_MODE;
+        }
+        if (MasterMode != NACK_MODE)
+            MasterMode = IDLE_MODE;
+        if (I2C_Frame_Done())
+            __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+      break;
     case USCI_I2C_UCRXIFG3:  break;         // Vector 10: RXIFG3
     case USCI_I2C_UCTXIFG3:  break;         // Vector 12: TXIFG3
     case USCI_I2C_UCRXIFG2:  break;         // Vector 14: RXIFG2
@@ -157,68 +701,28 @@ void __attribute__ ((interrupt(USCI_B0_VECTOR))) USCI_B0_ISR (void)
     case USCI_I2C_UCTXIFG1:  break;         // Vector 20: TXIFG1
     case USCI_I2C_UCRXIFG0:                 // Vector 22: RXIFG0
         rx_val = UCB0RXBUF;
-        if (RXByteCtr)
+        if (SegCtr)
         {
-          ReceiveBuffer[ReceiveIndex++] = rx_val;
-          RXByteCtr--;
+          *SegRx++ = rx_val;
+          SegCtr--;
+          ByteCount++;
         }
 
-        if (RXByteCtr == 1)
+        if (SegCtr == 1)
         {
           UCB0CTLW0 |= UCTXSTP;
         }
-        else if (RXByteCtr == 0)
+        else if (SegCtr == 0)
         {
           UCB0IE &= ~UCRXIE;
           MasterMode = IDLE_MODE;
-          __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
+          if (I2C_Frame_Done())
+            __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
         }
         break;
     case USCI_I2C_UCTXIFG0:                 // Vector 24: TXIFG0
-        switch (MasterMode)
-        {
-          case TX_REG_ADDRESS_MODE:
-              UCB0TXBUF = TransmitRegAddr;
-              if (RXByteCtr)
-                  MasterMode = SWITCH_TO_RX_MODE;   // Need to start receiving now
-              else
-                  MasterMode = TX_DATA_MODE;        // Continue to transmision with the data in Transmit Buffer
-              break;
-
-          case SWITCH_TO_RX_MODE:
-              UCB0IE |= UCRXIE;              // Enable RX interrupt
-              UCB0IE &= ~UCTXIE;             // Disable TX interrupt
-              UCB0CTLW0 &= ~UCTR;            // Switch to receiver
-              MasterMode = RX_DATA_MODE;    // State state is to receive data
-              UCB0CTLW0 |= UCTXSTT;          // Send repeated start
-              if (RXByteCtr == 1)
-              {
-                  //Must send stop since this is the N-1 byte
-                  while((UCB0CTLW0 & UCTXSTT));
-                  UCB0CTLW0 |= UCTXSTP;      // Send stop condition
-              }
-              break;
-
-          case TX_DATA_MODE:
-              if (TXByteCtr)
-              {
-                  UCB0TXBUF = TransmitBuffer[TransmitIndex++];
-                  TXByteCtr--;
-              }
-              else
-              {
-                  //Done with transmission
-                  UCB0CTLW0 |= UCTXSTP;     // Send stop condition
-                  MasterMode = IDLE_MODE;
-                  UCB0IE &= ~UCTXIE;                       // disable TX interrupt
-                  __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
-              }
-              break;
-
-          default:
-              __no_operation();
-              break;
-        }
+        if (I2C_Tx_Next())
+            __bic_SR_register_on_exit(CPUOFF);      // Exit LPM0
         break;
     default: break;
   }
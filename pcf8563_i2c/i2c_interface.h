@@ -1,13 +1,20 @@
 #ifndef __I2C_INTERFACE_H
 #define __I2C_INTERFACE_H
 
+#include <stdint.h>
+
 /*
     important!!!
 
     nack received after start condition using i2c interface
     so i think maybe some hw work is needed
+
+    -> a nack right after the start means no slave acknowledged the address:
+       check the pullups on P1.6/P1.7 (4.7k, or P1REN in main.c) and RTC_ADDR.
+       It is now reported as NACK_MODE with a stop on the bus.
 */
 #define USE_I2C_INTERFACE
+#define USE_I2C_DMA
 
 #define MAX_BUFFER_SIZE     20
 
@@ -24,12 +31,121 @@ typedef enum I2C_ModeEnum{
     RX_DATA_MODE,
     SWITCH_TO_RX_MODE,
     SWITHC_TO_TX_MODE,
-    TIMEOUT_MODE
+    TIMEOUT_MODE,
+    ARBLOST_MODE
 } I2C_Mode;
 
+//******************************************************************************
+// Bus Speed *******************************************************************
+//******************************************************************************
+
+/* SCL rate asked for with I2C_Set_Speed. UCB0BRW is worked out from the
+ * SMCLK the clock system really runs at (clock_smclk), rounded so SCL never
+ * exceeds the rate, and again each time clock_init changes SMCLK.
+ * I2C_SPEED_FASTPLUS needs every slave rated for it (the PCF8563 stops at
+ * 400kHz) and stiffer pull-ups.
+ * */
+#define I2C_SPEED_STANDARD  100000UL
+#define I2C_SPEED_FAST      400000UL
+#define I2C_SPEED_FASTPLUS  1000000UL
+
+#define I2C_DIV_MIN         4       /* SCL at most SMCLK / 4 */
+
+//******************************************************************************
+// Timeouts ********************************************************************
+//******************************************************************************
+
+/* Every transaction is armed on TA2 (ACLK) with twice its clocking time plus
+ * I2C_TIMEOUT_MARGIN, which also covers clock stretching. On expiry the
+ * transaction is aborted: DMA stopped, eUSCI reset, up to 9 SCL pulses on
+ * the GPIO pins until the slave lets go of SDA, a stop, TIMEOUT_MODE
+ * reported.
+ * */
+#define I2C_TIMEOUT_HZ      32768UL
+#define I2C_TIMEOUT_MARGIN  328     /* ~10ms */
+#define I2C_TIMEOUT_MAX     0xf000  /* ~1.9s */
+
+//******************************************************************************
+// Transaction Descriptor ******************************************************
+//******************************************************************************
+
+/* I2C_Xfer.flags
+ * I2C_REG16: Two register address bytes, MSB first (EEPROMs, some sensors)
+ * I2C_NOREG: No register address, txData goes out right after the slave address
+ * I2C_STOPSTART: Stop and start between the write and the read segment, for
+ *                slaves that do not take a repeated start
+ * */
+#define I2C_REG16           0x01
+#define I2C_NOREG           0x02
+#define I2C_STOPSTART       0x04
+
+/* Segments shorter than this are moved by the ISR, longer ones by DMA2 */
+#define I2C_DMA_MIN         4
+
+/* One transaction with a slave, in this order:
+ * addr: 7 bit slave address
+ * reg / flags: Register address sent first, one byte unless I2C_REG16 or I2C_NOREG
+ * txData / txLen: Write segment, sent after the register address
+ * rxData / rxLen: Read segment, after a repeated start (or I2C_STOPSTART)
+ *
+ * With no register, no write and no read segment only the address goes out,
+ * which probes for a slave.
+ * */
+typedef struct I2C_XferStruct{
+    uint8_t addr;
+    uint8_t flags;
+    uint16_t reg;
+    const uint8_t *txData;
+    uint16_t txLen;
+    uint8_t *rxData;
+    uint16_t rxLen;
+} I2C_Xfer;
+
+//******************************************************************************
+// Transaction Queue ***********************************************************
+//******************************************************************************
+
+/* Number of ring slots, a power of two. One slot is kept free. */
+#define I2C_QUEUE_SIZE      8
+
+typedef struct I2C_TransStruct I2C_Trans;
+
+/* Runs in interrupt context once the transaction is over: after the stop
+ * of a write or a NACK, after the last byte of a read. It may submit
+ * further descriptors. */
+typedef void (*I2C_Callback)(I2C_Trans *trans);
+
+/* Queued transaction, owned by the caller until done has run
+ * xfer: The transaction, its buffers must stay valid until then
+ * done: Completion callback, may be NULL
+ * arg: Free for the submitter
+ * status: TX_REG_ADDRESS_MODE while queued, IDLE_MODE once done,
+ *         NACK_MODE if the slave did not acknowledge, ARBLOST_MODE if
+ *         another master won the bus, TIMEOUT_MODE if it was aborted
+ * */
+struct I2C_TransStruct{
+    I2C_Xfer xfer;
+    I2C_Callback done;
+    void *arg;
+    volatile I2C_Mode status;
+};
+
 extern uint8_t ReceiveBuffer[MAX_BUFFER_SIZE];
+
+I2C_Mode I2C_Master_Transfer(const I2C_Xfer *xfer);
 I2C_Mode I2C_Master_WriteReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t *reg_data, uint8_t count);
 I2C_Mode I2C_Master_ReadReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t count);
+
+uint8_t I2C_Queue_Submit(I2C_Trans *trans);
+uint8_t I2C_Queue_Pending(void);
+uint8_t I2C_Master_Busy(void);
+void I2C_Queue_Flush(void);
+uint16_t I2C_Timeouts(void);
+void I2C_Set_Speed(uint32_t hz);
+uint32_t I2C_Get_Speed(void);
+void I2C_Apply_Speed(unsigned long smclk);
+uint8_t I2C_Recover(void);
+
 void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count);
 void i2c_interface_init(void);
 #endif
@@ -0,0 +1,436 @@
+#ifdef CONFIG_I2C_SIM
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i2csim.h"
+#include "i2c_interface.h"
+#include "myprintf.h"
+
+struct i2csim_s
+{
+    uint8_t  addr;             /* 7 bit slave address */
+    uint8_t  reg16;            /* Two register pointer bytes */
+    uint8_t *regs;             /* Register file, owned by the caller */
+    uint16_t nregs;
+    uint16_t ptr;              /* Register pointer */
+};
+
+struct i2csim_s g_i2csim[I2CSIM_MAXDEV];
+uint8_t g_ni2csim;
+
+uint64_t g_i2cns;              /* Simulated time */
+uint32_t g_i2cscl = I2CSIM_SCL_HZ;  /* Rate the bus runs at, the bit time */
+uint32_t g_i2cspeed = I2CSIM_SCL_HZ; /* Rate asked for with I2C_Set_Speed */
+uint32_t g_i2csmclk;           /* SMCLK from I2C_Apply_Speed, 0 until known */
+uint16_t g_i2cnack;            /* Transactions still to NACK, i2csim_nack */
+uint16_t g_i2cstuck;           /* Transactions still to time out, i2csim_timeout */
+uint16_t I2cTimeouts;
+
+struct i2csim_stats_s g_i2cstats;
+
+uint8_t ReceiveBuffer[MAX_BUFFER_SIZE] = {0};
+
+struct i2csim_s *i2csim_find(uint8_t addr);
+void i2csim_clock(uint32_t bits);
+void i2csim_write(struct i2csim_s *sim, uint16_t nwritten, uint8_t val);
+void i2csim_scl(void);
+
+/************************************************************************************
+ * Name: i2csim_attach
+ *
+ * Description:
+ *   Add a slave at addr with nregs registers in regs. reg16 selects a two
+ *   byte register pointer. Returns the slave number or -1.
+ *
+ ************************************************************************************/
+
+int i2csim_attach(uint8_t addr, uint8_t *regs, uint16_t nregs, uint8_t reg16)
+{
+    struct i2csim_s *sim;
+
+    if (g_ni2csim == I2CSIM_MAXDEV || nregs == 0 || i2csim_find(addr))
+    {
+        return -1;
+    }
+
+    sim = &g_i2csim[g_ni2csim];
+    sim->addr  = addr;
+    sim->reg16 = reg16;
+    sim->regs  = regs;
+    sim->nregs = nregs;
+    sim->ptr   = 0;
+
+    return g_ni2csim++;
+}
+
+void i2csim_detach(void)
+{
+    g_ni2csim = 0;
+    g_i2cnack = 0;
+    g_i2cstuck = 0;
+}
+
+/************************************************************************************
+ * Name: i2csim_nack
+ *
+ * Description:
+ *   Let the next n transactions be NACKed at the address, as a slave that is
+ *   busy or missing answers.
+ *
+ ************************************************************************************/
+
+void i2csim_nack(uint16_t n)
+{
+    g_i2cnack = n;
+}
+
+/************************************************************************************
+ * Name: i2csim_timeout
+ *
+ * Description:
+ *   Let the next n transactions hang, as with a slave holding SDA low: they
+ *   end in TIMEOUT_MODE after I2CSIM_TIMEOUT_USEC and a bus clear.
+ *
+ ************************************************************************************/
+
+void i2csim_timeout(uint16_t n)
+{
+    g_i2cstuck = n;
+}
+
+void i2csim_delay(unsigned long cycles)
+{
+    g_i2cns += (uint64_t)cycles * 1000000000ULL / I2CSIM_MCLK_HZ;
+}
+
+uint32_t i2csim_usec(void)
+{
+    return (uint32_t)(g_i2cns / 1000);
+}
+
+void i2csim_stats(struct i2csim_stats_s *stats, uint8_t reset)
+{
+    *stats = g_i2cstats;
+    stats->usec = i2csim_usec();
+    if (reset)
+    {
+        memset(&g_i2cstats, 0, sizeof(g_i2cstats));
+    }
+}
+
+//******************************************************************************
+// Bus Model *******************************************************************
+//******************************************************************************
+
+struct i2csim_s *i2csim_find(uint8_t addr)
+{
+    uint8_t i;
+
+    for (i = 0; i < g_ni2csim; i++)
+    {
+        if (g_i2csim[i].addr == addr)
+        {
+            return &g_i2csim[i];
+        }
+    }
+
+    return NULL;
+}
+
+void i2csim_clock(uint32_t bits)
+{
+    g_i2cns += (uint64_t)bits * 1000000000ULL / g_i2cscl;
+}
+
+/* Byte nwritten of a write segment: pointer bytes first, then data */
+
+void i2csim_write(struct i2csim_s *sim, uint16_t nwritten, uint8_t val)
+{
+    if (sim->reg16 && nwritten == 0)
+    {
+        sim->ptr = (uint16_t)val << 8;
+        return;
+    }
+
+    if (nwritten == sim->reg16)
+    {
+        sim->ptr = ((sim->reg16 ? sim->ptr : 0) | val) % sim->nregs;
+        return;
+    }
+
+    sim->regs[sim->ptr] = val;
+    sim->ptr = (sim->ptr + 1) % sim->nregs;
+}
+
+//******************************************************************************
+// i2c_interface.c Replacement *************************************************
+//******************************************************************************
+
+/* Transactions complete as soon as they are started, so queued descriptors
+ * run and call back inside I2C_Queue_Submit and the queue is never pending.
+ */
+
+void i2c_interface_init(void)
+{
+}
+
+void CopyArray(uint8_t *source, uint8_t *dest, uint8_t count)
+{
+    memcpy(dest, source, count);
+}
+
+I2C_Mode I2C_Master_Transfer(const I2C_Xfer *xfer)
+{
+    struct i2csim_s *sim = i2csim_find(xfer->addr);
+    uint8_t reg[2];
+    uint8_t regLen;
+    uint16_t i, n = 0;
+
+    g_i2cstats.transfers++;
+    g_i2cstats.bytes++;
+    i2csim_clock(1 + 9);                       // Start, address
+
+    if (g_i2cstuck)
+    {
+        g_i2cstuck--;
+        I2cTimeouts++;
+
+        g_i2cstats.timeouts++;
+        g_i2cns += (uint64_t)I2CSIM_TIMEOUT_USEC * 1000;
+        i2csim_clock(2 * 9 + 3);               // Bus clear, stop
+        return TIMEOUT_MODE;
+    }
+
+    if (sim == NULL || g_i2cnack)
+    {
+        if (g_i2cnack)
+        {
+            g_i2cnack--;
+        }
+
+        g_i2cstats.nacks++;
+        i2csim_clock(1);                       // Stop
+        return NACK_MODE;
+    }
+
+    regLen = (xfer->flags & I2C_NOREG) ? 0 : (xfer->flags & I2C_REG16) ? 2 : 1;
+    reg[0] = (regLen == 2) ? xfer->reg >> 8 : xfer->reg;
+    reg[1] = xfer->reg;
+
+    for (i = 0; i < regLen; i++)
+    {
+        i2csim_write(sim, n++, reg[i]);
+    }
+
+    for (i = 0; i < xfer->txLen; i++)
+    {
+        i2csim_write(sim, n++, xfer->txData[i]);
+    }
+
+    if (xfer->rxLen)
+    {
+        if (n || (xfer->flags & I2C_STOPSTART))
+        {
+            g_i2cstats.bytes++;
+            i2csim_clock(1 + 9);               // Repeated start, address
+        }
+
+        for (i = 0; i < xfer->rxLen; i++)
+        {
+            xfer->rxData[i] = sim->regs[sim->ptr];
+            sim->ptr = (sim->ptr + 1) % sim->nregs;
+        }
+    }
+
+    g_i2cstats.bytes += n + xfer->rxLen;
+    i2csim_clock((uint32_t)(n + xfer->rxLen) * 9 + 1);
+
+    return IDLE_MODE;
+}
+
+I2C_Mode I2C_Master_ReadReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t count)
+{
+    I2C_Xfer xfer = {0};
+
+    if (count > MAX_BUFFER_SIZE)
+        count = MAX_BUFFER_SIZE;
+
+    xfer.addr = dev_addr;
+    xfer.reg = reg_addr;
+    xfer.rxData = ReceiveBuffer;
+    xfer.rxLen = count;
+
+    return I2C_Master_Transfer(&xfer);
+}
+
+I2C_Mode I2C_Master_WriteReg(uint8_t dev_addr, uint8_t reg_addr, uint8_t *reg_data, uint8_t count)
+{
+    I2C_Xfer xfer = {0};
+
+    xfer.addr = dev_addr;
+    xfer.reg = reg_addr;
+    xfer.txData = reg_data;
+    xfer.txLen = count;
+
+    return I2C_Master_Transfer(&xfer);
+}
+
+uint8_t I2C_Queue_Submit(I2C_Trans *trans)
+{
+    trans->status = TX_REG_ADDRESS_MODE;
+    trans->status = I2C_Master_Transfer(&trans->xfer);
+
+    if (trans->done)
+    {
+        trans->done(trans);
+    }
+
+    return 1;
+}
+
+uint8_t I2C_Queue_Pending(void)
+{
+    return 0;
+}
+
+uint8_t I2C_Master_Busy(void)
+{
+    return 0;
+}
+
+void I2C_Queue_Flush(void)
+{
+}
+
+/* SCL as i2c_interface.c would clock it: SMCLK over the divisor rounded up,
+ * so never above the rate asked for. The rate itself until an SMCLK is known.
+ */
+
+void i2csim_scl(void)
+{
+    uint32_t div;
+
+    if (g_i2csmclk == 0)
+    {
+        g_i2cscl = g_i2cspeed;
+        return;
+    }
+
+    div = (g_i2csmclk + g_i2cspeed - 1) / g_i2cspeed;
+    if (div < I2C_DIV_MIN)
+    {
+        div = I2C_DIV_MIN;
+    }
+    if (div > 0xffff)
+    {
+        div = 0xffff;
+    }
+
+    g_i2cscl = g_i2csmclk / div;
+}
+
+void I2C_Set_Speed(uint32_t hz)
+{
+    g_i2cspeed = hz;
+    i2csim_scl();
+}
+
+uint32_t I2C_Get_Speed(void)
+{
+    return g_i2cscl;
+}
+
+void I2C_Apply_Speed(unsigned long smclk)
+{
+    if (smclk == 0)
+    {
+        return;
+    }
+
+    g_i2csmclk = smclk;
+    i2csim_scl();
+}
+
+uint16_t I2C_Timeouts(void)
+{
+    return I2cTimeouts;
+}
+
+uint8_t I2C_Recover(void)
+{
+    return 1;
+}
+
+//******************************************************************************
+// myprintf.c Replacement ******************************************************
+//******************************************************************************
+
+/* Same conversions as myprintf.c (%s %c %d %u %x %X, width, '0' and '-'),
+ * every numeric argument passed as unsigned long.
+ */
+
+int myprintf(char *format, ...)
+{
+    va_list args;
+    char spec[16];
+    int n = 0;
+    int i;
+
+    va_start(args, format);
+
+    for (; *format; format++)
+    {
+        if (*format != '%')
+        {
+            putchar(*format);
+            n++;
+            continue;
+        }
+
+        spec[0] = '%';
+        for (i = 1, format++; *format && strchr("-0123456789", *format) && i < 12; format++)
+        {
+            spec[i++] = *format;
+        }
+
+        switch (*format)
+        {
+        case 's':
+            spec[i++] = 's';
+            spec[i] = 0;
+            n += printf(spec, va_arg(args, char *));
+            break;
+        case 'c':
+            putchar((int)va_arg(args, unsigned long));
+            n++;
+            break;
+        case 'd':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[i++] = 'l';
+            spec[i++] = *format;
+            spec[i] = 0;
+            if (*format == 'd')
+                n += printf(spec, (long)va_arg(args, unsigned long));
+            else
+                n += printf(spec, va_arg(args, unsigned long));
+            break;
+        case '%':
+            putchar('%');
+            n++;
+            break;
+        default:
+            format--;
+            break;
+        }
+    }
+
+    va_end(args);
+
+    return n;
+}
+
+#endif /* CONFIG_I2C_SIM */
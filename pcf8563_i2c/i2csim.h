@@ -0,0 +1,66 @@
+#ifndef __I2CSIM_H__
+#define __I2CSIM_H__
+
+#include <stdint.h>
+
+/* Host mock of the I2C bus (CONFIG_I2C_SIM)
+ *
+ * Built on a Linux host with -DCONFIG_I2C_SIM, i2csim.c stands in for
+ * i2c_interface.c and myprintf.c: every I2C_Xfer goes to a register file
+ * slave attached at its address, or is NACKed if there is none. Slaves
+ * behave like most register devices (and the PCF8563): the first one or two
+ * bytes written after the address set the register pointer, later bytes are
+ * written and read at the pointer, which auto-increments and wraps.
+ *
+ * Time is simulated at the I2C_Set_Speed rate (I2CSIM_SCL_HZ until set),
+ * divided down from the SMCLK passed to I2C_Apply_Speed as the eUSCI would,
+ * 9 clocks per byte plus start, repeated start and stop, so transaction
+ * rates come out as on the target.
+ * i2csim_nack and i2csim_timeout inject the faults the driver recovers from.
+ *
+ * This header also replaces <msp430.h> for pcf8563.c.
+ */
+
+#define I2CSIM_MAXDEV       4
+#define I2CSIM_SCL_HZ       100000UL
+#define I2CSIM_MCLK_HZ      16000000UL /* __delay_cycles rate */
+#define I2CSIM_TIMEOUT_USEC 10000      /* Deadline of a stuck transaction, I2C_TIMEOUT_MARGIN */
+
+/* msp430.h stand-ins *****************************************************/
+
+#define BIT0    0x01
+#define BIT1    0x02
+#define BIT2    0x04
+#define BIT3    0x08
+#define BIT4    0x10
+#define BIT5    0x20
+#define BIT6    0x40
+#define BIT7    0x80
+
+#define __get_interrupt_state()     0
+#define __set_interrupt_state(x)    ((void)(x))
+#define __disable_interrupt()
+#define __enable_interrupt()
+#define __no_operation()
+#define __delay_cycles(n)           i2csim_delay(n)
+
+/* Simulator ***************************************************************/
+
+struct i2csim_stats_s
+{
+    uint32_t transfers;        /* Transactions started */
+    uint32_t nacks;            /* Of those, not acknowledged */
+    uint32_t timeouts;         /* Of those, stuck until their deadline */
+    uint32_t bytes;            /* Address, register and data bytes */
+    uint32_t usec;             /* Bus time */
+};
+
+int i2csim_attach(uint8_t addr, uint8_t *regs, uint16_t nregs, uint8_t reg16);
+void i2csim_detach(void);
+void i2csim_nack(uint16_t n);
+void i2csim_timeout(uint16_t n);
+void i2csim_delay(unsigned long cycles);
+uint32_t i2csim_usec(void);
+void i2csim_stats(struct i2csim_stats_s *stats, uint8_t reset);
+
+#endif /* __I2CSIM_H__ */
@@ -32,6 +32,7 @@
 #include "i2c_interface.h"
 #include "i2c_gpio.h"
 #include "pcf8563.h"
+#include "bustrace.h"
 
 #include "myclock.h"
 #include "myprintf.h"
@@ -42,10 +43,16 @@
 
 int main(void)
 {
-    unsigned int i;
+    struct pcf8563_time_s now;
+    unsigned int i, n = 0;
     unsigned char myClock = CLOCK_16M;
     unsigned char uartCH = USCI_A1;
     unsigned char uartBR = BR_115200;
+#if defined(USE_I2C_GPIO) && defined(I2C_GPIO_BENCH)
+    unsigned int benchCycles[CLOCK_16M + 1];
+    I2C_Mode benchMode[CLOCK_16M + 1];
+    unsigned char c;
+#endif
 
     WDTCTL = WDTPW | WDTHOLD;   // Stop watchdog timer
 
@@ -72,14 +79,32 @@ int main(void)
 
 #ifdef USE_I2C_INTERFACE
     i2c_interface_init();
+    I2C_Set_Speed(I2C_SPEED_FAST);              // The PCF8563 takes 400kHz
 #endif
+    bustrace_init();
 #ifdef USE_I2C_GPIO
     I2C_Gpio_Init();
+#ifdef I2C_GPIO_BENCH
+    // One run per MCLK setting, reported once the UART is back at myClock
+    for (c = CLOCK_1M; c <= CLOCK_16M; c++)
+    {
+        clock_init(c);
+        benchMode[c] = I2C_Gpio_Bench(c, RTC_ADDR, &benchCycles[c]);
+    }
+    clock_init(myClock);
+#endif
 #endif
 
     uart_baudrate_init(myClock, uartCH, uartBR);
 	
     myprintf("pcf8563 Program Start\r\n");
+#ifdef USE_I2C_INTERFACE
+    myprintf("i2c: %u Hz\r\n", (unsigned long)I2C_Get_Speed());
+#endif
+#if defined(USE_I2C_GPIO) && defined(I2C_GPIO_BENCH)
+    for (c = CLOCK_1M; c <= CLOCK_16M; c++)
+        I2C_Gpio_Bench_Report(c, benchMode[c], benchCycles[c]);
+#endif
 
     RTC_Init();
     PCF8563_setDate(1999, 12, 31);
@@ -90,7 +115,19 @@ int main(void)
         for(i=0; i<999; i++)
             __delay_cycles(16000);
 
-        PCF8563_getDate();
-        PCF8563_getTime();
+        if (PCF8563_getDateTime(&now) == 0)
+        {
+            myprintf("%d-%d-%d %d:%d:%d%s\r\n", (long int)now.year, (long int)now.mon, (long int)now.day,
+                     (long int)now.hour, (long int)now.min, (long int)now.sec, now.vl ? " (VL)" : "");
+        }
+
+        if (++n % 60 == 0)
+        {
+            bustrace_report();
+#ifdef USE_I2C_INTERFACE
+            myprintf("rtc: retries %u failures %u timeouts %u\r\n", (unsigned long)rtcRetries,
+                     (unsigned long)rtcFailures, (unsigned long)I2C_Timeouts());
+#endif
+        }
     }
 }
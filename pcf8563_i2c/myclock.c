@@ -4,12 +4,28 @@
 #include "myclock.h"
 #include "myprintf.h"
 
+/* DCO frequency in kHz by DCOFSEL, for DCORSEL = 0 and 1 (factory trim) */
+const unsigned int dcoKHz[2][8] = {
+    { 1000, 2670, 3330, 4000, 5330, 6670, 8000, 8000 },
+    { 1000, 5330, 6670, 8000, 16000, 21000, 24000, 24000 }
+};
+
+clock_hook_t clockHook[CLOCK_NHOOKS] = {0};
+
 void clock_init(unsigned char clkType)
 {
+    unsigned char i;
+
     switch(clkType)
     {
         case CLOCK_1M:
-            // ACLK = n/a, MCLK = SMCLK = default DCO
+            // MCLK = SMCLK = DCO 1MHz, ACLK unchanged. Set explicitly so
+            // switching back down from 8/16MHz works too
+            CSCTL0_H = CSKEY >> 8;                    // Unlock clock registers
+            CSCTL1 = DCOFSEL_0;                       // Set DCO to 1MHz
+            CSCTL2 = (CSCTL2 & SELA) | SELS__DCOCLK | SELM__DCOCLK;
+            CSCTL3 = DIVA__1 | DIVS__1 | DIVM__1;     // Set all dividers
+            CSCTL0_H = 0;                             // Lock CS registers
             break;
 
         case CLOCK_8M:
@@ -44,4 +60,46 @@ void clock_init(unsigned char clkType)
             CSCTL0_H = 0;                           // Lock CS registers
             break;
     }
+
+    for (i = 0; i < CLOCK_NHOOKS; i++)
+        if (clockHook[i])
+            clockHook[i](clock_smclk());
+}
+
+/* SMCLK in Hz as the clock system is set up right now: source, DCO range
+ * and divider read back from CSCTL1-3. Returns 0 for a source of unknown
+ * frequency.
+ */
+unsigned long clock_smclk(void)
+{
+    unsigned long hz;
+
+    switch ((CSCTL2 & SELS) >> 4)
+    {
+        case 0: hz = CLOCK_LFXT_HZ; break;
+        case 1: hz = CLOCK_VLO_HZ; break;
+        case 2: hz = CLOCK_MOD_HZ / 128; break;
+        case 3:
+            hz = dcoKHz[(CSCTL1 & DCORSEL) ? 1 : 0][(CSCTL1 & DCOFSEL) >> 1] * 1000UL;
+            break;
+        case 4: hz = CLOCK_MOD_HZ; break;
+        default: hz = CLOCK_HFXT_HZ; break;
+    }
+
+    return hz >> ((CSCTL3 & DIVS) >> 4);
+}
+
+/* Adds a function clock_init calls after a change, once, up to CLOCK_NHOOKS */
+void clock_sethook(clock_hook_t hook)
+{
+    unsigned char i;
+
+    for (i = 0; i < CLOCK_NHOOKS; i++)
+    {
+        if (clockHook[i] == 0 || clockHook[i] == hook)
+        {
+            clockHook[i] = hook;
+            return;
+        }
+    }
 }
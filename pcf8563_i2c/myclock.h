@@ -6,6 +6,20 @@
 #define CLOCK_8M    1
 #define CLOCK_16M   2
 
+/* Oscillators SMCLK can run from, besides the trimmed DCO */
+#define CLOCK_LFXT_HZ       32768UL
+#define CLOCK_VLO_HZ        9400UL
+#define CLOCK_MOD_HZ        5000000UL
+#define CLOCK_HFXT_HZ       0UL         /* No HFXT crystal on the kit */
+
+/* Called by clock_init with the new SMCLK, so peripherals clocked from it
+ * can recompute their divisors. */
+typedef void (*clock_hook_t)(unsigned long smclk);
+
+#define CLOCK_NHOOKS        2           /* I2C divisor and bustrace time base */
+
 void clock_init(unsigned char clkType);
+unsigned long clock_smclk(void);
+void clock_sethook(clock_hook_t hook);
 
 #endif
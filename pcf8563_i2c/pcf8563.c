@@ -1,5 +1,9 @@
 
+#ifdef CONFIG_I2C_SIM
+#include "i2csim.h"
+#else
 #include <msp430.h>
+#endif
 #include <stdint.h>
 
 #include "i2c_interface.h"
@@ -7,45 +11,127 @@
 #include "pcf8563.h"
 #include "myprintf.h"
 
-void I2C_Scan(void) 
+/* Probes every 7 bit address with an address-only transaction and prints
+ * the ones that acknowledge.
+ */
+void I2C_Scan(void)
 {
+#ifdef USE_I2C_INTERFACE
+    I2C_Xfer xfer = {0};
+    uint8_t addr;
+
+    xfer.flags = I2C_NOREG;
 
+    for (addr = 0x08; addr < 0x78; addr++)
+    {
+        xfer.addr = addr;
+        if (I2C_Master_Transfer(&xfer) == IDLE_MODE)
+            myprintf("i2c: %02x\r\n", (unsigned long)addr);
+    }
+#endif
 }
 
+/* Retries and transactions given up after PCF8563_TRIES */
+uint16_t rtcRetries = 0;
+uint16_t rtcFailures = 0;
+
 void readyI2C(void)
 {
 }
 
+#ifdef USE_I2C_INTERFACE
+/* Runs xfer, up to PCF8563_TRIES times. A NACK or lost arbitration is tried
+ * again after a short pause, a timeout has had the bus cleared by the
+ * driver already. Returns the last I2C_Mode.
+ */
+I2C_Mode xferI2C(const I2C_Xfer *xfer)
+{
+    I2C_Mode mode;
+    uint8_t tries = 0;
+
+    for (;;)
+    {
+        mode = I2C_Master_Transfer(xfer);
+        if (mode == IDLE_MODE)
+            return mode;
+
+        if (++tries == PCF8563_TRIES)
+        {
+            rtcFailures++;
+            return mode;
+        }
+
+        rtcRetries++;
+        __delay_cycles(PCF8563_RETRY_CYCLES);
+    }
+}
+#endif
+
 void setI2C(uint8_t reg, uint8_t data)
 {
-    uint8_t txData[1] = {0,};
+    setI2CBurst(reg, &data, 1);
+}
 
-    readyI2C();
+uint8_t getI2C(uint8_t reg)
+{
+    uint8_t rxData[1] = {0,};
 
-    txData[0] = data;
+    getI2CBurst(reg, rxData, sizeof(rxData));
+
+    return rxData[0];
+}
 
+/* Reads count registers from reg on in one transaction, the PCF8563
+ * auto-increments the register address. Returns 0, or -1 once the
+ * retries are used up.
+ */
+int getI2CBurst(uint8_t reg, uint8_t *data, uint8_t count)
+{
 #ifdef USE_I2C_INTERFACE
-    I2C_Master_WriteReg(RTC_ADDR, reg, txData, sizeof(txData));
+    I2C_Xfer xfer = {0};
+#endif
+
+    readyI2C();
+
+#ifdef USE_I2C_INTERFACE
+    xfer.addr = RTC_ADDR;
+    xfer.reg = reg;
+    xfer.rxData = data;
+    xfer.rxLen = count;
+
+    if (xferI2C(&xfer) != IDLE_MODE)
+        return -1;
 #endif
 #ifdef USE_I2C_GPIO
-    I2C_WriteData((RTC_ADDR), reg, txData, sizeof(txData));
+    I2C_ReadData((RTC_ADDR), reg, data, count);
 #endif
+    return 0;
 }
 
-uint8_t getI2C(uint8_t reg)
+/* Writes count registers from reg on in one transaction.
+ * Returns 0, or -1 once the retries are used up.
+ */
+int setI2CBurst(uint8_t reg, uint8_t *data, uint8_t count)
 {
-    uint8_t rxData[1] = {0,};
+#ifdef USE_I2C_INTERFACE
+    I2C_Xfer xfer = {0};
+#endif
 
     readyI2C();
 
 #ifdef USE_I2C_INTERFACE
-    I2C_Master_ReadReg(RTC_ADDR, reg, sizeof(rxData));
-    CopyArray(ReceiveBuffer, rxData, sizeof(rxData));
+    xfer.addr = RTC_ADDR;
+    xfer.reg = reg;
+    xfer.txData = data;
+    xfer.txLen = count;
+
+    if (xferI2C(&xfer) != IDLE_MODE)
+        return -1;
 #endif
 #ifdef USE_I2C_GPIO
-    I2C_ReadData((RTC_ADDR), reg, rxData, sizeof(rxData));
+    I2C_WriteData((RTC_ADDR), reg, data, count);
 #endif
-    return rxData[0];
+    return 0;
 }
 
 void RTC_Init(void)
@@ -56,8 +142,8 @@ void RTC_Init(void)
 
 void PCF8563_setDate(uint16_t year, uint8_t mon, uint8_t day)
 {
+    mon 	= changeIntToHex(mon) | ((year > 1999) ? 0x00 : PCF8563_CENTURY);
     year	= changeIntToHex(year % 100);
-    mon 	= changeIntToHex(mon) | ((year > 1999) ? 0x00 : 0x80);
     day 	= changeIntToHex(day);
 
     setI2C(REG_YEAR, year);
@@ -67,27 +153,11 @@ void PCF8563_setDate(uint16_t year, uint8_t mon, uint8_t day)
 
 void PCF8563_getDate(void)
 {
-    uint8_t buf[3] = {0,};
-    uint8_t century = 0;
-    uint16_t year;
-    uint8_t mon, day;
-
-    buf[0] = getI2C(REG_YEAR);
-    buf[1] = getI2C(REG_MON);
-    buf[2] = getI2C(REG_DAY);
-
-    if (buf[1] & 0x80)
-        century = 1;
-
-    buf[0] = buf[0]&0xff;
-    buf[1] = buf[1]&0x1f;
-    buf[2] = buf[2]&0x3f;
+    struct pcf8563_time_s t = {0,};
 
-    year = (century == 1) ? (1900 + changeHexToInt(buf[0])) : (2000 + changeHexToInt(buf[0]));
-    mon = changeHexToInt(buf[1]);
-    day = changeHexToInt(buf[2]);
+    PCF8563_getDateTime(&t);
 
-    myprintf("%d-%d-%d ", (long int)year, (long int)mon, (long int)day);
+    myprintf("%d-%d-%d ", (long int)t.year, (long int)t.mon, (long int)t.day);
 }
 
 void PCF8563_setTime(uint8_t hour, uint8_t min, uint8_t sec)
@@ -99,11 +169,53 @@ void PCF8563_setTime(uint8_t hour, uint8_t min, uint8_t sec)
 
 void PCF8563_getTime(void)
 {
-    uint8_t hour, min, sec;
+    struct pcf8563_time_s t = {0,};
+
+    PCF8563_getDateTime(&t);
+
+    myprintf("%d:%d:%d\r\n", (long int)t.hour, (long int)t.min, (long int)t.sec);
+}
+
+/* Sets all seven time and date registers in one burst. Writing REG_SEC
+ * also clears the VL flag and restarts the prescaler, so the new second
+ * starts counting from here. Returns 0, or -1 if the RTC cannot be written.
+ */
+int PCF8563_setDateTime(const struct pcf8563_time_s *t)
+{
+    uint8_t buf[PCF8563_NTIME];
+
+    buf[0] = changeIntToHex(t->sec);
+    buf[1] = changeIntToHex(t->min);
+    buf[2] = changeIntToHex(t->hour);
+    buf[3] = changeIntToHex(t->day);
+    buf[4] = t->wday;
+    buf[5] = changeIntToHex(t->mon) | ((t->year > 1999) ? 0x00 : PCF8563_CENTURY);
+    buf[6] = changeIntToHex(t->year % 100);
+
+    return setI2CBurst(REG_SEC, buf, sizeof(buf));
+}
+
+/* Reads REG_SEC to REG_YEAR in one burst and decodes them into t. The
+ * PCF8563 freezes the time registers for the length of a transaction, so
+ * the fields cannot straddle a rollover. No formatting is done here, it is
+ * cheap enough to timestamp every record. Returns 0, or -1 if the RTC
+ * cannot be read.
+ */
+int PCF8563_getDateTime(struct pcf8563_time_s *t)
+{
+    uint8_t buf[PCF8563_NTIME];
+
+    if (getI2CBurst(REG_SEC, buf, sizeof(buf)) < 0)
+        return -1;
 
-    hour = changeHexToInt(getI2C(REG_HOUR) & 0x3f);
-    min = changeHexToInt(getI2C(REG_MIN) & 0x7f);
-    sec = changeHexToInt(getI2C(REG_SEC) & 0x7f);
+    t->vl   = (buf[0] & PCF8563_VL) ? 1 : 0;
+    t->sec  = changeHexToInt(buf[0] & 0x7f);
+    t->min  = changeHexToInt(buf[1] & 0x7f);
+    t->hour = changeHexToInt(buf[2] & 0x3f);
+    t->day  = changeHexToInt(buf[3] & 0x3f);
+    t->wday = buf[4] & 0x07;
+    t->mon  = changeHexToInt(buf[5] & 0x1f);
+    t->year = ((buf[5] & PCF8563_CENTURY) ? 1900 : 2000) + changeHexToInt(buf[6]);
 
-    myprintf("%d:%d:%d\r\n", (long int)hour, (long int)min, (long int)sec);
+    return 0;
 }
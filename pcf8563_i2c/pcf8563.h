@@ -24,6 +24,30 @@
 #define REG_TIMER_CTRL			0x0E
 #define REG_TIMER_COUNT_VAL	0x0F
 
+#define PCF8563_NTIME   7   /* REG_SEC to REG_YEAR, one auto-increment burst */
+
+#define PCF8563_VL      0x80    /* REG_SEC: clock integrity lost */
+#define PCF8563_CENTURY 0x80    /* REG_MON: set for 19xx */
+
+/* Time and date decoded from one burst, consistent across a rollover */
+struct pcf8563_time_s
+{
+    uint16_t year;          /* 1900 - 2099 */
+    uint8_t  mon;           /* 1 - 12 */
+    uint8_t  day;           /* 1 - 31 */
+    uint8_t  wday;          /* 0 - 6 */
+    uint8_t  hour;
+    uint8_t  min;
+    uint8_t  sec;
+    uint8_t  vl;            /* Oscillator stopped since the last set, time unreliable */
+};
+
+#define PCF8563_TRIES           3
+#define PCF8563_RETRY_CYCLES    16000   /* 1ms at 16MHz between tries */
+
+extern uint16_t rtcRetries;
+extern uint16_t rtcFailures;
+
 #define changeIntToHex(dec)		( ( ((dec)/10) <<4 ) + ((dec)%10) )
 #define changeHexToInt(hex)		( ( ((hex)>>4) *10 ) + ((hex)%16) )
 
@@ -31,10 +55,14 @@ void I2C_Scan(void);
 void readyI2C(void);
 void setI2C(uint8_t reg, uint8_t data);
 uint8_t getI2C(uint8_t reg);
+int setI2CBurst(uint8_t reg, uint8_t *data, uint8_t count);
+int getI2CBurst(uint8_t reg, uint8_t *data, uint8_t count);
 void RTC_Init(void);
 void PCF8563_setDate(uint16_t year, uint8_t mon, uint8_t day);
 void PCF8563_getDate(void);
 void PCF8563_setTime(uint8_t hour, uint8_t min, uint8_t sec);
 void PCF8563_getTime(void);
+int PCF8563_setDateTime(const struct pcf8563_time_s *t);
+int PCF8563_getDateTime(struct pcf8563_time_s *t);
 
 #endif
@@ -0,0 +1,1179 @@
+/* Host test: i2c_interface.c transactions, queue and error handling
+ *
+ * Builds the real i2c_interface.c against the register model in
+ * simtest/msp430.h (README, 14):
+ *
+ *   cd pcf8563_i2c
+ *   gcc -Isimtest -I. -o i2c_queue simtest/i2c_queue.c i2c_interface.c
+ *   ./i2c_queue
+ *
+ * The model clocks the bus one SCL period per step, with register file
+ * slaves at 0x50 (16 bit register address) and 0x51 (the PCF8563), and
+ * raises the USCI_B0, DMA and TA2 interrupts the way the eUSCI_B would:
+ * UCTXIFG0 at the start and whenever UCB0TXBUF moves into the shifter,
+ * UCRXIFG0 per byte with the master holding SCL until UCB0RXBUF is read,
+ * UCNACKIFG, UCALIFG and UCSTPIFG. DMA2 moves a byte on each edge of its
+ * trigger. It checks the events on the wire and the slave memory for
+ * writes and reads through the ISR and through DMA2, address-only probes,
+ * the completion order and status of queued transactions, a NACKed address
+ * and a NACKed last byte (each completing exactly once), lost arbitration,
+ * a bus held by the slave until the TA2 deadline and I2C_Recover.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <msp430.h>
+
+#include "i2c_interface.h"
+#include "i2c_gpio.h"
+#include "pcf8563.h"
+#include "myclock.h"
+#include "bustrace.h"
+
+#define I2CM_EMPTY      0x0100     /* No byte in UCB0TXBUF */
+#define I2CM_MAXWIRE    4096
+#define I2CM_SMCLK      16000000UL
+#define I2CM_ACLKDIV    (I2CM_SMCLK / I2C_TIMEOUT_HZ)
+
+#define DEV_A           RTC_ADDR   /* 8 bit register address */
+#define DEV_B           0x50       /* 16 bit register address */
+#define DEV_NONE        0x22       /* Nobody answers */
+
+void USCI_B0_ISR(void);
+void DMA_ISR(void);
+void TIMER2_A0_ISR(void);
+
+extern volatile uint8_t QueueBusy;
+
+/* Registers ***************************************************************/
+
+volatile uint16_t g_i2cm_sr = 0;
+volatile uint16_t g_i2cm_exitclr = 0;
+
+volatile uint16_t UCB0BRW, UCB0I2CSA, UCB0IE, UCB0IFG;
+volatile uint16_t DMACTL1, DMAIV;
+volatile uint16_t DMA2CTL, DMA2SZ;
+volatile unsigned long DMA2SA, DMA2DA;
+
+volatile uint16_t TA2CTL, TA2CCR0, TA2CCTL0;
+volatile uint16_t TA2R = 0xff00;           /* Deadlines wrap early on */
+
+volatile uint8_t P1OUT, P1DIR, P1IN;
+volatile uint8_t P1SEL0 = SCL + SDA;
+
+/* Model state *************************************************************/
+
+enum i2cm_phase_e
+{
+    I2CM_IDLE,                             /* Bus free */
+    I2CM_BYTE,                             /* Clocking g_shifter, g_bit clocks done */
+    I2CM_HOLD,                             /* Master holds SCL low between bytes */
+    I2CM_OTHER                             /* Another master won the bus */
+};
+
+enum i2cm_kind_e
+{
+    I2CM_ADDR,
+    I2CM_TX,
+    I2CM_RX
+};
+
+/* One event on the wire: S start, A address, W written byte, R read byte,
+ * P stop, L arbitration lost, C bus clear. ack is the 9th bit, 1 for ACK.
+ */
+
+struct i2cm_ev_s
+{
+    char ev;
+    uint8_t byte;
+    uint8_t ack;
+};
+
+struct i2cm_slave_s
+{
+    uint8_t addr;
+    uint8_t reg16;
+    uint16_t size;
+    uint16_t ptr;
+    uint8_t mem[256];
+};
+
+volatile uint16_t g_ctlw0;                 /* UCB0CTLW0 */
+volatile uint16_t g_txstage = I2CM_EMPTY;  /* UCB0TXBUF */
+volatile uint16_t g_rxbuf;                 /* UCB0RXBUF */
+volatile uint16_t g_iv;                    /* UCB0IV */
+
+enum i2cm_phase_e g_phase = I2CM_IDLE;
+enum i2cm_kind_e g_kind;
+uint8_t g_shifter;
+uint8_t g_bit;
+uint8_t g_read;                            /* Addressed for reading */
+uint8_t g_nacked;                          /* Address or last byte not acknowledged */
+uint8_t g_rxdone;                          /* Master NACKed its last byte */
+struct i2cm_slave_s *g_slave;              /* Selected slave */
+uint8_t g_regleft;                         /* Register address bytes still to come */
+uint32_t g_aclkfrac;                       /* SMCLK cycles short of the next TA2 tick */
+
+struct i2cm_slave_s g_slaves[2] = {{DEV_A, 0, 16, 0, {0}}, {DEV_B, 1, 256, 0, {0}}};
+
+/* Faults, counted down per byte or clock, 0 off */
+
+uint16_t g_nackafter;                      /* Slave NACKs the n-th written data byte */
+uint16_t g_nackaddr;                       /* Slave NACKs the n-th address */
+uint16_t g_arbafter;                       /* Arbitration lost in the n-th written data byte */
+uint32_t g_hangafter;                      /* Slave holds SCL after n clocks */
+uint8_t g_hang;                            /* SCL held until I2C_Bus_Clear */
+uint8_t g_sdastuck;                        /* SDA held low, no start possible */
+uint8_t g_nofree;                          /* I2C_Bus_Clear cannot free the bus */
+
+uint16_t g_overruns;                       /* UCB0TXBUF written while full */
+uint16_t g_straystops;                     /* UCTXSTP on a free bus */
+uint16_t g_deadlocks;                      /* LPM0 with nothing left to wake it */
+uint16_t g_busclears;                      /* I2C_Bus_Clear calls */
+uint16_t g_badclears;                      /* ... with the eUSCI still driving the pins */
+int16_t g_traces;                          /* bustrace_begin without bustrace_end */
+uint32_t g_ends;                           /* bustrace_end calls */
+
+uint32_t g_nwire;
+struct i2cm_ev_s g_wire[I2CM_MAXWIRE];
+
+void i2cm_event(char ev, uint8_t byte, uint8_t ack)
+{
+    if (g_nwire < I2CM_MAXWIRE)
+    {
+        g_wire[g_nwire].ev = ev;
+        g_wire[g_nwire].byte = byte;
+        g_wire[g_nwire].ack = ack;
+    }
+    g_nwire++;
+}
+
+void i2cm_write_addr(unsigned short reg, unsigned long addr)
+{
+    if (reg == (unsigned short)&DMA2SA)
+    {
+        DMA2SA = addr;
+    }
+    else if (reg == (unsigned short)&DMA2DA)
+    {
+        DMA2DA = addr;
+    }
+}
+
+/* Interrupt entry saves the status register and clears GIE and CPUOFF,
+ * reti restores it less what __bic_SR_register_on_exit took out.
+ */
+
+void i2cm_irq(void (*isr)(void))
+{
+    uint16_t sr = g_i2cm_sr;
+    uint16_t exitclr = g_i2cm_exitclr;
+
+    g_i2cm_sr = 0;
+    g_i2cm_exitclr = 0;
+    isr();
+    g_i2cm_sr = sr & ~g_i2cm_exitclr;
+    g_i2cm_exitclr = exitclr;
+}
+
+/* A write to UCB0TXBUF, by the CPU or DMA2, clears UCTXIFG0 */
+
+void i2cm_txwrite(uint8_t byte)
+{
+    if (g_txstage != I2CM_EMPTY)
+    {
+        g_overruns++;
+    }
+
+    g_txstage = byte;
+    UCB0IFG &= ~UCTXIFG0;
+}
+
+/* One DMA2 transfer, on the edge of its trigger */
+
+void i2cm_dma(void)
+{
+    uint8_t byte = *(uint8_t *)DMA2SA;
+
+    if (DMA2SA == (unsigned long)&g_rxbuf)
+    {
+        UCB0IFG &= ~UCRXIFG0;
+    }
+
+    if (DMA2DA == (unsigned long)&g_txstage)
+    {
+        i2cm_txwrite(byte);
+    }
+    else
+    {
+        *(uint8_t *)DMA2DA = byte;
+    }
+
+    if (DMA2CTL & DMASRCINCR_3)
+    {
+        DMA2SA++;
+    }
+    if (DMA2CTL & DMADSTINCR_3)
+    {
+        DMA2DA++;
+    }
+    if (--DMA2SZ == 0)
+    {
+        DMA2CTL = (DMA2CTL & ~DMAEN) | DMAIFG;
+    }
+}
+
+void i2cm_flag(uint16_t flag)
+{
+    uint16_t tsel = DMACTL1 & DMA2TSEL_31;
+
+    UCB0IFG |= flag;
+
+    if ((DMA2CTL & DMAEN) &&
+        ((flag == UCTXIFG0 && tsel == DMA2TSEL__UCB0TXIFG0) || (flag == UCRXIFG0 && tsel == DMA2TSEL__UCB0RXIFG0)))
+    {
+        i2cm_dma();
+    }
+}
+
+/* UCSWRST: the eUSCI lets go of the bus and clears UCB0IE, UCB0IFG and the
+ * start and stop requests. A slave in the middle of a byte stays there.
+ */
+
+void i2cm_reset(void)
+{
+    g_ctlw0 &= ~(UCTXSTT | UCTXSTP);
+    UCB0IE = 0;
+    UCB0IFG = 0;
+    g_txstage = I2CM_EMPTY;
+
+    if (g_phase == I2CM_BYTE || g_phase == I2CM_HOLD)
+    {
+        g_phase = I2CM_IDLE;
+        g_slave = 0;
+    }
+}
+
+void i2cm_tick(void)
+{
+    g_aclkfrac += UCB0BRW;
+    TA2R += g_aclkfrac / I2CM_ACLKDIV;
+    g_aclkfrac %= I2CM_ACLKDIV;
+}
+
+void i2cm_start(void)
+{
+    uint8_t i;
+
+    i2cm_event('S', 0, 0);
+
+    g_shifter = (uint8_t)(UCB0I2CSA << 1) | ((g_ctlw0 & UCTR) ? 0 : 1);
+    g_kind = I2CM_ADDR;
+    g_bit = 0;
+    g_phase = I2CM_BYTE;
+    g_nacked = 0;
+    g_rxdone = 0;
+    g_slave = 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (g_slaves[i].addr == UCB0I2CSA)
+        {
+            g_slave = &g_slaves[i];
+        }
+    }
+
+    if (g_ctlw0 & UCTR)
+    {
+        i2cm_flag(UCTXIFG0);               /* The first byte can be written */
+    }
+}
+
+void i2cm_nack(void)
+{
+    g_nacked = 1;
+    g_txstage = I2CM_EMPTY;
+    UCB0IFG &= ~UCTXIFG0;
+    i2cm_flag(UCNACKIFG);
+}
+
+/* The 9th clock of a byte */
+
+void i2cm_byte_done(void)
+{
+    uint8_t ack;
+
+    g_phase = I2CM_HOLD;
+
+    switch (g_kind)
+    {
+    case I2CM_ADDR:
+        g_ctlw0 &= ~UCTXSTT;
+        ack = g_slave != 0 && !(g_nackaddr && --g_nackaddr == 0);
+        i2cm_event('A', g_shifter, ack);
+        if (!ack)
+        {
+            i2cm_nack();
+            break;
+        }
+
+        g_read = g_shifter & 1;
+        if (!g_read)
+        {
+            g_regleft = g_slave->reg16 ? 2 : 1;
+        }
+        break;
+
+    case I2CM_TX:
+        if (g_arbafter && --g_arbafter == 0)
+        {
+            i2cm_event('L', g_shifter, 0);
+            g_ctlw0 &= ~UCMST;              /* Addressed as slave now */
+            g_txstage = I2CM_EMPTY;
+            g_phase = I2CM_OTHER;
+            g_slave = 0;
+            i2cm_flag(UCALIFG);
+            break;
+        }
+
+        ack = !(g_nackafter && --g_nackafter == 0);
+        i2cm_event('W', g_shifter, ack);
+        if (!ack)
+        {
+            i2cm_nack();
+        }
+        else if (g_regleft)
+        {
+            if (g_regleft == 2)
+            {
+                g_slave->ptr = g_shifter << 8;
+            }
+            else if (g_slave->reg16)
+            {
+                g_slave->ptr |= g_shifter;
+            }
+            else
+            {
+                g_slave->ptr = g_shifter;
+            }
+            g_regleft--;
+        }
+        else
+        {
+            g_slave->mem[g_slave->ptr++ % g_slave->size] = g_shifter;
+        }
+        break;
+
+    case I2CM_RX:
+        ack = !(g_ctlw0 & UCTXSTP);        /* The stop was asked for during the byte */
+        g_rxbuf = g_slave->mem[g_slave->ptr++ % g_slave->size];
+        i2cm_event('R', (uint8_t)g_rxbuf, ack);
+        g_rxdone = !ack;
+        i2cm_flag(UCRXIFG0);
+        break;
+    }
+}
+
+/* Advances the bus by one SCL period, or less when the master only moves
+ * UCB0TXBUF into the shifter. Returns 0 if nothing can happen without the
+ * CPU.
+ */
+
+int i2cm_step(void)
+{
+    if (g_ctlw0 & UCSWRST)
+    {
+        i2cm_reset();
+        return 0;
+    }
+
+    switch (g_phase)
+    {
+    case I2CM_IDLE:
+        if (g_ctlw0 & UCTXSTP)
+        {
+            g_ctlw0 &= ~UCTXSTP;
+            g_straystops++;
+        }
+        if (!(g_ctlw0 & UCTXSTT) || !(g_ctlw0 & UCMST) || g_sdastuck)
+        {
+            return 0;
+        }
+        i2cm_start();
+        break;
+
+    case I2CM_BYTE:
+        if (g_hang || (g_hangafter && --g_hangafter == 0))
+        {
+            g_hang = 1;
+            return 0;
+        }
+        if (++g_bit == 9)
+        {
+            i2cm_byte_done();
+        }
+        break;
+
+    case I2CM_HOLD:
+        if (!g_read && !g_nacked && g_txstage != I2CM_EMPTY)
+        {
+            g_shifter = (uint8_t)g_txstage;
+            g_txstage = I2CM_EMPTY;
+            g_kind = I2CM_TX;
+            g_bit = 0;
+            g_phase = I2CM_BYTE;
+            i2cm_flag(UCTXIFG0);
+            return 1;
+        }
+
+        if (g_ctlw0 & UCTXSTP)
+        {
+            i2cm_event('P', 0, 0);
+            g_ctlw0 &= ~UCTXSTP;
+            g_phase = I2CM_IDLE;
+            g_slave = 0;
+            i2cm_flag(UCSTPIFG);
+        }
+        else if (g_ctlw0 & UCTXSTT)
+        {
+            i2cm_start();                  /* Repeated start */
+        }
+        else if (g_read && !g_nacked && !g_rxdone && !(UCB0IFG & UCRXIFG0))
+        {
+            g_kind = I2CM_RX;
+            g_bit = 0;
+            g_phase = I2CM_BYTE;
+        }
+        else
+        {
+            return 0;
+        }
+        break;
+
+    case I2CM_OTHER:
+        g_phase = I2CM_IDLE;               /* Its stop */
+        break;
+    }
+
+    i2cm_tick();
+    return 1;
+}
+
+/* The eUSCI keeps clocking while the CPU polls UCTXSTT or UCTXSTP */
+
+volatile uint16_t *i2cm_ctlw0(void)
+{
+    i2cm_step();
+    return &g_ctlw0;
+}
+
+volatile uint16_t *i2cm_txbuf(void)
+{
+    if (g_txstage != I2CM_EMPTY)
+    {
+        g_overruns++;
+    }
+
+    g_txstage = I2CM_EMPTY;
+    UCB0IFG &= ~UCTXIFG0;
+    return &g_txstage;
+}
+
+volatile uint16_t *i2cm_rxbuf(void)
+{
+    UCB0IFG &= ~UCRXIFG0;
+    return &g_rxbuf;
+}
+
+/* Highest enabled flag first; reading UCB0IV clears it */
+
+volatile uint16_t *i2cm_iv(void)
+{
+    static const uint16_t flag[] = {UCALIFG, UCNACKIFG, UCSTPIFG, UCRXIFG0, UCTXIFG0};
+    static const uint16_t iv[] = {USCI_I2C_UCALIFG, USCI_I2C_UCNACKIFG, USCI_I2C_UCSTPIFG,
+                                  USCI_I2C_UCRXIFG0, USCI_I2C_UCTXIFG0};
+    uint8_t i;
+
+    g_iv = USCI_NONE;
+    for (i = 0; i < 5; i++)
+    {
+        if (UCB0IFG & UCB0IE & flag[i])
+        {
+            g_iv = iv[i];
+            UCB0IFG &= ~flag[i];
+            break;
+        }
+    }
+
+    return &g_iv;
+}
+
+/* Takes one pending interrupt, eUSCI_B0 before DMA before TA2 as in the
+ * vector table. Returns 0 if none is pending or GIE is clear.
+ */
+
+int i2cm_dispatch(void)
+{
+    if (!(g_i2cm_sr & GIE))
+    {
+        return 0;
+    }
+
+    if (UCB0IFG & UCB0IE & (UCALIFG | UCNACKIFG | UCSTPIFG | UCRXIFG0 | UCTXIFG0))
+    {
+        i2cm_irq(USCI_B0_ISR);
+        return 1;
+    }
+
+    if ((DMA2CTL & (DMAIFG | DMAIE)) == (DMAIFG | DMAIE))
+    {
+        DMA2CTL &= ~DMAIFG;
+        DMAIV = DMAIV_DMA2IFG;
+        i2cm_irq(DMA_ISR);
+        return 1;
+    }
+
+    if ((TA2CCTL0 & CCIE) && (int16_t)(TA2R - TA2CCR0) >= 0)
+    {
+        i2cm_irq(TIMER2_A0_ISR);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Runs the peripherals while the CPU sleeps. Time jumps to the deadline
+ * when the bus has nothing to do.
+ */
+
+void i2cm_bis_sr(uint16_t bits)
+{
+    g_i2cm_sr |= bits;
+
+    while (g_i2cm_sr & CPUOFF)
+    {
+        if (i2cm_dispatch() || i2cm_step())
+        {
+            continue;
+        }
+
+        if (!(TA2CCTL0 & CCIE))
+        {
+            g_deadlocks++;
+            g_i2cm_sr &= ~CPUOFF;
+            break;
+        }
+
+        TA2R = TA2CCR0;
+    }
+}
+
+/* i2c_gpio.c: nine clocks and a stop on the GPIO pins */
+
+unsigned char I2C_Bus_Clear(void)
+{
+    g_busclears++;
+    if (!(g_ctlw0 & UCSWRST) || (P1SEL0 & (SCL + SDA)))
+    {
+        g_badclears++;
+    }
+
+    if (g_nofree)
+    {
+        return 0;
+    }
+
+    i2cm_event('C', 0, 0);
+    g_hang = 0;
+    g_hangafter = 0;
+    g_sdastuck = 0;
+    g_phase = I2CM_IDLE;
+    g_slave = 0;
+    return 1;
+}
+
+/* myclock.c */
+
+unsigned long clock_smclk(void)
+{
+    return I2CM_SMCLK;
+}
+
+void clock_sethook(clock_hook_t hook)
+{
+    (void)hook;
+}
+
+void bustrace_begin(uint8_t bus, uint8_t addr, uint8_t op)
+{
+    (void)bus;
+    (void)addr;
+    (void)op;
+    g_traces++;
+}
+
+void bustrace_end(uint8_t bus, uint16_t nbytes, uint8_t status)
+{
+    (void)bus;
+    (void)nbytes;
+    (void)status;
+    g_traces--;
+    g_ends++;
+}
+
+/* Tests *******************************************************************/
+
+#define TEST_NTRANS     I2C_QUEUE_SIZE
+
+I2C_Trans g_trans[TEST_NTRANS];
+uint8_t g_rx[TEST_NTRANS][16];
+uint8_t g_tx[16] = {0x10, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76, 0x87, 0x98, 0xa9, 0xba, 0xcb, 0xdc, 0xed, 0xfe, 0x0f};
+
+/* Order the callbacks ran in, with the wire position at each */
+
+int g_ndone;
+int g_order[TEST_NTRANS * 2];
+uint32_t g_donewire[TEST_NTRANS * 2];
+int g_badcb;
+
+int g_fail;
+
+void test_check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("%s\n", what);
+        g_fail++;
+    }
+}
+
+void test_done(I2C_Trans *trans)
+{
+    int n = (int)(trans - g_trans);
+
+    if (trans->status == TX_REG_ADDRESS_MODE)
+    {
+        g_badcb++;
+    }
+
+    if (g_ndone < TEST_NTRANS * 2)
+    {
+        g_order[g_ndone] = n;
+        g_donewire[g_ndone] = g_nwire;
+    }
+    g_ndone++;
+
+    /* The first descriptor queues one more from interrupt context */
+
+    if (n == 0 && trans->arg)
+    {
+        I2C_Queue_Submit((I2C_Trans *)trans->arg);
+    }
+}
+
+void test_xfer(I2C_Xfer *xfer, uint8_t addr, uint8_t flags, uint16_t reg, uint16_t txLen, uint8_t *rx,
+               uint16_t rxLen)
+{
+    memset(xfer, 0, sizeof(*xfer));
+    xfer->addr = addr;
+    xfer->flags = flags;
+    xfer->reg = reg;
+    xfer->txData = txLen ? g_tx : 0;
+    xfer->txLen = txLen;
+    xfer->rxData = rx;
+    xfer->rxLen = rxLen;
+}
+
+void test_trans(int n, uint8_t addr, uint8_t flags, uint16_t reg, uint16_t txLen, uint16_t rxLen)
+{
+    I2C_Trans *trans = &g_trans[n];
+
+    memset(trans, 0, sizeof(*trans));
+    test_xfer(&trans->xfer, addr, flags, reg, txLen, rxLen ? g_rx[n] : 0, rxLen);
+    trans->done = test_done;
+}
+
+int test_ev(uint32_t *w, char ev, int byte, uint8_t ack)
+{
+    struct i2cm_ev_s *e;
+
+    if (*w >= g_nwire || *w >= I2CM_MAXWIRE)
+    {
+        return 0;
+    }
+
+    e = &g_wire[(*w)++];
+    return e->ev == ev && (byte < 0 || e->byte == byte) && (ev == 'S' || ev == 'P' || e->ack == ack);
+}
+
+/* The events of a successful xfer from wire position start on, with its
+ * replies in rxData. Returns the position after its stop, 0 on a mismatch.
+ */
+
+uint32_t test_wire(uint32_t start, const I2C_Xfer *xfer)
+{
+    uint8_t regLen = (xfer->flags & I2C_NOREG) ? 0 : (xfer->flags & I2C_REG16) ? 2 : 1;
+    uint8_t reg[2] = {(uint8_t)(regLen == 2 ? xfer->reg >> 8 : xfer->reg), (uint8_t)xfer->reg};
+    uint8_t write = regLen || xfer->txLen || !xfer->rxLen;
+    uint32_t w = start;
+    uint16_t i;
+    int ok = 1;
+
+    if (write)
+    {
+        ok &= test_ev(&w, 'S', -1, 0) && test_ev(&w, 'A', xfer->addr << 1, 1);
+        for (i = 0; i < regLen; i++)
+        {
+            ok &= test_ev(&w, 'W', reg[i], 1);
+        }
+        for (i = 0; i < xfer->txLen; i++)
+        {
+            ok &= test_ev(&w, 'W', xfer->txData[i], 1);
+        }
+        if (xfer->rxLen && (xfer->flags & I2C_STOPSTART))
+        {
+            ok &= test_ev(&w, 'P', -1, 0);
+        }
+    }
+
+    if (xfer->rxLen)
+    {
+        ok &= test_ev(&w, 'S', -1, 0) && test_ev(&w, 'A', (xfer->addr << 1) | 1, 1);
+        for (i = 0; i < xfer->rxLen; i++)
+        {
+            ok &= test_ev(&w, 'R', xfer->rxData[i], i < xfer->rxLen - 1);
+        }
+    }
+
+    ok &= test_ev(&w, 'P', -1, 0);
+
+    return ok ? w : 0;
+}
+
+struct i2cm_slave_s *test_slave(uint8_t addr)
+{
+    return addr == DEV_A ? &g_slaves[0] : &g_slaves[1];
+}
+
+void test_reset(void)
+{
+    uint16_t i;
+
+    g_nackafter = 0;
+    g_nackaddr = 0;
+    g_arbafter = 0;
+    g_hangafter = 0;
+    g_hang = 0;
+    g_sdastuck = 0;
+    g_nofree = 0;
+    g_ndone = 0;
+    g_badcb = 0;
+    memset(g_rx, 0, sizeof(g_rx));
+
+    for (i = 0; i < 256; i++)
+    {
+        g_slaves[0].mem[i] = (uint8_t)(0xa0 + i);
+        g_slaves[1].mem[i] = (uint8_t)(0x37 * i + 1);
+    }
+
+    __enable_interrupt();
+}
+
+/* The eUSCI is back to idle with only the error interrupts enabled */
+
+int test_idle(void)
+{
+    return (UCB0IE & ~(UCNACKIE | UCALIE)) == 0 && (UCB0IE & (UCNACKIE | UCALIE)) == (UCNACKIE | UCALIE) &&
+           !(DMA2CTL & DMAEN) && !(TA2CCTL0 & CCIE) && (g_ctlw0 & UCMST) && !(g_ctlw0 & UCSWRST);
+}
+
+/* Lets the bus run on after the CPU woke up: a read completes on its last
+ * byte, with the stop still to come.
+ */
+
+void test_drain(void)
+{
+    while (g_phase != I2CM_IDLE && i2cm_step());
+}
+
+/* Runs xfer as a blocking transaction; 1 if it finished with mode after
+ * exactly one completion.
+ */
+
+int test_run(const I2C_Xfer *xfer, I2C_Mode mode, uint32_t *start)
+{
+    uint32_t ends = g_ends;
+    I2C_Mode got;
+
+    *start = g_nwire;
+    got = I2C_Master_Transfer(xfer);
+    test_drain();
+    return got == mode && g_ends == ends + 1 && test_idle();
+}
+
+/* Writes and reads through the ISR and DMA2, register address variants */
+
+void test_blocking(void)
+{
+    static const struct
+    {
+        uint8_t addr;
+        uint8_t flags;
+        uint16_t reg;
+        uint16_t txLen;
+        uint16_t rxLen;
+        const char *what;
+    } cases[] = {
+        {DEV_A, 0, 2, 3, 0, "isr write"},
+        {DEV_A, 0, 3, 12, 0, "dma write"},
+        {DEV_B, I2C_REG16, 0x0123, 8, 0, "dma write, 16 bit register"},
+        {DEV_A, 0, 2, 0, 1, "one byte read"},
+        {DEV_A, 0, 2, 0, 2, "isr read"},
+        {DEV_A, 0, 2, 0, I2C_DMA_MIN - 1, "longest isr read"},
+        {DEV_A, 0, 2, 0, I2C_DMA_MIN, "shortest dma read"},
+        {DEV_A, 0, 9, 0, 7, "dma read"},
+        {DEV_B, I2C_REG16, 0x00f0, 0, 12, "dma read, 16 bit register"},
+        {DEV_B, I2C_REG16 | I2C_STOPSTART, 0x0040, 0, 5, "stop-start read"},
+        {DEV_B, I2C_NOREG, 0, 0, 6, "read only"},
+        {DEV_B, I2C_NOREG, 0, 0, 1, "one byte read only"},
+        {DEV_A, 0, 4, 2, 3, "write then read"},
+    };
+    struct i2cm_slave_s *slave;
+    I2C_Xfer xfer;
+    uint32_t start;
+    uint16_t i, ptr;
+    uint8_t c;
+    int ok;
+
+    test_reset();
+    DMACTL1 = 0x1d00;                      /* DMA3 trigger of someone else */
+
+    for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        test_xfer(&xfer, cases[c].addr, cases[c].flags, cases[c].reg, cases[c].txLen, g_rx[0], cases[c].rxLen);
+        slave = test_slave(cases[c].addr);
+        ptr = (cases[c].flags & I2C_NOREG) ? slave->ptr : cases[c].reg;
+
+        ok = test_run(&xfer, IDLE_MODE, &start) && test_wire(start, &xfer) == g_nwire;
+
+        for (i = 0; ok && i < cases[c].txLen; i++)
+        {
+            ok = slave->mem[(ptr + i) % slave->size] == g_tx[i];
+        }
+        for (i = 0; ok && i < cases[c].rxLen; i++)
+        {
+            ok = g_rx[0][i] == slave->mem[(ptr + cases[c].txLen + i) % slave->size];
+        }
+
+        test_check(ok, cases[c].what);
+    }
+
+    start = g_nwire;
+    ok = I2C_Master_ReadReg(DEV_A, 5, 4) == IDLE_MODE && ReceiveBuffer[0] == g_slaves[0].mem[5] &&
+         ReceiveBuffer[3] == g_slaves[0].mem[8];
+    test_check(ok && I2C_Master_WriteReg(DEV_A, 1, g_tx, 2) == IDLE_MODE && g_slaves[0].mem[2] == g_tx[1],
+               "ReadReg / WriteReg");
+
+    test_check((DMACTL1 & 0xff00) == 0x1d00, "DMA3 trigger changed");
+}
+
+/* An address-only probe reports whether the slave acknowledged */
+
+void test_probe(void)
+{
+    I2C_Xfer xfer;
+    uint32_t start;
+    uint8_t addr;
+    int found = 0, ok = 1;
+
+    test_reset();
+
+    for (addr = 0x08; addr < 0x78; addr++)
+    {
+        test_xfer(&xfer, addr, I2C_NOREG, 0, 0, 0, 0);
+        if (addr == DEV_A || addr == DEV_B)
+        {
+            ok &= test_run(&xfer, IDLE_MODE, &start) && test_wire(start, &xfer) == g_nwire;
+            found++;
+        }
+        else
+        {
+            ok &= test_run(&xfer, NACK_MODE, &start) && test_ev(&start, 'S', -1, 0) &&
+                  test_ev(&start, 'A', addr << 1, 0) && test_ev(&start, 'P', -1, 0) && start == g_nwire;
+        }
+    }
+
+    test_check(ok && found == 2, "address scan");
+}
+
+/* A NACKed address or data byte ends the transaction with a stop and
+ * NACK_MODE, completed once.
+ */
+
+void test_nack(void)
+{
+    static const struct
+    {
+        uint16_t txLen;
+        uint16_t nackat;                   /* Written byte, register included */
+        const char *what;
+    } cases[] = {
+        {2, 3, "isr write, last byte nacked"},
+        {2, 2, "isr write, first byte nacked"},
+        {10, 4, "dma write, byte nacked"},
+        {8, 9, "dma write, last byte nacked"},
+        {0, 1, "register nacked"},
+    };
+    I2C_Xfer xfer;
+    uint32_t start;
+    uint16_t i;
+    uint8_t c;
+    int ok;
+
+    test_reset();
+
+    for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        test_xfer(&xfer, DEV_A, 0, 1, cases[c].txLen, 0, 0);
+        g_nackafter = cases[c].nackat;
+
+        ok = test_run(&xfer, NACK_MODE, &start) && test_ev(&start, 'S', -1, 0) &&
+             test_ev(&start, 'A', DEV_A << 1, 1);
+        for (i = 1; ok && i < cases[c].nackat; i++)
+        {
+            ok = test_ev(&start, 'W', -1, 1);
+        }
+        ok = ok && test_ev(&start, 'W', -1, 0) && test_ev(&start, 'P', -1, 0) && start == g_nwire;
+        test_check(ok, cases[c].what);
+    }
+
+    test_xfer(&xfer, DEV_NONE, 0, 1, 0, g_rx[0], 4);
+    ok = test_run(&xfer, NACK_MODE, &start) && test_ev(&start, 'S', -1, 0) &&
+         test_ev(&start, 'A', DEV_NONE << 1, 0) && test_ev(&start, 'P', -1, 0) && start == g_nwire;
+    test_check(ok, "read, address nacked");
+
+    test_xfer(&xfer, DEV_NONE, I2C_NOREG, 0, 0, g_rx[0], 1);
+    ok = test_run(&xfer, NACK_MODE, &start) && test_ev(&start, 'S', -1, 0) &&
+         test_ev(&start, 'A', (DEV_NONE << 1) | 1, 0) && test_ev(&start, 'P', -1, 0) && start == g_nwire;
+    test_check(ok, "one byte read only, address nacked");
+
+    /* The stop between the segments must not pass for the final one */
+
+    test_xfer(&xfer, DEV_B, I2C_REG16 | I2C_STOPSTART, 0x0010, 0, g_rx[0], 4);
+    g_nackaddr = 2;
+    ok = test_run(&xfer, NACK_MODE, &start) && test_ev(&start, 'S', -1, 0) &&
+         test_ev(&start, 'A', DEV_B << 1, 1) && test_ev(&start, 'W', 0x00, 1) && test_ev(&start, 'W', 0x10, 1) &&
+         test_ev(&start, 'P', -1, 0) && test_ev(&start, 'S', -1, 0) && test_ev(&start, 'A', (DEV_B << 1) | 1, 0) &&
+         test_ev(&start, 'P', -1, 0) && start == g_nwire;
+    test_check(ok, "stop-start read, read address nacked");
+
+    test_xfer(&xfer, DEV_A, 0, 2, 0, g_rx[0], 7);
+    test_check(test_run(&xfer, IDLE_MODE, &start) && test_wire(start, &xfer) == g_nwire, "read after the nacks");
+}
+
+/* Transactions with both slaves chain in the handlers and complete in
+ * submission order, each once; a NACKed probe in the middle does not
+ * complete its successor. One is submitted by a callback.
+ */
+
+void test_chain(void)
+{
+    static const I2C_Mode status[] = {IDLE_MODE, NACK_MODE, IDLE_MODE, IDLE_MODE, NACK_MODE, IDLE_MODE, IDLE_MODE};
+    uint32_t start = g_nwire;
+    uint32_t ends = g_ends;
+    int i, ok;
+
+    test_reset();
+    test_trans(0, DEV_A, 0, 3, 2, 0);
+    test_trans(1, DEV_NONE, I2C_NOREG, 0, 0, 0);
+    test_trans(2, DEV_A, 0, 0, 0, 7);
+    test_trans(3, DEV_B, I2C_NOREG, 0, 0, 0);
+    test_trans(4, DEV_NONE, 0, 1, 6, 0);
+    test_trans(5, DEV_B, I2C_REG16, 0x0200, 6, 0);
+    test_trans(6, DEV_B, I2C_REG16, 0x0200, 0, 2);
+    g_trans[0].arg = &g_trans[6];
+
+    for (i = 0; i < 6; i++)
+    {
+        test_check(I2C_Queue_Submit(&g_trans[i]), "submit");
+    }
+
+    I2C_Queue_Flush();
+    test_drain();
+
+    ok = g_ndone == 7 && g_badcb == 0 && g_ends == ends + 7 && I2C_Queue_Pending() == 0 && !QueueBusy &&
+         test_idle();
+    for (i = 0; ok && i < 7; i++)
+    {
+        ok = g_order[i] == i && g_trans[i].status == status[i];
+        if (ok && status[i] == IDLE_MODE)
+        {
+            start = test_wire(start, &g_trans[i].xfer);
+            ok = start == g_donewire[i] + (g_trans[i].xfer.rxLen ? 1 : 0);
+        }
+        else if (ok)
+        {
+            start = g_donewire[i];
+        }
+    }
+
+    test_check(ok, "queue order and status");
+    test_check(g_rx[6][0] == g_tx[0] && g_rx[6][1] == g_tx[1], "queued read after queued write");
+}
+
+/* One slot stays free, and a blocking transfer waits for the ring */
+
+void test_full(void)
+{
+    uint32_t ends = g_ends;
+    I2C_Xfer xfer;
+    I2C_Mode mode;
+    int i, ok = 1;
+
+    test_reset();
+    for (i = 0; i < I2C_QUEUE_SIZE; i++)
+    {
+        test_trans(i, (i & 1) ? DEV_B : DEV_A, (i & 1) ? I2C_REG16 : 0, i, 1, 0);
+        ok &= I2C_Queue_Submit(&g_trans[i]) == (i < I2C_QUEUE_SIZE - 1);
+    }
+    test_check(ok && I2C_Queue_Pending() == I2C_QUEUE_SIZE - 1, "ring full");
+
+    test_xfer(&xfer, DEV_A, 0, 0, 0, g_rx[7], 4);
+    mode = I2C_Master_Transfer(&xfer);
+    test_drain();
+
+    ok = mode == IDLE_MODE && g_ndone == I2C_QUEUE_SIZE - 1 && g_ends == ends + I2C_QUEUE_SIZE && test_idle() &&
+         test_wire(g_donewire[I2C_QUEUE_SIZE - 2], &xfer) == g_nwire;
+    for (i = 0; ok && i < I2C_QUEUE_SIZE - 1; i++)
+    {
+        ok = g_order[i] == i && g_trans[i].status == IDLE_MODE;
+    }
+
+    test_check(ok, "blocking transfer after the ring");
+}
+
+/* Another master wins the bus: ARBLOST_MODE, the eUSCI is master again
+ * and the next transaction runs.
+ */
+
+void test_arblost(void)
+{
+    I2C_Xfer xfer;
+    uint32_t start;
+    int ok;
+
+    test_reset();
+    test_xfer(&xfer, DEV_A, 0, 0, 8, 0, 0);
+    g_arbafter = 3;
+    ok = test_run(&xfer, ARBLOST_MODE, &start);
+    test_check(ok && g_wire[g_nwire - 1].ev == 'L', "blocking, arbitration lost");
+
+    test_trans(0, DEV_B, I2C_REG16, 0x10, 2, 0);
+    test_trans(1, DEV_A, 0, 6, 0, 5);
+    g_arbafter = 2;
+    start = g_nwire;
+    I2C_Queue_Submit(&g_trans[0]);
+    I2C_Queue_Submit(&g_trans[1]);
+    I2C_Queue_Flush();
+    test_drain();
+
+    ok = g_ndone == 2 && g_order[0] == 0 && g_order[1] == 1 && g_trans[0].status == ARBLOST_MODE &&
+         g_trans[1].status == IDLE_MODE && test_idle();
+    test_check(ok && test_wire(g_donewire[0], &g_trans[1].xfer) == g_nwire, "queued, arbitration lost");
+}
+
+/* A slave holding SCL is cut loose by the TA2 deadline: TIMEOUT_MODE, the
+ * bus cleared with the pins as GPIO and handed back to the eUSCI.
+ */
+
+void test_timeout(void)
+{
+    uint16_t timeouts = I2C_Timeouts();
+    uint16_t clears = g_busclears;
+    I2C_Xfer xfer;
+    uint32_t start;
+    int ok;
+
+    test_reset();
+    test_xfer(&xfer, DEV_A, 0, 2, 0, g_rx[0], 7);
+    g_hangafter = 40;                      /* In the read segment, DMA2 running */
+    ok = test_run(&xfer, TIMEOUT_MODE, &start) && I2C_Timeouts() == timeouts + 1 &&
+         g_busclears == clears + 1 && g_badclears == 0 && (P1SEL0 & (SCL + SDA)) == SCL + SDA;
+    test_check(ok, "blocking timeout");
+
+    test_trans(0, DEV_A, 0, 1, 10, 0);
+    test_trans(1, DEV_B, I2C_REG16, 0x80, 0, 3);
+    g_hangafter = 30;
+    I2C_Queue_Submit(&g_trans[0]);
+    I2C_Queue_Submit(&g_trans[1]);
+    I2C_Queue_Flush();
+    test_drain();
+
+    ok = g_ndone == 2 && g_trans[0].status == TIMEOUT_MODE && g_trans[1].status == IDLE_MODE &&
+         I2C_Timeouts() == timeouts + 2 && test_idle();
+    test_check(ok && test_wire(g_donewire[0], &g_trans[1].xfer) == g_nwire, "queued timeout");
+
+    /* SDA held low: no start at all until the deadline clears the bus */
+
+    test_xfer(&xfer, DEV_A, 0, 0, 2, 0, 0);
+    g_sdastuck = 1;
+    ok = test_run(&xfer, TIMEOUT_MODE, &start) && !g_sdastuck;
+    test_xfer(&xfer, DEV_A, 0, 0, 2, 0, 0);
+    test_check(ok && test_run(&xfer, IDLE_MODE, &start) && test_wire(start, &xfer) == g_nwire,
+               "start blocked by SDA");
+}
+
+/* I2C_Recover frees the bus, restores the pins and the eUSCI setup */
+
+void test_recover(void)
+{
+    uint8_t out, dir;
+    int ok;
+
+    test_reset();
+    P1OUT = (P1OUT & ~(SCL + SDA)) | SDA;
+    P1DIR = (P1DIR & ~(SCL + SDA)) | SCL;
+    out = P1OUT;
+    dir = P1DIR;
+
+    g_sdastuck = 1;
+    ok = I2C_Recover() == 1 && !g_sdastuck && g_badclears == 0;
+    test_check(ok && P1OUT == out && P1DIR == dir && (P1SEL0 & (SCL + SDA)) == SCL + SDA && test_idle(),
+               "recover");
+
+    g_nofree = 1;
+    test_check(I2C_Recover() == 0 && test_idle(), "recover, bus stays stuck");
+    g_nofree = 0;
+    g_sdastuck = 0;
+}
+
+int main(void)
+{
+    i2c_interface_init();
+    test_check(UCB0BRW == I2CM_SMCLK / I2C_SPEED_STANDARD && g_busclears == 1, "init");
+
+    test_blocking();
+    test_probe();
+    test_nack();
+    test_chain();
+    test_full();
+    test_arblost();
+    test_timeout();
+    test_recover();
+
+    /* Same again at 400kHz */
+
+    I2C_Set_Speed(I2C_SPEED_FAST);
+    test_check(I2C_Get_Speed() == I2C_SPEED_FAST, "fast mode divisor");
+    test_blocking();
+    test_chain();
+    test_timeout();
+
+    test_check(g_overruns == 0 && g_straystops == 0, "eUSCI misuse");
+    test_check(g_deadlocks == 0 && g_traces == 0, "bus state");
+
+    printf("i2c_queue: %lu bus events, %d failures\n", (unsigned long)g_nwire, g_fail);
+
+    return g_fail != 0;
+}
@@ -0,0 +1,150 @@
+#ifndef __SIMTEST_MSP430_H__
+#define __SIMTEST_MSP430_H__
+
+#include <stdint.h>
+
+/* Register model of the MSP430FR6989 peripherals i2c_interface.c drives
+ *
+ * Stands in for <msp430.h> when i2c_interface.c is built on the host with
+ * -Isimtest (see i2c_queue.c). The registers are plain variables, except
+ * UCB0CTLW0, UCB0TXBUF, UCB0RXBUF and UCB0IV: every access to them goes
+ * through the model, which clocks the bus on a UCB0CTLW0 access the way
+ * the eUSCI keeps running while the CPU polls UCTXSTT or UCTXSTP, picks up
+ * a UCB0TXBUF write, clears UCRXIFG0 on a UCB0RXBUF read and the flag
+ * UCB0IV reports on an UCB0IV read. eUSCI_B0, DMA2 and TA2 are stepped by
+ * i2cm_run while the CPU sits in LPM0; interrupt handlers are called from
+ * there with the status register saved and restored as the hardware does.
+ */
+
+/* Host gcc has no MSP430 interrupt attribute */
+
+#define interrupt(vector)
+
+/* i2c_interface.c hands register addresses to __data16_write_addr as 16-bit
+ * values; on the host they are only used to tell the DMA registers apart.
+ */
+
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#define BIT0    0x01
+#define BIT1    0x02
+#define BIT2    0x04
+#define BIT3    0x08
+#define BIT4    0x10
+#define BIT5    0x20
+#define BIT6    0x40
+#define BIT7    0x80
+
+/* Status register ********************************************************/
+
+#define GIE             0x0008
+#define CPUOFF          0x0010
+#define LPM0_bits       CPUOFF
+
+#define __get_interrupt_state()         (g_i2cm_sr & GIE)
+#define __set_interrupt_state(x)        (g_i2cm_sr = (g_i2cm_sr & ~GIE) | ((x) & GIE))
+#define __disable_interrupt()           (g_i2cm_sr &= ~GIE)
+#define __enable_interrupt()            (g_i2cm_sr |= GIE)
+#define __bis_SR_register(x)            i2cm_bis_sr(x)
+#define __bic_SR_register_on_exit(x)    (g_i2cm_exitclr |= (x))
+#define __even_in_range(x, y)           (x)
+#define __data16_write_addr(reg, addr)  i2cm_write_addr(reg, addr)
+
+extern volatile uint16_t g_i2cm_sr;
+extern volatile uint16_t g_i2cm_exitclr;
+
+void i2cm_bis_sr(uint16_t bits);
+void i2cm_write_addr(unsigned short reg, unsigned long addr);
+
+/* eUSCI_B0, I2C mode *****************************************************/
+
+#define UCB0CTLW0       (*i2cm_ctlw0())
+#define UCB0TXBUF       (*i2cm_txbuf())
+#define UCB0RXBUF       (*i2cm_rxbuf())
+#define UCB0IV          (*i2cm_iv())
+
+extern volatile uint16_t UCB0BRW, UCB0I2CSA, UCB0IE, UCB0IFG;
+
+volatile uint16_t *i2cm_ctlw0(void);
+volatile uint16_t *i2cm_txbuf(void);
+volatile uint16_t *i2cm_rxbuf(void);
+volatile uint16_t *i2cm_iv(void);
+
+#define UCSWRST         0x0001
+#define UCTXSTT         0x0002
+#define UCTXSTP         0x0004
+#define UCTR            0x0010
+#define UCSSEL__SMCLK   0x00c0
+#define UCSYNC          0x0100
+#define UCMODE_3        0x0600
+#define UCMST           0x0800
+
+#define UCRXIE          0x0001
+#define UCTXIE          0x0002
+#define UCSTPIE         0x0008
+#define UCALIE          0x0010
+#define UCNACKIE        0x0020
+
+#define UCRXIFG         0x0001
+#define UCTXIFG         0x0002
+#define UCRXIFG0        0x0001
+#define UCTXIFG0        0x0002
+#define UCSTPIFG        0x0008
+#define UCALIFG         0x0010
+#define UCNACKIFG       0x0020
+
+#define USCI_NONE               0x00
+#define USCI_I2C_UCALIFG        0x02
+#define USCI_I2C_UCNACKIFG      0x04
+#define USCI_I2C_UCSTTIFG       0x06
+#define USCI_I2C_UCSTPIFG       0x08
+#define USCI_I2C_UCRXIFG3       0x0a
+#define USCI_I2C_UCTXIFG3       0x0c
+#define USCI_I2C_UCRXIFG2       0x0e
+#define USCI_I2C_UCTXIFG2       0x10
+#define USCI_I2C_UCRXIFG1       0x12
+#define USCI_I2C_UCTXIFG1       0x14
+#define USCI_I2C_UCRXIFG0       0x16
+#define USCI_I2C_UCTXIFG0       0x18
+#define USCI_I2C_UCBIT9IFG      0x1e
+
+/* DMA2 *******************************************************************/
+
+extern volatile uint16_t DMACTL1, DMAIV;
+extern volatile uint16_t DMA2CTL, DMA2SZ;
+extern volatile unsigned long DMA2SA, DMA2DA;
+
+#define DMA2TSEL_31             0x001f
+#define DMA2TSEL__UCB0RXIFG0    0x0012
+#define DMA2TSEL__UCB0TXIFG0    0x0013
+
+#define DMADT_0         0x0000
+#define DMASRCINCR_0    0x0000
+#define DMASRCINCR_3    0x0300
+#define DMADSTINCR_0    0x0000
+#define DMADSTINCR_3    0x0c00
+#define DMASRCBYTE      0x0040
+#define DMADSTBYTE      0x0080
+#define DMAEN           0x0010
+#define DMAIFG          0x0008
+#define DMAIE           0x0004
+
+#define DMAIV_NONE      0x00
+#define DMAIV_DMA0IFG   0x02
+#define DMAIV_DMA1IFG   0x04
+#define DMAIV_DMA2IFG   0x06
+
+/* TA2, transaction deadlines *********************************************/
+
+extern volatile uint16_t TA2CTL, TA2R, TA2CCR0, TA2CCTL0;
+
+#define TASSEL__ACLK    0x0100
+#define MC__CONTINUOUS  0x0020
+#define TACLR           0x0004
+#define CCIE            0x0010
+
+/* SCL (P1.7) and SDA (P1.6), eUSCI_B0 while selected in P1SEL0 ***********/
+
+extern volatile uint8_t P1OUT, P1DIR, P1IN, P1SEL0;
+
+#endif /* __SIMTEST_MSP430_H__ */